@@ -0,0 +1,873 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * Micro benchmarks of parts of the LSM tree.
+ *
+ * The makefile compiles this program to bin/lemur-bench with optimization
+ * turned on. To run a benchmark enter this command:
+ *
+ *      bin/lemur-bench filters|cache|multiget|scan|index|policy|threads|shards|merge|io|direct
+ *
+ * where
+ *      filters     Compare the false positive rate and the speed of the
+ *                  classic and blocked bloom filters.
+ *      cache       Compare lookups with a Zipfian distribution with and
+ *                  without a page cache. The store is written to data/.
+ *      multiget    Compare looking up batches of keys with MultiGet and
+ *                  with one Get for each key.
+ *      scan        Compare reading ranges of keys with Scan and with one Get
+ *                  for each key in the range.
+ *      index       Compare lookups using the fence posts and learned indexes
+ *                  with different error bounds, and the memory they use.
+ *      policy      Compare writes and lookups with leveling, tiering, and
+ *                  tiering the upper levels and leveling the lower ones.
+ *      threads     Look up keys on more and more threads while one thread
+ *                  puts, and compare the lookups and puts per second.
+ *      shards      Fill a store split into more and more shards, each putting
+ *                  on its own thread, and compare the puts and lookups per
+ *                  second. The shards are written to data/shards/.
+ *      merge       Fill a store which splits big merges over more and more
+ *                  threads, and compare the puts per second.
+ *      io          Fill a store whose merges use blocking I/O, and then
+ *                  io_uring or helper threads with more and more pages read
+ *                  ahead, and compare the puts per second.
+ *      direct      Look up keys on one thread while another puts, with
+ *                  buffered and direct I/O merges, and compare the lookup
+ *                  latencies.
+ */
+
+#include "../src/bloomfilter.hpp"
+#include "../src/store.hpp"
+#include "../src/shardedstore.hpp"
+#include "../src/test.hpp"
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include <sstream>
+#include <thread>
+#include <atomic>
+
+using namespace kv;
+
+void benchFilters();
+void benchCache();
+void benchMultiGet();
+void benchScan();
+void benchIndex();
+void benchPolicy();
+void benchThreads();
+void benchShards();
+void benchMerge();
+void benchIo();
+void benchDirect();
+
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && strcmp(argv[1], "filters") == 0)
+    {
+        benchFilters();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "cache") == 0)
+    {
+        benchCache();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "multiget") == 0)
+    {
+        benchMultiGet();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "scan") == 0)
+    {
+        benchScan();
+        return 0;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "index") == 0)
+    {
+        benchIndex();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "policy") == 0)
+    {
+        benchPolicy();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "threads") == 0)
+    {
+        benchThreads();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "shards") == 0)
+    {
+        benchShards();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "merge") == 0)
+    {
+        benchMerge();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "io") == 0)
+    {
+        benchIo();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "direct") == 0)
+    {
+        benchDirect();
+        return 0;
+    }
+
+    std::cout << "usage: bin/lemur-bench filters|cache|multiget|scan|index|policy|threads|shards|merge|io|direct" << std::endl;
+    return 1;
+}
+
+
+/**
+ * Seconds since some fixed time.
+ */
+double now()
+{
+    auto time = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration<double>(time).count();
+}
+
+/**
+ * Fill a filter with keys and then test it with keys which aren't in it.
+ * Print the false positive rate and the time taken by Add and Test.
+ */
+void benchFilter(FilterType type, uint64_t keys, uint64_t bitsPerKey, uint64_t hashes)
+{
+    BloomFilter filter(keys * bitsPerKey, hashes, keys, type);
+
+    // The even numbers are in the filter and the odd numbers aren't.
+    double start = now();
+    for (int i = 0; i < keys; i++)
+    {
+        filter.Add(i * 2);
+    }
+    double addTime = now() - start;
+
+    int tests = 1000000;
+    int positives = 0;
+    start = now();
+    for (int i = 0; i < tests; i++)
+    {
+        positives += filter.Test(i * 2 + 1);
+    }
+    double testTime = now() - start;
+
+    std::cout
+        << (type == FilterType::Blocked ? "blocked" : "classic")
+        << "," << keys
+        << "," << bitsPerKey
+        << "," << hashes
+        << "," << filter.getNumBits()
+        << "," << std::fixed << std::setprecision(5)
+        << positives / (double)tests
+        << "," << std::setprecision(1)
+        << addTime * 1e9 / keys
+        << "," << testTime * 1e9 / tests
+        << std::endl;
+}
+
+/**
+ * Compare the classic and blocked bloom filters.
+ */
+void benchFilters()
+{
+    std::cout << "filter,keys,bits/key,hashes,bits,fpr,add ns,test ns" << std::endl;
+
+    uint64_t sizes[] = {100000, 1000000, 10000000};
+    uint64_t bitsPerKey[] = {5, 10};
+    for (uint64_t keys : sizes)
+    {
+        for (uint64_t bits : bitsPerKey)
+        {
+            // About ln 2 * bits per key hashes gives the lowest rate.
+            uint64_t hashes = bits * 7 / 10;
+            benchFilter(FilterType::Classic, keys, bits, hashes);
+            benchFilter(FilterType::Blocked, keys, bits, hashes);
+        }
+    }
+}
+
+/**
+ * Draw numbers from 0 to n-1 where the chance of drawing i is proportional to
+ * 1/(i+1)^theta.
+ */
+class Zipf
+{
+public:
+    Zipf(int n, double theta)
+        : _cdf(n),
+          _random(42)
+    {
+        double sum = 0;
+        for (int i = 0; i < n; i++)
+        {
+            sum += 1 / std::pow(i + 1, theta);
+            _cdf[i] = sum;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            _cdf[i] /= sum;
+        }
+    }
+
+    int Next()
+    {
+        double r = std::uniform_real_distribution<double>(0, 1)(_random);
+        return std::lower_bound(_cdf.begin(), _cdf.end(), r) - _cdf.begin();
+    }
+
+private:
+    std::vector<double> _cdf;
+    std::mt19937_64 _random;
+};
+
+/**
+ * Fill a store and then look up keys with a Zipfian distribution.
+ * Print the lookup rate and the page cache hit rate.
+ */
+void benchLookups(size_t cacheSize)
+{
+    Options options;
+    options.size = 1024;
+    options.ratio = 4;
+    options.bitsPerKey = 10;
+    options.mmap = false;
+    options.cacheSize = cacheSize;
+    Store kv(options);
+
+    int inserts = 1000000;
+    std::vector<kv_key_t> keys = makeRandomKeys(inserts * 2);
+    for (int i = 0; i < inserts; i++)
+    {
+        kv.Put(keys[i], "This is text");
+    }
+
+    // The popular keys are spread over the whole key space.
+    Zipf zipf(inserts, 0.99);
+    int lookups = 500000;
+    int found = 0;
+    std::string val;
+    double start = now();
+    for (int i = 0; i < lookups; i++)
+    {
+        found += kv.Get(keys[zipf.Next()], val);
+    }
+    double time = now() - start;
+
+    PageCache* cache = kv.getCache();
+    uint64_t hits = cache ? cache->getHits() : 0;
+    uint64_t misses = cache ? cache->getMisses() : 0;
+    std::cout
+        << cacheSize
+        << "," << found
+        << "," << std::fixed << std::setprecision(0) << lookups / time
+        << "," << std::setprecision(3)
+        << (hits + misses ? hits / (double)(hits + misses) : 0)
+        << std::endl;
+}
+
+/**
+ * Compare lookups with and without a page cache.
+ */
+void benchCache()
+{
+    std::cout << "cache bytes,found,lookups/s,hit rate" << std::endl;
+
+    size_t sizes[] = {0, 1 << 20, 4 << 20, 16 << 20, 64 << 20};
+    for (size_t size : sizes)
+    {
+        benchLookups(size);
+    }
+}
+
+/**
+ * Fill a store and then look up random batches of keys, half of which are in
+ * the store, with Get and with MultiGet.
+ */
+void benchBatches(bool mmap, int batchSize)
+{
+    Options options;
+    options.size = 1024;
+    options.ratio = 4;
+    options.bitsPerKey = 10;
+    options.mmap = mmap;
+    Store kv(options);
+
+    int inserts = 1000000;
+    std::vector<kv_key_t> keys = makeRandomKeys(inserts);
+    for (int i = 0; i < inserts; i++)
+    {
+        kv.Put(keys[i], "This is text");
+    }
+
+    int lookups = 200000;
+    std::vector<kv_key_t> batch(batchSize);
+    std::vector<std::string> values;
+    std::vector<bool> found;
+    std::string val;
+
+    srand(1);
+    int getFound = 0;
+    double start = now();
+    for (int b = 0; b < lookups / batchSize; b++)
+    {
+        for (int i = 0; i < batchSize; i++)
+        {
+            getFound += kv.Get(rand() % inserts, val);
+        }
+    }
+    double getTime = now() - start;
+
+    srand(1);
+    int multiFound = 0;
+    start = now();
+    for (int b = 0; b < lookups / batchSize; b++)
+    {
+        for (int i = 0; i < batchSize; i++)
+        {
+            batch[i] = rand() % inserts;
+        }
+        kv.MultiGet(batch, values, found);
+        for (int i = 0; i < batchSize; i++)
+        {
+            multiFound += found[i];
+        }
+    }
+    double multiTime = now() - start;
+
+    std::cout
+        << (mmap ? "mmap" : "pread")
+        << "," << batchSize
+        << "," << getFound << "," << multiFound
+        << "," << std::fixed << std::setprecision(0)
+        << lookups / getTime
+        << "," << lookups / multiTime
+        << std::endl;
+}
+
+/**
+ * Compare batches of lookups with Get and MultiGet.
+ */
+void benchMultiGet()
+{
+    std::cout << "reads,batch,get found,multiget found,get keys/s,multiget keys/s" << std::endl;
+
+    int sizes[] = {100, 1000};
+    for (int size : sizes)
+    {
+        benchBatches(false, size);
+        benchBatches(true, size);
+    }
+}
+
+/**
+ * Fill a store and then read random ranges of keys with Scan and with Get.
+ */
+void benchRanges(bool leveling, int width)
+{
+    Options options;
+    options.leveling = leveling;
+    options.size = 1024;
+    options.ratio = 4;
+    options.bitsPerKey = 10;
+    Store kv(options);
+
+    // Only the even keys are in the store.
+    int inserts = 1000000;
+    std::vector<kv_key_t> keys = makeRandomKeys(inserts * 2);
+    for (int i = 0; i < inserts; i++)
+    {
+        kv.Put(keys[i], "This is text");
+    }
+
+    // Gets are very slow when tiering, so read fewer keys.
+    int ranges = std::max(10, (leveling ? 200000 : 20000) / width);
+    kv_key_t key;
+    std::string val;
+
+    srand(1);
+    int getFound = 0;
+    double start = now();
+    for (int r = 0; r < ranges; r++)
+    {
+        int lo = rand() % (inserts * 2 - width);
+        for (int k = lo; k < lo + width; k++)
+        {
+            getFound += kv.Get(k, val);
+        }
+    }
+    double getTime = now() - start;
+
+    srand(1);
+    int scanFound = 0;
+    start = now();
+    for (int r = 0; r < ranges; r++)
+    {
+        int lo = rand() % (inserts * 2 - width);
+        Iterator it = kv.Scan(lo, lo + width - 1);
+        while (it.HasNext())
+        {
+            it.Next(key, val);
+            scanFound++;
+        }
+    }
+    double scanTime = now() - start;
+
+    std::cout
+        << (leveling ? "leveling" : "tiering")
+        << "," << width
+        << "," << getFound << "," << scanFound
+        << "," << std::fixed << std::setprecision(0)
+        << getFound / getTime
+        << "," << scanFound / scanTime
+        << std::endl;
+}
+
+/**
+ * Compare reading ranges with Get and Scan.
+ */
+void benchScan()
+{
+    std::cout << "tree,range,get found,scan found,get keys/s,scan keys/s" << std::endl;
+
+    int widths[] = {100, 10000};
+    for (int width : widths)
+    {
+        benchRanges(true, width);
+        benchRanges(false, width);
+    }
+}
+
+/**
+ * Add up a field, such as "index bytes:", over all the levels in a dump.
+ */
+uint64_t sumField(const std::string& dump, const std::string& field)
+{
+    uint64_t sum = 0;
+    size_t pos = 0;
+    while ((pos = dump.find(field, pos)) != std::string::npos)
+    {
+        pos += field.size();
+        sum += std::stoull(dump.substr(pos));
+    }
+    return sum;
+}
+
+/**
+ * Fill a store with keys which are uniform with some dense runs, and then
+ * look up random keys.
+ */
+void benchLookupIndex(bool mmap, int epsilon)
+{
+    Options options;
+    options.size = 1024;
+    options.ratio = 4;
+    options.bitsPerKey = 10;
+    options.mmap = mmap;
+    options.learnedIndex = epsilon;
+    Store kv(options);
+
+    // Every tenth key starts a run of 100 keys in a row.
+    int inserts = 1000000;
+    std::vector<kv_key_t> keys;
+    srand(1);
+    while (keys.size() < inserts)
+    {
+        kv_key_t key = rand();
+        int run = keys.size() % 10 == 0 ? 100 : 1;
+        for (int i = 0; i < run && keys.size() < inserts; i++)
+        {
+            keys.push_back(key + i);
+        }
+    }
+    for (int i = 0; i < inserts; i++)
+    {
+        kv.Put(keys[i], "This is text");
+    }
+
+    int lookups = 200000;
+    int found = 0;
+    std::string val;
+    double start = now();
+    for (int i = 0; i < lookups; i++)
+    {
+        found += kv.Get(keys[rand() % inserts], val);
+    }
+    double time = now() - start;
+
+    std::string dump = kv.Dump(false);
+    std::cout
+        << (mmap ? "mmap" : "pread")
+        << "," << (epsilon ? std::to_string(epsilon) : "fences")
+        << "," << found
+        << "," << sumField(dump, "fence bytes:")
+        << "," << sumField(dump, "index segments:")
+        << "," << sumField(dump, "index bytes:")
+        << "," << std::fixed << std::setprecision(0) << lookups / time
+        << std::endl;
+}
+
+/**
+ * Compare lookups with the fence posts and with learned indexes.
+ */
+void benchIndex()
+{
+    std::cout << "reads,index,found,fence bytes,segments,index bytes,lookups/s" << std::endl;
+
+    int epsilons[] = {0, 4, 16, 64, 256};
+    for (bool mmap : {false, true})
+    {
+        for (int epsilon : epsilons)
+        {
+            benchLookupIndex(mmap, epsilon);
+        }
+    }
+}
+
+/**
+ * Fill a store with random keys using a merge policy for each level, and then
+ * look up keys, half of which were inserted.
+ * @param name The name of the policy.
+ */
+void benchMergePolicy(const char* name, const std::vector<bool>& policy)
+{
+    Options options;
+    options.size = 1024;
+    options.ratio = 4;
+    options.bitsPerKey = 10;
+    options.policy = policy;
+    Store kv(options);
+
+    int inserts = 1000000;
+    std::vector<kv_key_t> keys = makeRandomKeys(inserts);
+    double start = now();
+    for (int i = 0; i < inserts; i++)
+    {
+        kv.Put(keys[i], "This is text");
+    }
+    double putTime = now() - start;
+
+    int lookups = 200000;
+    int found = 0;
+    std::string val;
+    start = now();
+    for (int i = 0; i < lookups; i++)
+    {
+        kv_key_t key = keys[rand() % inserts];
+        found += kv.Get(i % 2 ? key : -key - 1, val);
+    }
+    double getTime = now() - start;
+
+    // Every value written by a merge into a file level counts towards the
+    // write amplification.
+    std::string dump = kv.Dump(false);
+    std::cout
+        << name
+        << "," << std::fixed << std::setprecision(0) << inserts / putTime
+        << "," << std::setprecision(2) << (double)sumField(dump, "written:") / inserts
+        << "," << sumField(dump, "runs:")
+        << "," << found
+        << "," << std::setprecision(0) << lookups / getTime
+        << std::endl;
+}
+
+/**
+ * Compare leveling, tiering, and policies between them.
+ */
+void benchPolicy()
+{
+    std::cout << "policy,puts/s,write amplification,runs,found,lookups/s" << std::endl;
+
+    // The tree has five file levels, with the memory level first.
+    benchMergePolicy("leveling", {true});
+    benchMergePolicy("tiering", {false});
+    benchMergePolicy("lazy leveling", {false, false, false, false, false, true});
+    benchMergePolicy("tier 1-3 level 4-5", {false, false, false, false, true});
+}
+
+/**
+ * Fill a store and then look up keys on 1 to 32 threads while another thread
+ * puts new keys, which keeps the merges running under the lookups.
+ */
+void benchThreads()
+{
+    Options options;
+    options.size = 1024;
+    options.ratio = 4;
+    options.bitsPerKey = 10;
+    options.background = true;
+    Store kv(options);
+
+    int inserts = 1000000;
+    std::vector<kv_key_t> keys = makeRandomKeys(inserts);
+    for (int i = 0; i < inserts; i++)
+    {
+        kv.Put(keys[i], "This is text");
+    }
+
+    std::cout << "cores " << std::thread::hardware_concurrency() << std::endl;
+    std::cout << "threads,lookups/s,puts/s" << std::endl;
+    int next = inserts;
+    for (int threads = 1; threads <= 32; threads *= 2)
+    {
+        std::atomic<bool> stop(false);
+        std::atomic<uint64_t> lookups(0);
+        std::vector<std::thread> readers;
+        for (int t = 0; t < threads; t++)
+        {
+            readers.push_back(std::thread([&, t]()
+            {
+                unsigned int seed = t;
+                uint64_t count = 0;
+                std::string val;
+                while (!stop)
+                {
+                    kv.Get(keys[rand_r(&seed) % inserts], val);
+                    count++;
+                }
+                lookups += count;
+            }));
+        }
+
+        // Put odd keys, which aren't in the store yet, for a second.
+        double start = now();
+        int puts = 0;
+        while (now() - start < 1)
+        {
+            for (int i = 0; i < 1000; i++)
+            {
+                kv.Put(next++ * 2 + 1, "This is text");
+            }
+            puts += 1000;
+        }
+        stop = true;
+        for (int t = 0; t < threads; t++)
+        {
+            readers[t].join();
+        }
+        double time = now() - start;
+
+        std::cout
+            << threads
+            << "," << std::fixed << std::setprecision(0) << lookups / time
+            << "," << puts / time
+            << std::endl;
+    }
+}
+
+/**
+ * Fill a store split into 1 to 32 shards from one thread, and then look up
+ * the keys in batches. Print the puts per second, including waiting for the
+ * shards to finish, and the lookups per second.
+ */
+void benchShards()
+{
+    Options options;
+    options.size = 1024;
+    options.ratio = 4;
+    options.bitsPerKey = 10;
+    options.dir = "data/shards";
+
+    int inserts = 1000000;
+    std::vector<kv_key_t> keys = makeRandomKeys(inserts);
+    std::vector<std::string> vals(1000, "This is text");
+
+    std::cout << "cores " << std::thread::hardware_concurrency() << std::endl;
+    std::cout << "shards,puts/s,lookups/s" << std::endl;
+    for (int shards = 1; shards <= 32; shards *= 2)
+    {
+        ShardedStore kv(options, shards);
+
+        double start = now();
+        for (int i = 0; i < inserts; i += 1000)
+        {
+            std::vector<kv_key_t> batch(keys.begin() + i, keys.begin() + i + 1000);
+            kv.Put(batch, vals);
+        }
+        kv.Wait();
+        double putTime = now() - start;
+
+        int lookups = inserts / 10;
+        std::vector<std::string> found;
+        std::vector<bool> exists;
+        start = now();
+        for (int i = 0; i < lookups; i += 1000)
+        {
+            std::vector<kv_key_t> batch(keys.begin() + i, keys.begin() + i + 1000);
+            kv.MultiGet(batch, found, exists);
+        }
+        double getTime = now() - start;
+
+        std::cout
+            << shards
+            << "," << std::fixed << std::setprecision(0) << inserts / putTime
+            << "," << lookups / getTime
+            << std::endl;
+    }
+}
+
+/**
+ * Fill a store which splits big leveling merges over 1 to 8 threads. Print the
+ * puts per second, which is mostly the time spent merging.
+ */
+void benchMerge()
+{
+    int inserts = 2000000;
+    std::vector<kv_key_t> keys = makeRandomKeys(inserts);
+    std::vector<std::string> vals(1000, "This is text");
+
+    std::cout << "cores " << std::thread::hardware_concurrency() << std::endl;
+    std::cout << "threads,puts/s,seconds" << std::endl;
+    for (int threads = 1; threads <= 8; threads *= 2)
+    {
+        Options options;
+        options.size = 4096;
+        options.ratio = 4;
+        options.bitsPerKey = 10;
+        options.mergeThreads = threads;
+        Store kv(options);
+
+        double start = now();
+        for (int i = 0; i < inserts; i += 1000)
+        {
+            std::vector<kv_key_t> batch(keys.begin() + i, keys.begin() + i + 1000);
+            kv.Put(batch, vals);
+        }
+        double time = now() - start;
+
+        std::cout
+            << threads
+            << "," << std::fixed << std::setprecision(0) << inserts / time
+            << "," << std::setprecision(2) << time
+            << std::endl;
+    }
+}
+
+/**
+ * Fill a store with blocking merges, then with merges which keep 1 to 16
+ * pages of each input and output in flight with io_uring, and then with
+ * merges which read 1 to 16 pages of each input ahead on helper threads.
+ */
+void benchIo()
+{
+    int inserts = 2000000;
+    std::vector<kv_key_t> keys = makeRandomKeys(inserts);
+    std::vector<std::string> vals(1000, "This is text");
+
+    std::cout << "cores " << std::thread::hardware_concurrency() << std::endl;
+    std::cout << "reads,depth,puts/s,seconds" << std::endl;
+    for (int run = 0; run < 11; run++)
+    {
+        // The first run blocks, the next five use io_uring and the last five
+        // use helper threads.
+        int depth = run == 0 ? 0 : 1 << ((run - 1) % 5);
+        Options options;
+        options.size = 4096;
+        options.ratio = 4;
+        options.bitsPerKey = 10;
+        options.ioUring = run >= 1 && run <= 5;
+        options.ioDepth = depth;
+        options.prefetch = run > 5 ? depth : 0;
+        Store kv(options);
+
+        double start = now();
+        for (int i = 0; i < inserts; i += 1000)
+        {
+            std::vector<kv_key_t> batch(keys.begin() + i, keys.begin() + i + 1000);
+            kv.Put(batch, vals);
+        }
+        double time = now() - start;
+
+        const char* reads = run == 0 ? "blocking" : options.ioUring ? "io_uring" : "thread";
+        std::cout
+            << reads
+            << "," << depth
+            << "," << std::fixed << std::setprecision(0) << inserts / time
+            << "," << std::setprecision(2) << time
+            << std::endl;
+    }
+}
+
+/**
+ * Fill a store, and then time lookups on one thread for a few seconds while
+ * another thread puts new keys, which keeps merges running under the
+ * lookups. Compare merges using the page cache and direct I/O. The
+ * difference shows when the levels don't fit in memory with the merges.
+ */
+void benchDirect()
+{
+    int inserts = 2000000;
+    std::vector<kv_key_t> keys = makeRandomKeys(inserts);
+
+    std::cout << "cores " << std::thread::hardware_concurrency() << std::endl;
+    std::cout << "merges,puts/s,lookups/s,p50 us,p99 us,p99.9 us" << std::endl;
+    for (int direct = 0; direct < 2; direct++)
+    {
+        Options options;
+        options.size = 4096;
+        options.ratio = 4;
+        options.bitsPerKey = 10;
+        options.background = true;
+        options.directIo = direct;
+        Store kv(options);
+        for (int i = 0; i < inserts; i++)
+        {
+            kv.Put(keys[i], "This is text");
+        }
+
+        std::atomic<bool> stop(false);
+        std::vector<double> latencies;
+        std::thread reader([&]()
+        {
+            unsigned int seed = 1;
+            std::string val;
+            while (!stop)
+            {
+                double start = now();
+                kv.Get(keys[rand_r(&seed) % inserts], val);
+                latencies.push_back(now() - start);
+            }
+        });
+
+        // Put odd keys, which aren't in the store yet.
+        double start = now();
+        int puts = 0;
+        while (now() - start < 3)
+        {
+            for (int i = 0; i < 1000; i++)
+            {
+                kv.Put(puts++ * 2 + 1, "This is text");
+            }
+        }
+        stop = true;
+        reader.join();
+        double time = now() - start;
+
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&](double p)
+        {
+            return latencies[(size_t)(p * (latencies.size() - 1))] * 1e6;
+        };
+        std::cout
+            << (direct ? "direct" : "buffered")
+            << "," << std::fixed << std::setprecision(0) << puts / time
+            << "," << latencies.size() / time
+            << "," << std::setprecision(1) << percentile(0.5)
+            << "," << percentile(0.99)
+            << "," << percentile(0.999)
+            << std::endl;
+    }
+}
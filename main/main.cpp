@@ -51,7 +51,7 @@ int main(int argc, char** argv)
     // Get a random list of keys.
     // This only contains even keys.
     srand(clock());
-    std::vector<int> tests = makeRandomKeys(inserts);
+    std::vector<kv_key_t> tests = makeRandomKeys(inserts);
 
     // Use this value.
     std::string str = "This is text";
@@ -60,7 +60,7 @@ int main(int argc, char** argv)
     clock_t time = std::clock();
     for (int i = 0; i < inserts; i++)
     {
-        int t = tests[i];
+        kv_key_t t = tests[i];
         kv.Put(t, str);
     }
     double insertTime = (std::clock() - time) / (double)CLOCKS_PER_SEC;
@@ -2,6 +2,11 @@
  * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
  *
  * Searching algorithms.
+ *
+ * These are templates over the type of the key/value wrapper. Passing a
+ * concrete wrapper, such as MappedKeyValues, lets the compiler inline Key()
+ * and Val() in the search loops instead of making a virtual call for every
+ * key. Passing a KeyValues pointer still works through the virtual calls.
  */
 
 #ifndef KVALGORITHMS_H
@@ -20,7 +25,11 @@ namespace kv
  * @param val The value found.
  * @return true if the key was found
  */
-bool binarySearch(KeyValues *kvs, kv_key_t key, kv_val_t &val);
+template<class KVS>
+bool binarySearch(KVS *kvs, kv_key_t key, kv_val_t &val)
+{
+    return binarySearch(kvs, key, val, 0, kvs->Count());
+}
 
 /**
  * Do a linear search on a list of key/value pairs.
@@ -29,7 +38,11 @@ bool binarySearch(KeyValues *kvs, kv_key_t key, kv_val_t &val);
  * @param val The value found.
  * @return true if the key was found
  */
-bool linearSearch(KeyValues *kvs, kv_key_t key, kv_val_t &val);
+template<class KVS>
+bool linearSearch(KVS *kvs, kv_key_t key, kv_val_t &val)
+{
+    return linearSearch(kvs, key, val, 0, kvs->Count());
+}
 
 /**
  * Do a binary search on a sorted list of key/value pairs.
@@ -40,7 +53,40 @@ bool linearSearch(KeyValues *kvs, kv_key_t key, kv_val_t &val);
  * @param val The value found.
  * @return true if the key was found
  */
-bool binarySearch(KeyValues *kvs, kv_key_t key, kv_val_t &val, int lower, int upper);
+template<class KVS>
+bool binarySearch(KVS *kvs, kv_key_t key, kv_val_t &val, int lower, int upper)
+{
+    int l = lower;
+    int r = upper-1;
+    kv_key_t k;
+    while (l <= r)
+    {
+        int m = (l+r)/2;
+        k = kvs->Key(m);
+        if (k < key)
+        {
+            l = m + 1;
+        }
+        else if (k > key)
+        {
+            r = m - 1;
+        }
+        else
+        {
+            // Found a matching key.
+
+            // The same key could have been added more than once. Check the key
+            // to the left to see if it is the same key. Keep sliding to the
+            // left while the key is equal. This will cause us to return the
+            // most recent value for this key.
+            while ((m > lower) && (key == kvs->Key(m-1))) { m--; }
+
+            val = kvs->Val(m);
+            return true;
+        }
+    }
+    return false;
+}
 
 /**
  * Do a linear search on a list of key/value pairs.
@@ -51,7 +97,47 @@ bool binarySearch(KeyValues *kvs, kv_key_t key, kv_val_t &val, int lower, int up
  * @param val The value found.
  * @return true if the key was found
  */
-bool linearSearch(KeyValues *kvs, kv_key_t key, kv_val_t &val, int lower, int upper);
+template<class KVS>
+bool linearSearch(KVS *kvs, kv_key_t key, kv_val_t &val, int lower, int upper)
+{
+    // Search backward so we find the most recent copy of a key.
+    for (int i = upper-1; i >= lower; i--)
+    {
+        kv_key_t test = kvs->Key(i);
+        if (test == key)
+        {
+            val = kvs->Val(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Find the first position in a sorted subrange of a list of key/value pairs
+ * with a key which is not less than a key. If the key is in the list more
+ * than once this is the most recent copy.
+ * @param kvs A wrapper over an in-memory array of key/values or key/value files.
+ * @param key The key to lookup.
+ * @return The position, or upper if every key is less than key.
+ */
+template<class KVS>
+int lowerBound(KVS *kvs, kv_key_t key, int lower, int upper)
+{
+    while (lower < upper)
+    {
+        int m = lower + (upper - lower) / 2;
+        if (kvs->Key(m) < key)
+        {
+            lower = m + 1;
+        }
+        else
+        {
+            upper = m;
+        }
+    }
+    return lower;
+}
 
 }
 #endif
\ No newline at end of file
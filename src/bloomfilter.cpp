@@ -11,32 +11,89 @@
 #include "lib/MurmurHash3.h"
 #include <sstream>
 
-BloomFilter::BloomFilter(uint64_t numBits, uint64_t numHashes, uint32_t seed)
-    : _bits(numBits),
+BloomFilter::BloomFilter(
+    uint64_t numBits, uint64_t numHashes, uint32_t seed, FilterType type)
+    : _type(type),
       _numHashes(numHashes),
+      _numBits(numBits),
       _seed(seed)
 {
+    if (_type == FilterType::Blocked)
+        _numBits = (numBits + BLOCK_BITS - 1) / BLOCK_BITS * BLOCK_BITS;
+    allocate(_numBits);
 }
 
-void BloomFilter::Add(int data)
+void BloomFilter::Add(kv::kv_key_t data)
+{
+    add(data, false);
+}
+
+/**
+ * Add an item to a filter which other threads are adding items to at the
+ * same time. The bits are set with atomic ors, so the filter ends up the
+ * same as when the items are added one at a time.
+ */
+void BloomFilter::AddShared(kv::kv_key_t data)
+{
+    add(data, true);
+}
+
+/**
+ * Set the bits for an item, with atomic ors if the filter is shared.
+ */
+inline void BloomFilter::add(kv::kv_key_t data, bool shared)
 {
     // Create one multi-bit hash of the value.
     // Then use individual bits from the hash to set the bit vector.
     // See https://findingprotopia.org/posts/how-to-write-a-bloom-filter-cpp/
     auto hashValues = hash(data);
+
+    if (_type == FilterType::Blocked)
+    {
+        // The first hash picks the block and the second the bits in it.
+        uint64_t* block = _blocks[hashValues[0] % _blocks.size()].words;
+        uint64_t mask[BLOCK_WORDS];
+        blockMask(hashValues[1], mask);
+        for (int w = 0; w < BLOCK_WORDS; w++)
+        {
+            setBits(block[w], mask[w], shared);
+        }
+        return;
+    }
+
+    uint64_t* bits = words();
     for (int n = 0; n < _numHashes; n++)
     {
-        _bits[nthHash(n, hashValues[0], hashValues[1], _bits.size())] = true;
+        uint64_t bit = nthHash(n, hashValues[0], hashValues[1], _numBits);
+        setBits(bits[bit / 64], (uint64_t)1 << (bit % 64), shared);
     }
 }
 
-bool BloomFilter::Test(int data)
+bool BloomFilter::Test(kv::kv_key_t data)
 {
     // Use the same technique as Add to take bits from a multi-bit hash.
     auto hashValues = hash(data);
+
+    if (_type == FilterType::Blocked)
+    {
+        // Check the whole block at once, without branching on each word, so
+        // the compiler can do it with vector instructions.
+        const uint64_t* block = _blocks[hashValues[0] % _blocks.size()].words;
+        uint64_t mask[BLOCK_WORDS];
+        blockMask(hashValues[1], mask);
+        uint64_t missing = 0;
+        for (int w = 0; w < BLOCK_WORDS; w++)
+        {
+            missing |= mask[w] & ~block[w];
+        }
+        return missing == 0;
+    }
+
+    uint64_t* bits = words();
     for (int n = 0; n < _numHashes; n++)
     {
-        if (!_bits[nthHash(n, hashValues[0], hashValues[1], _bits.size())])
+        uint64_t bit = nthHash(n, hashValues[0], hashValues[1], _numBits);
+        if (!(bits[bit / 64] & ((uint64_t)1 << (bit % 64))))
         {
             return false;
         }
@@ -47,16 +104,57 @@ bool BloomFilter::Test(int data)
 
 void BloomFilter::Clear()
 {
-    std::fill(_bits.begin(), _bits.end(), false);
+    std::fill(words(), words() + _blocks.size() * BLOCK_WORDS, 0);
+}
+
+void BloomFilter::Save(std::ostream& output)
+{
+    uint64_t type = (uint64_t)_type;
+    output.write((char*)&type, sizeof(type));
+    output.write((char*)&_numBits, sizeof(_numBits));
+    output.write((char*)&_numHashes, sizeof(_numHashes));
+    output.write((char*)words(), numWords() * sizeof(uint64_t));
+}
+
+bool BloomFilter::Load(std::istream& input)
+{
+    uint64_t type, numBits, numHashes;
+    input.read((char*)&type, sizeof(type));
+    input.read((char*)&numBits, sizeof(numBits));
+    input.read((char*)&numHashes, sizeof(numHashes));
+    if (input.fail())
+        return false;
+
+    BloomFilter filter(numBits, numHashes, _seed, (FilterType)type);
+    if (filter._numBits != numBits)
+        return false;
+    input.read((char*)filter.words(), filter.numWords() * sizeof(uint64_t));
+    if (input.fail())
+        return false;
+
+    _type = filter._type;
+    _numBits = filter._numBits;
+    _numHashes = filter._numHashes;
+    _blocks.swap(filter._blocks);
+    return true;
+}
+
+/**
+ * Allocate the blocks for a number of bits.
+ */
+void BloomFilter::allocate(uint64_t numBits)
+{
+    _blocks.assign((numBits + BLOCK_BITS - 1) / BLOCK_BITS, Block());
+    Clear();
 }
 
 /**
  * Get a milti-byte hash.
  */
-std::array<uint64_t, 2> BloomFilter::hash(int data)
+std::array<uint64_t, 2> BloomFilter::hash(kv::kv_key_t data)
 {
     std::array<uint64_t, 2> hashValue;
-    MurmurHash3_x64_128(&data, sizeof(int), _seed, hashValue.data());
+    MurmurHash3_x64_128(&data, sizeof(data), _seed, hashValue.data());
     return hashValue;
 }
 
@@ -69,3 +167,23 @@ inline uint64_t BloomFilter::nthHash(
 {
     return (hashA + n * hashB) % bits;
 }
+
+/**
+ * Make the bits to set in a block for a key.
+ * Double hashing with the two halves of the hash picks each bit. Making the
+ * step odd means the hashes pick different bits.
+ */
+inline void BloomFilter::blockMask(uint64_t hash, uint64_t* mask)
+{
+    uint32_t hashA = (uint32_t)hash;
+    uint32_t hashB = (uint32_t)(hash >> 32) | 1;
+    for (int w = 0; w < BLOCK_WORDS; w++)
+    {
+        mask[w] = 0;
+    }
+    for (int n = 0; n < _numHashes; n++)
+    {
+        uint32_t bit = (hashA + n * hashB) % BLOCK_BITS;
+        mask[bit / 64] |= (uint64_t)1 << (bit % 64);
+    }
+}
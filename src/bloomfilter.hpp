@@ -5,14 +5,32 @@
  *     https://findingprotopia.org/posts/how-to-write-a-bloom-filter-cpp/
  * and this paper:
  *     https://doi.org/10.1002/rsa.20208
+ *
+ * The classic filter spreads the bits for a key over the whole filter, so a
+ * test of a large filter costs a cache miss for every hash. The blocked filter
+ * puts all the bits for a key in one 64 byte block, so a test costs one cache
+ * miss. It has a slightly higher false positive rate for the same number of
+ * bits. See https://doi.org/10.1145/1498698.1594230
  */
 
 #ifndef BLOOMFILTER_H
 #define BLOOMFILTER_H
 
+#include "types.hpp"
 #include <stddef.h>
+#include <stdint.h>
 #include <vector>
 #include <array>
+#include <iostream>
+
+/**
+ * How a bloom filter lays out the bits for a key.
+ */
+enum class FilterType
+{
+    Classic,    // Each hash picks a bit anywhere in the filter.
+    Blocked     // All the hashes pick bits in one cache line sized block.
+};
 
 class BloomFilter
 {
@@ -22,34 +40,99 @@ public:
      * seed is passed to the MurmurHash3 algorthm to generate hashes.
      * Using a different seed at different levels of the LSM tree prevents a
      * false positive happening at every level of the tree.
+     * A blocked filter rounds the number of bits up to a whole block.
      */
-    BloomFilter(uint64_t numBits, uint64_t numHashes, uint32_t seed);
+    BloomFilter(uint64_t numBits, uint64_t numHashes, uint32_t seed,
+        FilterType type = FilterType::Classic);
 
     /**
      * Add an item to the filter.
      */
-    void Add(int data);
+    void Add(kv::kv_key_t data);
+
+    /**
+     * Add an item to a filter which other threads are adding items to at
+     * the same time. The filter ends up the same as when the items are
+     * added one at a time.
+     */
+    void AddShared(kv::kv_key_t data);
 
     /**
      * Test an item in the filter.
      */
-    bool Test(int data);
+    bool Test(kv::kv_key_t data);
 
     /**
      * Forget all the items which were added to the filter.
      */
     void Clear();
 
-    uint64_t getNumBits() { return _bits.size(); }
+    /**
+     * Write the size of the filter and its bits to a stream.
+     */
+    void Save(std::ostream& output);
+
+    /**
+     * Replace the filter with one written by Save.
+     * @return false if the stream could not be read.
+     */
+    bool Load(std::istream& input);
+
+    uint64_t getNumBits() { return _numBits; }
     uint64_t getNumHashes() { return _numHashes; }
+    FilterType getType() { return _type; }
 
 private:
-    std::array<uint64_t, 2> hash(int data);
+    static const int BLOCK_WORDS = 8;               // 64 bytes.
+    static const int BLOCK_BITS = BLOCK_WORDS * 64;
+
+    /**
+     * A cache line of bits. These are aligned so a block is never split
+     * across two cache lines.
+     */
+    struct alignas(64) Block
+    {
+        uint64_t words[BLOCK_WORDS];
+    };
+
+    /**
+     * Set the bits for an item, with atomic ors if the filter is shared.
+     */
+    inline void add(kv::kv_key_t data, bool shared);
+
+    /**
+     * Set bits in a word. A shared word is set with an atomic or, and only
+     * if a bit is missing, so words which are already set aren't written.
+     */
+    void setBits(uint64_t& word, uint64_t mask, bool shared)
+    {
+        if (!shared)
+            word |= mask;
+        else if ((__atomic_load_n(&word, __ATOMIC_RELAXED) & mask) != mask)
+            __atomic_fetch_or(&word, mask, __ATOMIC_RELAXED);
+    }
+
+    std::array<uint64_t, 2> hash(kv::kv_key_t data);
     inline uint64_t nthHash(
         uint8_t n, uint64_t hashA, uint64_t hashB, uint64_t filterSize);
 
+    /**
+     * Make the bits to set in a block for a key.
+     */
+    inline void blockMask(uint64_t hash, uint64_t* mask);
+
+    /**
+     * Allocate the blocks for a number of bits.
+     */
+    void allocate(uint64_t numBits);
+
+    uint64_t* words() { return (uint64_t*)_blocks.data(); }
+    uint64_t numWords() { return (_numBits + 63) / 64; }
+
+    FilterType _type;
     uint64_t _numHashes;
-    std::vector<bool> _bits;
+    uint64_t _numBits;
+    std::vector<Block> _blocks;     // The bits packed into words.
     uint32_t _seed;
 };
 
@@ -2,6 +2,25 @@
  * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
  *
  * A simple wrapper around a file to simplify reading a writing keys and values.
+ *
+ * There are two ways to access the file. The stream backend uses std::fstream
+ * and flushes after every write. The POSIX backend uses a file descriptor with
+ * pread and pwrite, so a positional read or write is a single system call and
+ * nothing is forced to disk until Sync is called.
+ *
+ * With the POSIX backend positional reads don't use the read position, so
+ * lookups on different threads can read the same file at once.
+ *
+ * Both backends report an error the same way: the file fails, see fail, and
+ * reads and writes do nothing until it is opened again. A failure on one
+ * thread reading a POSIX file is seen by the others. With either backend a
+ * read which reaches the end of the file isn't an error, because the last
+ * page of a file is read whole even when it is only partly written.
+ *
+ * A file can also be opened for direct I/O, which bypasses the kernel's page
+ * cache. Then reads and writes must be in whole blocks of DIRECT_ALIGN bytes,
+ * at offsets which are a multiple of it, to and from buffers aligned to it.
+ * See newPage for aligned buffers.
  */
 
 #ifndef KVFILE_H
@@ -9,10 +28,67 @@
 
 #include <string>
 #include <fstream>
+#include <atomic>
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
 
 namespace kv
 {
 
+/**
+ * How a File reads and writes the disk.
+ */
+enum class FileBackend
+{
+    Stream,     // std::fstream, flushed after every write.
+    Posix       // A file descriptor using pread and pwrite.
+};
+
+/**
+ * The alignment of direct I/O. This is the largest block size file systems
+ * usually ask for, and the size of a memory page.
+ */
+const size_t DIRECT_ALIGN = 4096;
+
+/**
+ * Allocate a buffer for a page of items which can be used for direct I/O.
+ * Its length is rounded up to whole blocks. The items are plain data, so they
+ * don't need constructing. Free it with deletePage.
+ * @param count The number of items in the page.
+ */
+template<class T>
+T* newPage(int count)
+{
+    size_t len = (count * sizeof(T) + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+    void* page = NULL;
+    if (posix_memalign(&page, DIRECT_ALIGN, len) != 0)
+        throw std::bad_alloc();
+    return (T*)page;
+}
+
+/**
+ * Free a buffer allocated by newPage.
+ */
+template<class T>
+void deletePage(T* page)
+{
+    free(page);
+}
+
+/**
+ * A new id for a file which is being opened. Ids are never reused, so they
+ * can identify the contents of a file, e.g. in a PageCache.
+ */
+inline uint64_t nextFileId()
+{
+    static std::atomic<uint64_t> id(0);
+    return ++id;
+}
+
 /**
  * This is templitized to make it easy to read and write a given data type.
  * E.g. to read and write keys create an instance of File<kv_key_t>
@@ -26,6 +102,13 @@ public:
      * You need to call Open.
      */
     File()
+        : _id(0),
+          _backend(FileBackend::Posix),
+          _fd(-1),
+          _direct(false),
+          _failed(false),
+          _readPos(0),
+          _writePos(0)
     {
     }
 
@@ -41,10 +124,41 @@ public:
      * Open the file for reading and writing.
      * @param filename The file path.
      * @param trunc If true, truncate the file if it already exists.
+     * @param backend How to access the file.
+     * @param direct If true bypass the page cache, if the backend and the
+     *               file system allow it. See isDirect.
+     * The file fails if it can't be opened.
      */
-    void Open(std::string filename, bool trunc)
+    void Open(std::string filename, bool trunc, FileBackend backend = FileBackend::Posix,
+        bool direct = false)
     {
         _filename = filename;
+        _id = nextFileId();
+        _backend = backend;
+        _direct = false;
+        _failed = false;
+        _readPos = 0;
+        _writePos = 0;
+
+        if (_backend == FileBackend::Posix)
+        {
+            int flags = O_RDWR | O_CREAT;
+            if (trunc)
+                flags |= O_TRUNC;
+
+            // Some file systems, e.g. tmpfs, don't allow direct I/O.
+            if (direct)
+            {
+                _fd = ::open(filename.c_str(), flags | O_DIRECT, 0644);
+                _direct = _fd >= 0;
+                if (_direct)
+                    return;
+            }
+            _fd = ::open(filename.c_str(), flags, 0644);
+            _failed = _fd < 0;
+            return;
+        }
+
         auto mode = std::fstream::in | std::fstream::out | std::fstream::binary;
         if (trunc)
             mode |= std::fstream::trunc;
@@ -56,6 +170,12 @@ public:
      */
     void Close()
     {
+        if (_fd >= 0)
+        {
+            ::close(_fd);
+            _fd = -1;
+        }
+
         if (_stream.is_open())
         {
             _stream.flush();
@@ -63,12 +183,52 @@ public:
         }
     }
 
+    /**
+     * Force everything written so far to the disk.
+     * This is the durability point, e.g. at the end of a merge.
+     * @return false if the file has failed.
+     */
+    bool Sync()
+    {
+        if (_fd >= 0 && !_failed)
+        {
+            int result;
+            do
+            {
+                result = ::fsync(_fd);
+            } while (result < 0 && errno == EINTR);
+            if (result < 0)
+                _failed = true;
+        }
+        else if (_stream.is_open())
+        {
+            _stream.flush();
+        }
+        return !fail();
+    }
+
+    /**
+     * Has opening, reading, writing or syncing the file failed.
+     */
+    bool fail()
+    {
+        if (_backend == FileBackend::Posix)
+            return _failed;
+        return _stream.fail();
+    }
+
     /**
      * Read an item at the current read position.
      */
     void Read(T &data)
     {
-        _stream.read((char*)(&data), sizeof(T));
+        if (_backend == FileBackend::Posix)
+        {
+            pread((char*)(&data), sizeof(T), _readPos * sizeof(T));
+            _readPos++;
+            return;
+        }
+        sread((char*)(&data), sizeof(T));
     }
 
     /**
@@ -76,6 +236,11 @@ public:
      */
     void Read(T &data, int pos)
     {
+        if (_backend == FileBackend::Posix)
+        {
+            pread((char*)(&data), sizeof(T), (off_t)pos * sizeof(T));
+            return;
+        }
         _stream.seekg(pos * sizeof(T), _stream.beg);
         Read(data);
     }
@@ -85,8 +250,13 @@ public:
      */
     void Read(T *data, int pos, int count)
     {
+        if (_backend == FileBackend::Posix)
+        {
+            pread((char*)data, count * sizeof(T), (off_t)pos * sizeof(T));
+            return;
+        }
         _stream.seekg(pos * sizeof(T), _stream.beg);
-        _stream.read((char*)data, count * sizeof(T));
+        sread((char*)data, count * sizeof(T));
     }
 
     /**
@@ -95,6 +265,12 @@ public:
      */
     void Write(T data)
     {
+        if (_backend == FileBackend::Posix)
+        {
+            pwrite((char*)(&data), sizeof(T), _writePos * sizeof(T));
+            _writePos++;
+            return;
+        }
         _stream.write((char*)(&data), sizeof(T));
         _stream.flush();
     }
@@ -114,6 +290,12 @@ public:
      */
     void Write(T *data, int pos, int count)
     {
+        if (_backend == FileBackend::Posix)
+        {
+            pwrite((char*)data, count * sizeof(T), (off_t)pos * sizeof(T));
+            _writePos = pos + count;
+            return;
+        }
         _stream.seekp(pos * sizeof(T), _stream.beg);
         _stream.write((char*)data, count*sizeof(T));
         _stream.flush();
@@ -124,15 +306,103 @@ public:
      */
     void Rewind()
     {
-        _stream.seekg(0, _stream.beg);
-        _stream.seekp(0, _stream.beg);
+        _readPos = 0;
+        _writePos = 0;
+        if (_stream.is_open())
+        {
+            _stream.seekg(0, _stream.beg);
+            _stream.seekp(0, _stream.beg);
+        }
     }
 
     std::string getFilename() { return _filename; }
+    uint64_t getId() { return _id; }
+
+    /**
+     * Was the file opened for direct I/O.
+     */
+    bool isDirect() { return _direct; }
+
+    /**
+     * Do pages of items start on direct I/O blocks. Whole pages can be read
+     * and written with direct I/O when they do.
+     * @param pageSize The number of items in a page.
+     */
+    static bool alignedPages(int pageSize)
+    {
+        return pageSize * sizeof(T) % DIRECT_ALIGN == 0;
+    }
+
+    /**
+     * The file descriptor, or -1 with the stream backend.
+     */
+    int getFd() { return _fd; }
 
 private:
+    /**
+     * Read bytes at an offset. Keep reading after a short read until all the
+     * bytes are read or the end of the file is reached. Fail on an error.
+     */
+    void pread(char* buf, size_t len, off_t offset)
+    {
+        while (len > 0 && !_failed)
+        {
+            ssize_t n = ::pread(_fd, buf, len, offset);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                _failed = true;
+            if (n <= 0)
+                return;
+            buf += n;
+            len -= n;
+            offset += n;
+        }
+    }
+
+    /**
+     * Read bytes from the stream at its read position. Reaching the end of
+     * the file sets the stream's failbit, which would fail every later read,
+     * so it is cleared.
+     */
+    void sread(char* buf, size_t len)
+    {
+        _stream.read(buf, len);
+        if (_stream.eof())
+            _stream.clear(_stream.rdstate() & std::fstream::badbit);
+    }
+
+    /**
+     * Write bytes at an offset. Keep writing after a short write until all
+     * the bytes are written. Fail if they can't be.
+     */
+    void pwrite(const char* buf, size_t len, off_t offset)
+    {
+        while (len > 0 && !_failed)
+        {
+            ssize_t n = ::pwrite(_fd, buf, len, offset);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                _failed = true;
+                return;
+            }
+            buf += n;
+            len -= n;
+            offset += n;
+        }
+    }
+
     std::string _filename;
-    std::fstream _stream;
+    uint64_t _id;           // Changes every time the file is opened.
+    FileBackend _backend;   // How the file is accessed.
+    std::fstream _stream;   // Used by the stream backend.
+    int _fd;                // Used by the POSIX backend.
+    bool _direct;           // Does _fd bypass the page cache.
+    std::atomic<bool> _failed;  // Has the POSIX backend failed. Only Open clears it.
+    off_t _readPos;         // The current read position, in items.
+    off_t _writePos;        // The current write position, in items.
 };
 
 }
@@ -9,127 +9,169 @@
 #include "inputreader.hpp"
 #include "outputfilewriter.hpp"
 #include <sstream>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
-#include <limits.h>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <thread>
 
 namespace kv
 {
 
+// The fewest values a range of a split merge gets. Smaller merges aren't
+// worth starting a thread for.
+static const int MIN_SPLIT = 4096;
+
 /**
  * Create a file level.
- * @param leveling true if using leveling, else use tiering.
+ * @param options The settings for the store.
+ * @param cache The page cache for the store, or NULL.
+ * @param depth The depth of this level. The first file level is 1.
  * @param pageSize The size of disk pages.
  * @param levelSize The number of items to store in this level.
- * @param ratio Size ratio between adjacent levels.
- * @param bits The number of bits int he bloom filter.
- * @param hashes The number of hashes in the bloom filter.
+ * @param bits The number of bits in the bloom filters of a full level.
+ * @param hashes The number of hashes in the bloom filters.
  */
-FileLevel::FileLevel(bool leveling, int pageSize, int levelSize, int ratio, int bits, int hashes)
-    : _leveling(leveling),      // Are we doing leveling or tiering.
+FileLevel::FileLevel(const Options& options, PageCache* cache, int depth, int pageSize,
+    int levelSize, uint64_t bits, uint64_t hashes)
+    : _options(options),        // The settings for the store.
+      _leveling(options.levelingAt(depth)), // Are we doing leveling or tiering.
       _pageSize(pageSize),      // The size of file pages.
       _levelSize(levelSize),    // The number of items we will store at this level.
-      _ratio(ratio),            // Size ratio between adjacent levels.
+      _ratio(options.ratio),    // Size ratio between adjacent levels.
+      _depth(depth),            // How far down the tree this level is.
       _count(0),                // The number of items currently in this level.
+      _bits(bits),              // The bloom filter size for a full level.
+      _hashes(hashes),
       _next(NULL),              // A pointer to the level below this one.
-      _filter(bits, hashes, levelSize), // Create the bloom filter.
-      _fenceCount(ratio),               // The number of fenced regions.
-      _fenceSize(levelSize/ratio)       // The number of items in a fenced region.
+      _cache(cache),            // The page cache shared by all the levels.
+      _output(NULL),            // Only set during a merge.
+      _cursor(KEY_MIN),         // Start pushing partitions down from the smallest key.
+      _generation(0),           // The generation of the first partition's files.
+      _written(0),              // No values have been merged yet.
+      _dropped(0)
 {
-    // Open the files we will use to store the keys and values for this layer.
-    std::stringstream filename;
-    filename << "data/lsm." << std::setfill('0') << std::setw(4) << levelSize;
+    // The partitions are created by the first merge.
+}
 
-    _keyFile.Open(filename.str() + ".key", true);
-    _valFile.Open(filename.str() + ".dat", true);
+/**
+ * Reopen a file level, and the levels below it, from the files left by a
+ * previous store.
+ * @param options The settings for the store.
+ * @param cache The page cache for the store, or NULL.
+ * @param levels The levels read from the manifest.
+ * @param depth The index of this level in levels.
+ */
+FileLevel::FileLevel(const Options& options, PageCache* cache, std::vector<LevelInfo>& levels,
+    int depth)
+    : _options(options),
+      _leveling(levels[depth].leveling),
+      _pageSize(levels[depth].pageSize),
+      _levelSize(levels[depth].size),
+      _ratio(levels[depth].ratio),
+      _depth(depth),
+      _count(0),
+      _bits(levels[depth].bits),
+      _hashes(levels[depth].hashes),
+      _next(NULL),
+      _cache(cache),
+      _output(NULL),
+      _cursor(KEY_MIN),
+      _generation(levels[depth].generation),
+      _written(0),
+      _dropped(0)
+{
+    // Reopen each partition. Their bloom filters and fence posts are read
+    // from their meta files instead of being rebuilt from the key files.
+    _options.filter = levels[depth].filter;
+    std::vector<PartitionInfo>& partitions = levels[depth].partitions;
+    uint64_t bits, hashes;
+    filterSize(partitionSize(), bits, hashes);
+    for (int i = 0; i < partitions.size(); i++)
+    {
+        int generation = partitions[i].generation;
+        _partitions.push_back(new Partition(_options, _cache, filename(generation), generation,
+            _pageSize, bits, hashes, _levelSize, partitions[i].count));
+        _count += partitions[i].count;
+    }
 
-    // Create the fence posts.
-    _fenceMins = new kv_key_t[_fenceCount];
-    _fenceMaxs = new kv_key_t[_fenceCount];
-    initFences();
+    if (depth + 1 < levels.size())
+        _next = new FileLevel(options, cache, levels, depth + 1);
 }
 
 FileLevel::~FileLevel()
 {
-    delete [] _fenceMins;
-    delete [] _fenceMaxs;
+    for (int i = 0; i < _partitions.size(); i++)
+    {
+        _partitions[i]->Unref();
+    }
+    for (int i = 0; i < _obsolete.size(); i++)
+    {
+        _obsolete[i]->Unref();
+    }
+    if (_next)
+        delete _next;
 }
 
 /**
- * Get a value from this level or the levels below it.
- * @param key The key to lookup.
- * @param val Set to the value, if it is found.
- * @return true if the key was found.
+ * Add this level, and the levels below it, to the manifest. Write the bloom
+ * filters, fence posts and learned index for each partition.
  */
-bool FileLevel::Get(kv_key_t key, kv_val_t &val)
+void FileLevel::Save(Manifest& manifest)
 {
-    // First check if the key is at this level.
-    // Check the bloom filter first.
-    if (_filter.Test(key))
+    LevelInfo info;
+    info.leveling = _leveling;
+    info.size = _levelSize;
+    info.ratio = _ratio;
+    info.pageSize = _pageSize;
+    info.count = _count;
+    info.bits = _bits;
+    info.hashes = _hashes;
+    info.filter = _options.filter;
+    info.generation = _generation;
+    for (int i = 0; i < _partitions.size(); i++)
     {
-        // The bloom filter tells us the key might be in this level.
-
-        // The algoritm we use to seach this level depends on where the level
-        // is sorted, i.e. leveling vs tiering.
-        if (_leveling)
-        {
-            if (get_leveling(key, val))
-                return true;
-        }
-        else
-        {
-            if (get_tiering(key, val))
-                return true;
-        }
+        // Only the partitions which changed since the last time write their
+        // meta files.
+        _partitions[i]->Save();
+        PartitionInfo part = {_partitions[i]->getGeneration(), _partitions[i]->getCount()};
+        info.partitions.push_back(part);
     }
+    manifest.getLevels().push_back(info);
 
-    // The key is not at this level so try the next level.
     if (_next)
-    {
-        return _next->Get(key, val);
-    }
-
-    // The key wasn't at this level or any level below it.
-    return false;
+        _next->Save(manifest);
 }
 
 /**
- * Look in the current level for a key using a linear seach because this
- * level is not sorted, i.e. tiering, not leveling.
+ * Release the replaced partitions of this level and the levels below it.
+ * Called once a manifest which doesn't need them has been saved. Their files
+ * are deleted when no version of the tree has them.
  */
-bool FileLevel::get_tiering(kv_key_t key, kv_val_t &val)
+void FileLevel::Purge()
 {
-    FileKeyValues kvs(_keyFile, _valFile, _count);
-
-    // For each fence region, if the key is between the fence posts then
-    // seach within the region.
-    for (int f = 0; f < _fenceCount; f++)
+    for (int i = 0; i < _obsolete.size(); i++)
     {
-        if (key >= _fenceMins[f] && key <= _fenceMaxs[f])
-        {
-            if (linearSearch(&kvs, key, val, f * _fenceSize, (f+1) * _fenceSize))
-                return true;
-        }
+        _obsolete[i]->RemoveFiles();
+        _obsolete[i]->Unref();
     }
-    return false;
+    _obsolete.clear();
+
+    if (_next)
+        _next->Purge();
 }
 
 /**
- * Look in the current level for a key using a binary seach because this
- * level is sorted, i.e. leveling, not tiering.
+ * Add the partitions of this level, and the levels below it, to a new version
+ * of the tree.
  */
-bool FileLevel::get_leveling(kv_key_t key, kv_val_t &val)
+void FileLevel::Snapshot(Version* version)
 {
-    // Find the fence region which this key is inside and search it.
-    for (int f = 0; f < _fenceCount; f++)
-    {
-        if (key >= _fenceMins[f] && key <= _fenceMaxs[f])
-        {
-            FileKeyValues kvs(_keyFile, _valFile, _count);
-            return binarySearch(&kvs, key, val, f * _fenceSize, (f+1) * _fenceSize);
-        }
-    }
-    return false;
+    version->AddLevel(_leveling, _partitions);
+    if (_next)
+        _next->Snapshot(version);
 }
 
 /**
@@ -142,37 +184,114 @@ int FileLevel::Count()
 }
 
 /**
- * Merge an array of keys and values into this level.
+ * Merge an array of keys and values into this level. They are sorted first.
  * This is called from the memory level.
  */
 void FileLevel::Merge(kv_key_t* keys, kv_val_t* vals, int count)
 {
-    InputMemReader input(keys, vals, count);
-    merge(&input);
+    // The arrays aren't sorted. Sort a copy of them so the merge writes a
+    // sorted run. Add them backwards so the newest copy of a key is first.
+    InputVectorReader input;
+    for (int i = count - 1; i >= 0; i--)
+    {
+        input.Add(keys[i], vals[i]);
+    }
+    input.Sort();
+    merge(&input, count);
+}
+
+/**
+ * Merge sorted keys and values from a skip list into this level.
+ * This is called from the memory level when leveling.
+ * @param count The number of values in the skip list.
+ */
+void FileLevel::Merge(InputListReader* input, int count)
+{
+    merge(input, count);
 }
 
 /**
- * Merge keys and values a files into this level. This is called be the level
- * above this one to merge into this level.
+ * Merge sorted runs into this level. This is called by the level above this
+ * one with the partition it pushes down, or with its runs when it is tiered.
+ * When a key is in more than one run the later runs are newer.
+ * @param count The number of values in the runs.
  */
-void FileLevel::Merge(File<kv_key_t>& keys, File<kv_val_t>& vals, int count)
+void FileLevel::Merge(const std::vector<Partition*>& runs, int count)
 {
-    InputFileReader input(keys, vals, count, _pageSize);
-    merge(&input);
+    makeRoom(count);
+
+    // A big merge into a level which is one run is split over threads.
+    int ranges = mergeThreads(_count + count);
+    if (ranges > 1)
+    {
+        levelSplit(runs, ranges);
+        return;
+    }
+
+    // One run is read straight from its files. More runs are merged as they
+    // are read.
+    if (runs.size() == 1)
+    {
+        InputFileReader input(runs[0]->getKeyFile(), runs[0]->getValFile(),
+            runs[0]->getCount(), _pageSize, mergeCache(), 0, ioDepth(), _options.directIo,
+            _options.prefetch);
+        copy(&input);
+        return;
+    }
+    InputRunReader input;
+    for (int i = 0; i < runs.size(); i++)
+    {
+        input.Add(runs[i]->getKeyFile(), runs[i]->getValFile(), runs[i]->getCount(),
+            _pageSize, mergeCache(), 0, ioDepth(), _options.directIo, _options.prefetch);
+    }
+    copy(&input);
 }
 
 /**
  * Implemeting the merge using a InputReader which wrappes both arrays of
  * keys/values from the memory level and files from disk levels.
+ * The merge is compiled for each kind of reader, so reading the next item in
+ * the merge loops isn't a virtual call.
+ * @param count The number of values in the input.
+ */
+template<class Reader>
+void FileLevel::merge(Reader* input, int count)
+{
+    makeRoom(count);
+    copy(input);
+}
+
+/**
+ * Make room in this level for the values being merged into it, by flushing it
+ * or pushing partitions down to the next level.
+ * @param count The number of values being merged.
  */
-void FileLevel::merge(InputReader* input)
+void FileLevel::makeRoom(int count)
 {
-    // If this level is full then flush to the next level.
-    if (_count == _levelSize)
+    // If this level doesn't have room for everything the level above can
+    // hold then flush to the next level. Without dropping superseded values
+    // this is when the level is full. A tiered level also flushes when it
+    // has ratio runs, because each run is searched by every lookup. The runs
+    // can be smaller than the level above when it is leveling.
+    if (_leveling && !partitioned() && _count + _levelSize / _ratio > _levelSize)
+        flush();
+    if (!_leveling && (_count + count > _levelSize || _partitions.size() >= _ratio))
         flush();
 
-    // Use the leveling or tiering algorthm to copy values from the level above
-    // to this level.
+    // A partitioned level only makes room for the values being merged. It
+    // pushes partitions down, one at a time, so a merge only moves about one
+    // partition's worth of values to the next level.
+    while (partitioned() && !_partitions.empty() && _count + count > _levelSize)
+        pushDown(pickPartition());
+}
+
+/**
+ * Use the leveling or tiering algorthm to copy values from the level above to
+ * this level.
+ */
+template<class Reader>
+void FileLevel::copy(Reader* input)
+{
     if (_leveling)
         level(input);
     else
@@ -185,185 +304,592 @@ void FileLevel::merge(InputReader* input)
  */
 void FileLevel::flush()
 {
-    // If the next level hasn't been created yet then create it.
+    // A leveling level pushes its partitions down one at a time.
+    if (_leveling)
+    {
+        while (!_partitions.empty())
+            pushDown(0);
+        return;
+    }
+
+    // Merge the runs of a tiered level into one sorted run in the next level.
+    addLevel();
+    _next->Merge(_partitions, _count);
+
+    // Now there is no values at this level. The old files are kept until a
+    // manifest without them has been saved.
+    for (int i = 0; i < _partitions.size(); i++)
+    {
+        retire(_partitions[i]);
+    }
+    _partitions.clear();
+    _count = 0;
+}
+
+/**
+ * Merge a partition of a leveling level into the next level and remove it
+ * from this level.
+ */
+void FileLevel::pushDown(int partition)
+{
+    addLevel();
+    Partition* p = _partitions[partition];
+    _next->Merge(std::vector<Partition*>(1, p), p->getCount());
+
+    // The next partition to push down is the one after this one.
+    _cursor = p->getMaxKey();
+    _count -= p->getCount();
+    _partitions.erase(_partitions.begin() + partition);
+    retire(p);
+}
+
+/**
+ * If the next level hasn't been created yet then create it.
+ */
+void FileLevel::addLevel()
+{
     if (!_next)
     {
         _next = new FileLevel(
-            _leveling, _pageSize, _levelSize * _ratio, _ratio,
-            _filter.getNumBits(), _filter.getNumHashes());
+            _options, _cache, _depth + 1, _pageSize, _levelSize * _ratio,
+            _bits, _hashes);
     }
+}
 
-    // Merge the files fromt this level to the next level.
-    _next->Merge(_keyFile, _valFile, _count);
+/**
+ * Pick the partition to push down to the next level. This is the partition
+ * which overlaps the fewest values in the next level for each of its own
+ * values, so it is the cheapest to merge. Ties go to the first partition
+ * after the last one pushed down, so partitions which score the same take
+ * turns.
+ */
+int FileLevel::pickPartition()
+{
+    // The first partition after the last one pushed down. When there are
+    // none go back to the start.
+    int first = 0;
+    while (first < _partitions.size() && _partitions[first]->getMinKey() <= _cursor)
+    {
+        first++;
+    }
+    if (first == _partitions.size())
+        first = 0;
 
-    // Now there is no values at this level. Clear the bloom filters, the
-    // fence posts and the count.
-    _filter.Clear();
-    initFences();
-    _count = 0;
+    // Without a next level there is nothing to overlap.
+    if (!_next)
+        return first;
+
+    int best = first;
+    double bestScore = 0;
+    for (int i = 0; i < _partitions.size(); i++)
+    {
+        int p = (first + i) % _partitions.size();
+        double score = (double)_next->overlap(_partitions[p]->getMinKey(),
+            _partitions[p]->getMaxKey()) / std::max(1, _partitions[p]->getCount());
+        if (i == 0 || score < bestScore)
+        {
+            best = p;
+            bestScore = score;
+        }
+    }
+    return best;
 }
 
 /**
- * Copy the values from an upper level into this level using tiering.
+ * The number of values in the partitions of this level which overlap a range
+ * of keys.
  */
-void FileLevel::tier(InputReader* input)
+int FileLevel::overlap(kv_key_t lo, kv_key_t hi)
 {
-    // Just read the values in order from the input and and write the to the
-    // output.
-    OutputFileWriter output(_keyFile, _valFile, _pageSize, _count);
+    int count = 0;
+
+    // The runs of a tiered level aren't sorted by key, so check them all.
+    if (!_leveling)
+    {
+        for (int i = 0; i < _partitions.size(); i++)
+        {
+            Partition* p = _partitions[i];
+            if (p->getMinKey() <= hi && p->getMaxKey() >= lo)
+                count += p->getCount();
+        }
+        return count;
+    }
+
+    auto found = std::lower_bound(_partitions.begin(), _partitions.end(), lo,
+        [](Partition* p, kv_key_t key) { return p->getMaxKey() < key; });
+    for (; found != _partitions.end() && (*found)->getMinKey() <= hi; found++)
+    {
+        count += (*found)->getCount();
+    }
+    return count;
+}
+
+/**
+ * Copy the sorted values from an upper level into this level as a new run
+ * using tiering.
+ */
+template<class Reader>
+void FileLevel::tier(Reader* input)
+{
+    // Just read the values in order from the input and and write the to a
+    // new partition after the other runs.
+    _outputs.clear();
     while (input->HasNext())
     {
         kv_key_t key;
         kv_val_t val;
         input->Next(key, val);
-        out(key, val, output);
+        out(key, val);
     }
+    closeOutput();
+    _partitions.insert(_partitions.end(), _outputs.begin(), _outputs.end());
+    _outputs.clear();
 }
 
 /**
  * Copy the values from an upper level into this level using leveling.
- * i.e. merge sort the values into this level.
+ * i.e. merge sort the values into this level. When the level is partitioned
+ * only the partitions the values fall in are rewritten.
  */
-void FileLevel::level(InputReader* left)
+template<class Reader>
+void FileLevel::level(Reader* left)
 {
-    // Open temp files to write the output into.
-    File<kv_key_t> keyOut;
-    File<kv_val_t> valOut;
-    keyOut.Open(_keyFile.getFilename() + ".tmp", true);
-    valOut.Open(_valFile.getFilename() + ".tmp", true);
-    OutputFileWriter output(keyOut, valOut, _pageSize, 0);
-
-    // An easy way to keep the bloom filters and fences correct it to
-    // clear them here and then read each value as it is beign written to the
-    // output.
-    _filter.Clear();
-    initFences();
-
+    // The two sides of the merge will be called left and right. The left
+    // side is the level above and the right side is a partition of this
+    // level.
     kv_key_t lk, rk;
     kv_val_t lv, rv;
+    bool hasLeft = left->HasNext();
+    if (hasLeft)
+        left->Next(lk, lv);
 
-    // Check if there are any values currently in this level.
-    if (_count > 0)
+    _outputs.clear();
+    for (int i = 0; i < _partitions.size(); i++)
     {
-        // Create a buffer wrapper around the files for this level.
-        // Use a pointer for right value so it look the same as the left one.
-        InputFileReader r(_keyFile, _valFile, _count, _pageSize);
-        InputFileReader* right = &r;
-
-        // The two sides of the merge will be called left and right.
+        Partition* p = _partitions[i];
 
-        // Reset the count before writing out all the values.
-        _count = 0;
+        // Keep a partition as it is if none of the values from the level
+        // above fall in it. Then the output can't go past it.
+        if (partitioned() && (!hasLeft || lk > p->getMaxKey()))
+        {
+            closeOutput();
+            _outputs.push_back(p);
+            continue;
+        }
 
-        // Get the first keys and values.
-        left->Next(lk, lv);
-        right->Next(rk, rv);
-        while (true)
+        // Merge the partition with the values from the level above up to the
+        // end of it. Values before the first partition, or between two
+        // partitions, are merged into the partition after them. The last
+        // partition takes all the values after it.
+        kv_key_t end = i + 1 < _partitions.size() ? p->getMaxKey() : KEY_MAX;
+        if (p->getCount() > 0)
         {
-            // Write the key and value out for which ever key is smaller.
-            // Then get another value from the side we consumed.
-            //
-            // Where there are no more values from that side then write the
-            // other value out and finish this loop.
+            // Write the key and value out for which ever key is smaller. Then
+            // get another value from the side we consumed.
             //
-            // If this the key in the left and right side match then insert the
-            // left key (i.e. the one from the upper layer) first. This will
-            // make this sort stable, i.e. the values for the same key will be
-            // in the order they were inserted.
-            if (lk <= rk)
+            // If this the key in the left and right side match then insert
+            // the left key (i.e. the one from the upper layer) first. This
+            // will make this sort stable, i.e. the values for the same key
+            // will be in the order they were inserted.
+            InputFileReader right(p->getKeyFile(), p->getValFile(), p->getCount(), _pageSize,
+                mergeCache(), 0, ioDepth(), _options.directIo, _options.prefetch);
+            right.Next(rk, rv);
+            while (true)
             {
-                out(lk, lv, output);
-                if (left->HasNext())
+                if (hasLeft && lk <= rk)
                 {
-                    left->Next(lk, lv);
+                    out(lk, lv);
+                    hasLeft = left->HasNext();
+                    if (hasLeft)
+                        left->Next(lk, lv);
                 }
                 else
                 {
-                    out(rk, rv, output);
-                    break;
-                }
-            }
-            else
-            {
-                out(rk, rv, output);
-                if (right->HasNext())
-                {
-                    right->Next(rk, rv);
-                }
-                else
-                {
-                    out(lk, lv, output);
-                    break;
+                    out(rk, rv);
+                    if (!right.HasNext())
+                        break;
+                    right.Next(rk, rv);
                 }
             }
         }
 
-        // If the right side wasn't exausted the left side must have been
-        // exausted. Write out the remaining right values.
-        while (right->HasNext())
+        // The right side is exausted. Write out the left values up to the
+        // end of the partition.
+        while (hasLeft && lk <= end)
         {
-            right->Next(rk, rv);
-            out(rk, rv, output);
+            out(lk, lv);
+            hasLeft = left->HasNext();
+            if (hasLeft)
+                left->Next(lk, lv);
         }
+
+        // The partition has been replaced. Its files are kept until a
+        // manifest without them has been saved.
+        _count -= p->getCount();
+        retire(p);
     }
 
+    // Write out the remaining left values. This is used when this level
+    // doesn't have any values yet.
+    while (hasLeft)
+    {
+        out(lk, lv);
+        hasLeft = left->HasNext();
+        if (hasLeft)
+            left->Next(lk, lv);
+    }
+    closeOutput();
 
-    // If the left side wasn't exausted the right side must have been
-    // exausted. Write out the remaining left values.
-    // This will also be used if there are no values on the right side,
-    // i.e. this level currently dorsn't have any values.
-    while (left->HasNext())
+    // Switch this level to the new partitions.
+    _partitions.swap(_outputs);
+    _outputs.clear();
+}
+
+/**
+ * The number of key ranges to split a merge of this many values into. Only a
+ * big merge into a leveling level which is one run is split, and each range
+ * gets at least MIN_SPLIT values.
+ */
+int FileLevel::mergeThreads(int count)
+{
+    // A partitioned level already only rewrites the partitions the values
+    // fall in. Dropping superseded values means a range doesn't know how
+    // many values the ranges before it write, so it can't know where to
+    // start writing. The stream backend can't read a file on two threads.
+    if (!_leveling || partitioned() || _options.dropSuperseded ||
+        _options.backend != FileBackend::Posix)
     {
-        left->Next(lk, lv);
-        out(lk, lv, output);
+        return 1;
     }
+    return std::max(1, std::min(_options.mergeThreads, count / MIN_SPLIT));
+}
 
-    // Flush all the data to disk.
-    output.Flush();
+/**
+ * Merge sorted runs into this leveling level, which is one run, on several
+ * threads. The keys are split into ranges which each have about the same
+ * number of values, and each thread merges a range into its part of the
+ * output files. The files, bloom filter and fence posts are the same as level
+ * writes.
+ * @param runs The runs from the level above, oldest first.
+ * @param ranges The number of ranges to split the merge into.
+ */
+void FileLevel::levelSplit(const std::vector<Partition*>& runs, int ranges)
+{
+    // The inputs are the runs from the level above and this level's run, if
+    // it has one. The right side goes last.
+    std::vector<Partition*> inputs(runs);
+    if (!_partitions.empty())
+        inputs.push_back(_partitions[0]);
+
+    // The splitters are keys spread evenly through the biggest input. Range
+    // r has the keys after splitter r - 1 up to and including splitter r, so
+    // all the copies of a key are in one range.
+    Partition* biggest = inputs[0];
+    for (int i = 1; i < inputs.size(); i++)
+    {
+        if (inputs[i]->getCount() > biggest->getCount())
+            biggest = inputs[i];
+    }
+    std::vector<kv_key_t> splitters;
+    for (int r = 1; r < ranges; r++)
+    {
+        kv_key_t key;
+        biggest->getKeyFile().Read(key, (int)((int64_t)biggest->getCount() * r / ranges));
+        splitters.push_back(key);
+    }
 
-    // Now close the files for this level and the temp files.
-    // Rename the temp files over the files for this level.
+    // Find where each range starts in each input, and so where it starts in
+    // the output. bounds[i][r] is the start of range r in input i.
+    std::vector<std::vector<int>> bounds(inputs.size());
+    std::vector<int> starts(ranges + 1, 0);
+    for (int i = 0; i < inputs.size(); i++)
+    {
+        bounds[i].push_back(0);
+        for (int r = 0; r < splitters.size(); r++)
+        {
+            bounds[i].push_back(inputs[i]->UpperBound(splitters[r]));
+        }
+        bounds[i].push_back(inputs[i]->getCount());
+        for (int r = 0; r <= ranges; r++)
+        {
+            starts[r] += bounds[i][r];
+        }
+    }
+    int total = starts[ranges];
 
-    _keyFile.Close();
-    keyOut.Close();
-    std::rename(keyOut.getFilename().c_str(), _keyFile.getFilename().c_str());
-    _keyFile.Open(_keyFile.getFilename(), false);
+    Partition* output = newPartition();
+    output->StartWriting(total);
+
+    // Each range reads its part of each input. The inputs are read with
+    // positional reads so the threads can share their files.
+    int rights = _partitions.empty() ? 0 : 1;
+    auto merge = [&](int r)
+    {
+        InputFileReader* right = NULL;
+        if (rights)
+        {
+            Partition* p = inputs.back();
+            right = new InputFileReader(p->getKeyFile(), p->getValFile(), bounds.back()[r + 1],
+                _pageSize, mergeCache(), bounds.back()[r], ioDepth(), _options.directIo,
+                _options.prefetch);
+        }
 
-    _valFile.Close();
-    valOut.Close();
-    std::rename(valOut.getFilename().c_str(), _valFile.getFilename().c_str());
-    _valFile.Open(_valFile.getFilename(), false);
+        int lefts = inputs.size() - rights;
+        if (lefts == 1)
+        {
+            InputFileReader left(inputs[0]->getKeyFile(), inputs[0]->getValFile(),
+                bounds[0][r + 1], _pageSize, mergeCache(), bounds[0][r], ioDepth(),
+                _options.directIo, _options.prefetch);
+            mergeRange(&left, right, output, starts[r]);
+        }
+        else
+        {
+            InputRunReader left;
+            for (int i = 0; i < lefts; i++)
+            {
+                left.Add(inputs[i]->getKeyFile(), inputs[i]->getValFile(), bounds[i][r + 1],
+                    _pageSize, mergeCache(), bounds[i][r], ioDepth(), _options.directIo,
+                    _options.prefetch);
+            }
+            mergeRange(&left, right, output, starts[r]);
+        }
+        delete right;
+    };
+
+    // The first range is merged on this thread.
+    std::vector<std::thread> threads;
+    for (int r = 1; r < ranges; r++)
+    {
+        threads.push_back(std::thread(merge, r));
+    }
+    merge(0);
+    for (int t = 0; t < threads.size(); t++)
+    {
+        threads[t].join();
+    }
+    output->FinishWriting();
+
+    // The level's run has been replaced. Its files are kept until a manifest
+    // without them has been saved.
+    if (rights)
+        retire(_partitions[0]);
+    _partitions.assign(1, output);
+    _count = total;
+    _written += total;
+}
+
+/**
+ * Merge one key range of a split merge into the output partition.
+ * @param left Reads the range from the level above.
+ * @param right Reads the range from this level, or NULL if it is empty.
+ * @param pos The position of the range in the output.
+ */
+template<class Reader>
+void FileLevel::mergeRange(Reader* left, InputFileReader* right, Partition* output, int pos)
+{
+    // Each thread writes through its own files, so the write positions don't
+    // get mixed up.
+    File<kv_key_t> keyFile;
+    File<kv_val_t> valFile;
+    keyFile.Open(output->getKeyFile().getFilename(), false, _options.backend);
+    valFile.Open(output->getValFile().getFilename(), false, _options.backend);
+    OutputFileWriter writer(keyFile, valFile, _pageSize, pos,
+        _options.ioUring ? _options.ioDepth : 0, _options.directIo);
+
+    // This is the loop in level. When the keys match the left key, which is
+    // newer, goes first.
+    kv_key_t lk, rk;
+    kv_val_t lv, rv;
+    bool hasLeft = left->HasNext();
+    if (hasLeft)
+        left->Next(lk, lv);
+    bool hasRight = right && right->HasNext();
+    if (hasRight)
+        right->Next(rk, rv);
+    while (hasLeft || hasRight)
+    {
+        if (hasLeft && (!hasRight || lk <= rk))
+        {
+            output->Write(writer, lk, lv, pos++);
+            hasLeft = left->HasNext();
+            if (hasLeft)
+                left->Next(lk, lv);
+        }
+        else
+        {
+            output->Write(writer, rk, rv, pos++);
+            hasRight = right->HasNext();
+            if (hasRight)
+                right->Next(rk, rv);
+        }
+    }
+    writer.Flush();
 }
 
 /**
- * Write the key and value to the output buffers. Update the bloom filter and
- * fence posts with the key. Increment the count.
+ * Write the key and value to the output partition, starting a new one if
+ * needed. Increment the count.
+ * When dropping superseded values only the first copy of a key is written.
  */
-void FileLevel::out(kv_key_t key, kv_val_t val, OutputFileWriter& output)
+void FileLevel::out(kv_key_t key, kv_val_t val)
 {
-    output.Push(key, val);
+    // A leveling merge writes the most recent value of a key first. If we are
+    // dropping superseded values then skip the ones after it.
+    bool first = !_output || _output->getCount() == 0;
+    if (_options.dropSuperseded && _leveling && !first && key == _lastKey)
+    {
+        _dropped++;
+        return;
+    }
 
-    _filter.Add(key);
+    // A partitioned level starts a new partition when the output is full.
+    // All the copies of a key go in the same partition.
+    if (partitioned() && _output && _output->getCount() >= partitionSize() &&
+        key != _lastKey)
+    {
+        closeOutput();
+    }
 
-    int f = _count / _fenceSize;
-    if (key < _fenceMins[f])
-        _fenceMins[f] = key;
-    if (key > _fenceMaxs[f])
-        _fenceMaxs[f] = key;
+    if (!_output)
+    {
+        _output = newPartition();
+        _output->StartWriting();
+    }
 
+    _lastKey = key;
+    _written++;
+    _output->Push(key, val);
     _count++;
 }
 
 /**
- * Set all the fence mininims to intmax and all the fence maximumns.
+ * Finish writing the output partition and add it to the outputs.
  */
-void FileLevel::initFences()
+void FileLevel::closeOutput()
 {
-    for (int i = 0; i < _fenceCount; i++)
+    if (!_output)
+        return;
+
+    // The new files must be durable before they replace the old ones.
+    _output->FinishWriting();
+    _outputs.push_back(_output);
+    _output = NULL;
+}
+
+/**
+ * Create an empty partition with new files.
+ */
+Partition* FileLevel::newPartition()
+{
+    uint64_t bits, hashes;
+    filterSize(partitionSize(), bits, hashes);
+
+    int generation = _generation++;
+    return new Partition(_options, _cache, filename(generation), generation, _pageSize,
+        bits, hashes, _levelSize);
+}
+
+/**
+ * The size of the bloom filter for a partition in this level. Without a bits
+ * per key budget a partition gets its share of the bits for a full level.
+ * With one the filter is sized for this level's depth.
+ * @param items The number of items in the partition.
+ * @param bits Set to the number of bits in the filter.
+ * @param hashes Set to the number of hashes in the filter.
+ */
+void FileLevel::filterSize(int items, uint64_t& bits, uint64_t& hashes)
+{
+    if (_options.bitsPerKey <= 0)
+    {
+        bits = std::max((uint64_t)64, _bits * items / _levelSize);
+        hashes = _hashes;
+        return;
+    }
+
+    // Monkey (https://doi.org/10.1145/3035918.3064054) shows the sum of the
+    // false positive rates is lowest when each level's rate is proportional
+    // to its size. So each level above the last gets ln(ratio)/ln(2)^2 more
+    // bits per key than the level below it. The bits per key for the last
+    // level are picked so the whole tree averages the budget.
+    int levels = _depth;
+    for (FileLevel* level = _next; level; level = level->_next)
+    {
+        levels++;
+    }
+
+    double step = std::log((double)_ratio) / (M_LN2 * M_LN2);
+    double weights = 0;
+    double extra = 0;
+    double size = 1;
+    for (int depth = levels; depth >= 1; depth--)
     {
-        _fenceMins[i] = INT_MAX;
-        _fenceMaxs[i] = INT_MIN;
+        weights += size;
+        extra += size * (levels - depth) * step;
+        size /= _ratio;
     }
+    double last = _options.bitsPerKey - extra / weights;
+    double bitsPerKey = std::max(0.0, last + (levels - _depth) * step);
+
+    // The best number of hashes is ln(2) times the bits per key. A level with
+    // no hashes has no filter and every lookup searches it.
+    hashes = (uint64_t)std::lround(bitsPerKey * M_LN2);
+    bits = std::max((uint64_t)64, (uint64_t)(bitsPerKey * items));
+}
+
+/**
+ * Remove a partition which has been replaced. It is released by Purge.
+ */
+void FileLevel::retire(Partition* partition)
+{
+    _obsolete.push_back(partition);
+}
+
+/**
+ * The path of the files for a generation of this level without an extension.
+ */
+std::string FileLevel::filename(int generation)
+{
+    std::stringstream filename;
+    filename << _options.dir << "/lsm." << std::setfill('0') << std::setw(4) << _levelSize
+             << "." << generation;
+    return filename.str();
+}
+
+/**
+ * The cache merges read through, or NULL if they bypass the cache.
+ */
+PageCache* FileLevel::mergeCache()
+{
+    return _options.cacheMerges ? _cache : NULL;
+}
+
+/**
+ * The number of pages merges read ahead with io_uring, or 0 if they use
+ * blocking reads. Reads through the cache are never read ahead.
+ */
+int FileLevel::ioDepth()
+{
+    return _options.ioUring && !mergeCache() ? _options.ioDepth : 0;
+}
+
+/**
+ * Is this level split into partitions by key.
+ */
+bool FileLevel::partitioned()
+{
+    return _leveling && _options.partitionSize > 0;
+}
+
+/**
+ * The number of items in a partition. A leveling level which isn't
+ * partitioned is one partition, and a partition is never bigger than the
+ * level. Each run of a tiered level is a partition.
+ */
+int FileLevel::partitionSize()
+{
+    if (!_leveling)
+        return _levelSize / _ratio;
+    return partitioned() ? std::min(_options.partitionSize, _levelSize) : _levelSize;
 }
 
 /**
@@ -372,34 +898,51 @@ void FileLevel::initFences()
  */
 std::string FileLevel::Dump(bool verbose, int depth)
 {
+    uint64_t bits = 0;
+    uint64_t hashes = _hashes;
+    size_t fenceBytes = 0;
+    size_t indexSegments = 0;
+    size_t indexBytes = 0;
+    for (int i = 0; i < _partitions.size(); i++)
+    {
+        Partition* p = _partitions[i];
+        bits += p->getFilterBits();
+        hashes = p->getNumHashes();
+        fenceBytes += p->getFenceBytes();
+        if (p->getIndex())
+        {
+            indexSegments += p->getIndex()->getSegments();
+            indexBytes += p->getIndex()->getMemory();
+        }
+    }
+
     std::stringstream output;
     output << "FileLevel "
            << depth
            << " leveling " << _leveling
            << " size: " << _levelSize
            << " ratio: " << _ratio
+           << " bits: " << bits
+           << " hashes: " << hashes
            << " count: " << _count
            << " Count: " << Count()
-           << std::endl;
+           << " written: " << _written
+           << " dropped: " << _dropped
+           << " runs: " << (_leveling ? _count > 0 : _partitions.size())
+           << " partitions: " << _partitions.size()
+           << " fence bytes: " << fenceBytes;
+    if (_options.learnedIndex > 0)
+    {
+        output << " index segments: " << indexSegments
+               << " index bytes: " << indexBytes;
+    }
+    output << std::endl;
 
     if (verbose)
     {
-        output << "Fence ";
-        for (int i = 0; i < _fenceCount; i++)
+        for (int i = 0; i < _partitions.size(); i++)
         {
-            output << "[ " << _fenceMins[i] << ", " << _fenceMaxs[i] << " ]";
-        }
-        output << std::endl;
-
-        kv_key_t key;
-        kv_val_t val;
-        std::string str;
-        for (int i = 0; i < _count; i++)
-        {
-            _keyFile.Read(key, i);
-            _valFile.Read(val, i);
-            value2string(val, str);
-            output << "  " << key << "=\"" << str << "\"" << std::endl;
+            output << _partitions[i]->Dump(verbose);
         }
     }
 
@@ -409,4 +952,4 @@ std::string FileLevel::Dump(bool verbose, int depth)
     return output.str();
 }
 
-}
\ No newline at end of file
+}
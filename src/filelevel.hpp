@@ -2,6 +2,24 @@
  * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
  *
  * A file level in the LSM tree.
+ *
+ * A level is made of sorted runs. A leveling level is one run which each
+ * merge into it replaces. A tiered level has up to ratio runs, one for each
+ * merge into it. When a tiered level is full its runs are merged into one
+ * run in the next level. Each level has its own policy, see Options::policy,
+ * so e.g. the upper levels can tier and the last level can level.
+ *
+ * The runs are kept in partitions, see partition.hpp. Each run of a tiered
+ * level is a partition, and a leveling level is usually one partition. A
+ * partitioned leveling level splits its run by key into partitions of about
+ * Options::partitionSize items. A merge into it only rewrites the partitions
+ * which overlap the merged keys, and when it is full it pushes one partition
+ * down to the next level instead of the whole level, so the work done by a
+ * merge doesn't grow with the size of the level.
+ *
+ * Lookups don't read the levels. They read a version of the tree, see
+ * version.hpp, which has the partitions of every level. So a merge can
+ * replace partitions while lookups on other threads are reading them.
  */
 
 #ifndef KVFILELEVEL_H
@@ -10,9 +28,15 @@
 #include "types.hpp"
 #include "keyvalues.hpp"
 #include "file.hpp"
+#include "mappedfile.hpp"
 #include "inputreader.hpp"
 #include "outputfilewriter.hpp"
 #include "bloomfilter.hpp"
+#include "options.hpp"
+#include "manifest.hpp"
+#include "partition.hpp"
+#include "version.hpp"
+#include <vector>
 
 namespace kv
 {
@@ -26,23 +50,48 @@ public:
 
     /**
      * Create a file level.
-     * @param leveling true if using leveling, else use tiering.
+     * @param options The settings for the store.
+     * @param cache The page cache for the store, or NULL.
+     * @param depth The depth of this level. The first file level is 1.
      * @param pageSize The size of disk pages.
      * @param levelSize The number of items to store in this level.
-     * @param ratio Size ratio between adjacent levels.
-     * @param bits The number of bits int he bloom filter.
-     * @param hashes The number of hashes in the bloom filter.
+     * @param bits The number of bits in the bloom filters of a full level.
+     * @param hashes The number of hashes in the bloom filters.
      */
-    FileLevel(bool leveling, int pageSize, int levelSize, int ratio, int bits, int hashes);
+    FileLevel(const Options& options, PageCache* cache, int depth, int pageSize,
+        int levelSize, uint64_t bits, uint64_t hashes);
+
+    /**
+     * Reopen a file level, and the levels below it, from the files left by a
+     * previous store.
+     * @param options The settings for the store.
+     * @param cache The page cache for the store, or NULL.
+     * @param levels The levels read from the manifest.
+     * @param depth The index of this level in levels.
+     */
+    FileLevel(const Options& options, PageCache* cache, std::vector<LevelInfo>& levels,
+        int depth);
+
     ~FileLevel();
 
     /**
-     * Get a value from this level or the levels below it.
-     * @param key The key to lookup.
-     * @param val Set to the value, if it is found.
-     * @return true if the key was found.
+     * Add this level, and the levels below it, to the manifest. Write the
+     * bloom filters and fence posts for each partition.
+     */
+    void Save(Manifest& manifest);
+
+    /**
+     * Release the replaced partitions of this level and the levels below it.
+     * Called once a manifest which doesn't need them has been saved. Their
+     * files are deleted when no version of the tree has them.
      */
-    bool Get(kv_key_t key, kv_val_t &val);
+    void Purge();
+
+    /**
+     * Add the partitions of this level, and the levels below it, to a new
+     * version of the tree.
+     */
+    void Snapshot(Version* version);
 
     /**
      * Return this count of this level plus the levels below it.
@@ -50,16 +99,25 @@ public:
     int Count();
 
     /**
-     * Merge an array of keys and values into this level.
+     * Merge an array of keys and values into this level. They are sorted first.
      * This is called from the memory level.
      */
     void Merge(kv_key_t* keys, kv_val_t* vals, int count);
 
     /**
-     * Merge keys and values a files into this level. This is called be the level
-     * above this one to merge into this level.
+     * Merge sorted keys and values from a skip list into this level.
+     * This is called from the memory level when leveling.
+     * @param count The number of values in the skip list.
      */
-    void Merge(File<kv_key_t>& keys, File<kv_val_t>& vals, int count);
+    void Merge(InputListReader* input, int count);
+
+    /**
+     * Merge sorted runs into this level. This is called by the level above
+     * this one with the partition it pushes down, or with its runs when it
+     * is tiered. When a key is in more than one run the later runs are newer.
+     * @param count The number of values in the runs.
+     */
+    void Merge(const std::vector<Partition*>& runs, int count);
 
     /**
      * Return a string with a description of this level and all the levels below it.
@@ -69,63 +127,183 @@ public:
 
 private:
     /**
-     * Look in the current level for a key using a linear seach because this
-     * level is not sorted, i.e. tiering, not leveling.
+     * Flush the current level to the next level.
      */
-    bool get_tiering(kv_key_t key, kv_val_t &val);
+    void flush();
 
     /**
-     * Look in the current level for a key using a binary seach because this
-     * level is sorted, i.e. leveling, not tiering.
+     * Implemeting the merge using a InputReader which wrappes both arrays of
+     * keys/values from the memory level and files from disk levels.
+     * The merge is compiled for each kind of reader, so reading the next
+     * item in the merge loops isn't a virtual call.
+     * @param count The number of values in the input.
      */
-    bool get_leveling(kv_key_t key, kv_val_t &val);
+    template<class Reader>
+    void merge(Reader* input, int count);
 
     /**
-     * Flush the current level to the next level.
+     * Make room in this level for the values being merged into it, by
+     * flushing it or pushing partitions down to the next level.
+     * @param count The number of values being merged.
      */
-    void flush();
+    void makeRoom(int count);
 
     /**
-     * Implemeting the merge using a InputReader which wrappes both arrays of
-     * keys/values from the memory level and files from disk levels.
+     * Use the leveling or tiering algorthm to copy values from the level
+     * above to this level.
      */
-    void merge(InputReader* input);
+    template<class Reader>
+    void copy(Reader* input);
 
     /**
-     * Copy the values from an upper level into this level using tiering.
+     * Copy the sorted values from an upper level into this level as a new run
+     * using tiering. Each run is a partition.
      */
-    void tier(InputReader* input);
+    template<class Reader>
+    void tier(Reader* input);
 
     /**
      * Copy the values from an upper level into this level using leveling.
-     * i.e. merge sort the values into this level.
+     * i.e. merge sort the values into this level. When the level is
+     * partitioned only the partitions the values fall in are rewritten.
+     */
+    template<class Reader>
+    void level(Reader* input);
+
+    /**
+     * The number of key ranges to split a merge of this many values into.
+     * Only a big merge into a leveling level which is one run is split, and
+     * each range gets at least MIN_SPLIT values.
+     */
+    int mergeThreads(int count);
+
+    /**
+     * Merge sorted runs into this leveling level, which is one run, on
+     * several threads. The keys are split into ranges which each have about
+     * the same number of values, and each thread merges a range into its
+     * part of the output files. The files, bloom filter and fence posts are
+     * the same as level writes.
+     * @param runs The runs from the level above, oldest first.
+     * @param ranges The number of ranges to split the merge into.
+     */
+    void levelSplit(const std::vector<Partition*>& runs, int ranges);
+
+    /**
+     * Merge one key range of a split merge into the output partition.
+     * @param left Reads the range from the level above.
+     * @param right Reads the range from this level, or NULL if it is empty.
+     * @param pos The position of the range in the output.
+     */
+    template<class Reader>
+    void mergeRange(Reader* left, InputFileReader* right, Partition* output, int pos);
+
+    /**
+     * Write the key and value to the output partition, starting a new one if
+     * needed. Increment the count.
+     * When dropping superseded values only the first copy of a key is written.
+     */
+    void out(kv_key_t key, kv_val_t val);
+
+    /**
+     * Finish writing the output partition and add it to the outputs.
+     */
+    void closeOutput();
+
+    /**
+     * Merge a partition of a leveling level into the next level and remove
+     * it from this level.
+     */
+    void pushDown(int partition);
+
+    /**
+     * If the next level hasn't been created yet then create it.
+     */
+    void addLevel();
+
+    /**
+     * Pick the partition to push down to the next level. This is the
+     * partition which overlaps the fewest values in the next level for each
+     * of its own values, so it is the cheapest to merge. Ties go to the first
+     * partition after the last one pushed down, so partitions which score the
+     * same take turns.
+     */
+    int pickPartition();
+
+    /**
+     * The number of values in the partitions of this level which overlap a
+     * range of keys.
+     */
+    int overlap(kv_key_t lo, kv_key_t hi);
+
+    /**
+     * Create an empty partition with new files.
+     */
+    Partition* newPartition();
+
+    /**
+     * The size of the bloom filter for a partition in this level. Without a
+     * bits per key budget a partition gets its share of the bits for a full
+     * level. With one the filter is sized for this level's depth.
+     * @param items The number of items in the partition.
+     * @param bits Set to the number of bits in the filter.
+     * @param hashes Set to the number of hashes in the filter.
+     */
+    void filterSize(int items, uint64_t& bits, uint64_t& hashes);
+
+    /**
+     * Remove a partition which has been replaced. It is released by Purge.
+     */
+    void retire(Partition* partition);
+
+    /**
+     * The path of the files for a generation of this level without an
+     * extension.
+     */
+    std::string filename(int generation);
+
+    /**
+     * The cache merges read through, or NULL if they bypass the cache.
+     */
+    PageCache* mergeCache();
+
+    /**
+     * The number of pages merges read ahead with io_uring, or 0 if they use
+     * blocking reads. Reads through the cache are never read ahead.
      */
-    void level(InputReader* input);
+    int ioDepth();
 
     /**
-     * Write the key and value to the output buffers. Update the bloom filter and
-     * fence posts with the key. Increment the count.
+     * Is this level split into partitions by key.
      */
-    void out(kv_key_t key, kv_val_t val, OutputFileWriter& output);
+    bool partitioned();
 
     /**
-     * Set all the fence mininims to intmax and all the fence maximumns.
+     * The number of items in a partition. A leveling level which isn't
+     * partitioned is one partition, and a partition is never bigger than the
+     * level. Each run of a tiered level is a partition.
      */
-    void initFences();
+    int partitionSize();
 
+    Options _options;           // The settings for the store.
     bool _leveling;             // Are we doing leveling or tiering.
     int _pageSize;              // The size of file pages.
     int _levelSize;             // The number of items we will store at this level.
     int _ratio;                 // Size ratio between adjacent levels.
+    int _depth;                 // The depth of this level, starting at 1.
     int _count;                 // The number of items currently in this level.
-    File<kv_key_t> _keyFile;    // The file with keys.
-    File<kv_val_t> _valFile;    // The file with values.
+    uint64_t _bits;             // The number of bits in the bloom filters for a full level.
+    uint64_t _hashes;           // The number of hashes in the bloom filters.
     FileLevel *_next;           // The level below this one.
-    BloomFilter _filter;        // The bloom filter.
-    int _fenceCount;            // The number of fenced regions.
-    int _fenceSize;             // The number of items in a fenced region.
-    int* _fenceMins;            // The min feence post values.
-    int* _fenceMaxs;            // The max feence post values.
+    PageCache *_cache;          // The page cache for lookups, or NULL.
+    std::vector<Partition*> _partitions;    // In key order, or oldest first when tiering.
+    std::vector<Partition*> _outputs;       // The partitions being built by a merge.
+    Partition* _output;         // The partition a merge is writing to.
+    kv_key_t _cursor;           // The largest key of the last partition pushed down.
+    int _generation;            // The generation of the next partition's files.
+    uint64_t _written;          // The values written by merges into this level.
+    uint64_t _dropped;          // The superseded values merges dropped.
+    kv_key_t _lastKey;          // The last key written by a merge.
+    std::vector<Partition*> _obsolete;  // Replaced partitions waiting for Purge.
 };
 
 }
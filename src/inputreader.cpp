@@ -6,6 +6,7 @@
  */
 
 #include "inputreader.hpp"
+#include <algorithm>
 
 namespace kv
 {
@@ -19,47 +20,297 @@ namespace kv
  * @param valFile The value file to read from.
  * @param count. The number of values in the files.
  * @param pageSize the size of disk pages to use.
+ * @param cache Read pages through this cache, or NULL to bypass the cache.
+ * @param start The position to start reading from.
+ * @param depth The number of pages to read ahead with io_uring, or 0 to read
+ *              each page when it is needed.
+ * @param direct If true read the files with direct I/O, if their pages are
+ *               aligned and the pages don't come through the cache.
+ * @param prefetch The number of pages to read ahead on a helper thread when
+ *                 they aren't read ahead with io_uring, or 0.
  */
-InputFileReader::InputFileReader(File<kv_key_t> &keyFile, File<kv_val_t> &valFile, int count, int pageSize)
-    : _pageSize(pageSize),
+InputFileReader::InputFileReader(File<kv_key_t> &keyFile, File<kv_val_t> &valFile, int count, int pageSize,
+    PageCache* cache, int start, int depth, bool direct, int prefetch)
+    : _cache(cache),
+      _pageSize(pageSize),
       _count(count),
       _keyFile(keyFile),
       _valFile(valFile),
-      _f(0),    // The last position read from the files.
-      _i(0)     // The number of items read from the file.
+      _keyIn(&keyFile),
+      _valIn(&valFile),
+      _f(start / pageSize * pageSize),  // The next page to read.
+      _i(start),    // The number of items read from the file.
+      _ring(NULL),
+      _depth(0),
+      _ahead(0),
+      _inflight(0),
+      _prefetcher(NULL),
+      _fetched(0),
+      _released(0),
+      _stop(false)
 {
-    // Create two arrays to act as memory buffers.
-    _keys = new kv_key_t[pageSize];
-    _vals = new kv_val_t[pageSize];
+    if (direct && !cache)
+        openDirect();
 
-    // Get the first values.
+    // Read ahead when there is more than one page to read, with io_uring
+    // unless the pages come through the cache, or else on a helper thread.
+    // Otherwise create two arrays to act as memory buffers.
+    bool pages = count > _f + pageSize;
+    bool ring = depth > 0 && !cache && pages && startReadAhead(depth);
+    if (!ring && (prefetch <= 0 || !pages || !startPrefetch(prefetch)))
+    {
+        _keys = newPage<kv_key_t>(pageSize);
+        _vals = newPage<kv_val_t>(pageSize);
+    }
+
+    // Get the first values. Skip the ones before the start in its page.
     fetch();
+    _b = start - (_f - pageSize);
 }
 
 InputFileReader::~InputFileReader()
 {
-    delete [] _keys;
-    delete [] _vals;
+    // The kernel, or the helper thread, writes to the buffers until the reads
+    // are done.
+    if (_prefetcher)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            _stop = true;
+        }
+        _changed.notify_all();
+        _prefetcher->join();
+        delete _prefetcher;
+    }
+    while (_inflight > 0)
+        complete();
+    delete _ring;
+
+    if (_keyPages.empty())
+    {
+        deletePage(_keys);
+        deletePage(_vals);
+    }
+    for (int i = 0; i < _keyPages.size(); i++)
+    {
+        deletePage(_keyPages[i]);
+        deletePage(_valPages[i]);
+    }
+    if (_keyIn != &_keyFile)
+    {
+        delete _keyIn;
+        delete _valIn;
+    }
 }
 
-void InputFileReader::Next(kv_key_t &key, kv_val_t &val)
+/**
+ * Open the files again for direct I/O, if their pages are aligned.
+ */
+void InputFileReader::openDirect()
 {
-    // If we read all items in the arrays get more.
-    if (_b == _pageSize)
-        fetch();
+    if (_keyFile.getFd() < 0 || !File<kv_key_t>::alignedPages(_pageSize) ||
+        !File<kv_val_t>::alignedPages(_pageSize))
+    {
+        return;
+    }
 
-    key = _keys[_b];
-    val = _vals[_b];
-    _b++;
-    _i++;
+    // Both files are read the same way, even if only one can be direct.
+    File<kv_key_t>* keys = new File<kv_key_t>();
+    File<kv_val_t>* vals = new File<kv_val_t>();
+    keys->Open(_keyFile.getFilename(), false, FileBackend::Posix, true);
+    vals->Open(_valFile.getFilename(), false, FileBackend::Posix, true);
+    if (!keys->isDirect() || !vals->isDirect())
+    {
+        delete keys;
+        delete vals;
+        return;
+    }
+    _keyIn = keys;
+    _valIn = vals;
+}
+
+/**
+ * Set up a ring and start reading pages ahead.
+ * @return false if the ring couldn't be set up.
+ */
+bool InputFileReader::startReadAhead(int depth)
+{
+    if (_keyIn->getFd() < 0 || _valIn->getFd() < 0)
+        return false;
+    IoRing* ring = new IoRing();
+    if (!ring->Open(2 * depth))
+    {
+        delete ring;
+        return false;
+    }
+
+    // Page p is read into buffer p % depth. The key buffers are registered
+    // first and then the value buffers.
+    _ring = ring;
+    _depth = depth;
+    std::vector<iovec> buffers;
+    for (int i = 0; i < depth; i++)
+    {
+        _keyPages.push_back(newPage<kv_key_t>(_pageSize));
+        buffers.push_back({_keyPages[i], _pageSize * sizeof(kv_key_t)});
+    }
+    for (int i = 0; i < depth; i++)
+    {
+        _valPages.push_back(newPage<kv_val_t>(_pageSize));
+        buffers.push_back({_valPages[i], _pageSize * sizeof(kv_val_t)});
+    }
+    _ring->Register(buffers);
+    _arrived.assign(depth, 0);
+
+    _ahead = _f / _pageSize;
+    for (int i = 0; i < depth; i++)
+    {
+        readAhead();
+    }
+    _ring->Submit();
+    return true;
 }
 
-bool InputFileReader::HasNext() { return _i < _count; }
+/**
+ * Queue the read of the next page into its buffer, if it is in the stream.
+ */
+void InputFileReader::readAhead()
+{
+    if ((int64_t)_ahead * _pageSize >= _count)
+        return;
+
+    // The tag is the page and which file it is from.
+    int slot = _ahead % _depth;
+    off_t pos = (off_t)_ahead * _pageSize;
+    _ring->Read(_keyIn->getFd(), _keyPages[slot], _pageSize * sizeof(kv_key_t),
+        pos * sizeof(kv_key_t), slot, (uint64_t)_ahead * 2);
+    _ring->Read(_valIn->getFd(), _valPages[slot], _pageSize * sizeof(kv_val_t),
+        pos * sizeof(kv_val_t), _depth + slot, (uint64_t)_ahead * 2 + 1);
+    _ahead++;
+    _inflight += 2;
+}
+
+/**
+ * Wait for a read to finish. A read which fails, or is short, is done again
+ * without the ring.
+ */
+void InputFileReader::complete()
+{
+    uint64_t tag;
+    int result;
+    _ring->Wait(tag, result);
+    _inflight--;
+
+    // The last page of a file can be short, so only the items in the stream
+    // have to be read.
+    int page = tag / 2;
+    int slot = page % _depth;
+    int items = std::min(_pageSize, _count - page * _pageSize);
+    if (tag % 2 == 0 && result < (int)(items * sizeof(kv_key_t)))
+        _keyIn->Read(_keyPages[slot], page * _pageSize, _pageSize);
+    if (tag % 2 == 1 && result < (int)(items * sizeof(kv_val_t)))
+        _valIn->Read(_valPages[slot], page * _pageSize, _pageSize);
+    _arrived[slot]++;
+}
+
+/**
+ * Start a helper thread which reads pages ahead.
+ * @param pages The number of pages to read ahead of the one being read.
+ * @return false if the files can't be read by another thread.
+ */
+bool InputFileReader::startPrefetch(int pages)
+{
+    // The stream backend moves a shared read position.
+    if (_keyIn->getFd() < 0 || _valIn->getFd() < 0)
+        return false;
+
+    // Page p is read into buffer p % depth. There is a buffer for the page
+    // being read and one for each page ahead of it.
+    _depth = pages + 1;
+    for (int i = 0; i < _depth; i++)
+    {
+        _keyPages.push_back(newPage<kv_key_t>(_pageSize));
+        _valPages.push_back(newPage<kv_val_t>(_pageSize));
+    }
+    _fetched = _f / _pageSize;
+    _released = _fetched;
+    _prefetcher = new std::thread(&InputFileReader::prefetch, this, _fetched);
+    return true;
+}
+
+/**
+ * Read pages into their buffers on the helper thread, until the stream ends or
+ * the reader is freed.
+ * @param page The first page.
+ */
+void InputFileReader::prefetch(int page)
+{
+    for (; (int64_t)page * _pageSize < _count; page++)
+    {
+        // Wait for the buffer to be done with.
+        {
+            std::unique_lock<std::mutex> lock(_lock);
+            _changed.wait(lock, [&]() { return _stop || page < _released + _depth; });
+            if (_stop)
+                return;
+        }
+
+        int slot = page % _depth;
+        bool full = (int64_t)(page + 1) * _pageSize <= _count;
+        readPage(_cache, *_keyIn, page, _pageSize, full, _keyPages[slot]);
+        readPage(_cache, *_valIn, page, _pageSize, full, _valPages[slot]);
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            _fetched = page + 1;
+        }
+        _changed.notify_all();
+    }
+}
 
 void InputFileReader::fetch()
 {
-    _keyFile.Read(_keys, _f, _pageSize);
-    _valFile.Read(_vals, _f, _pageSize);
+    int page = _f / _pageSize;
+    if (_prefetcher)
+    {
+        // The pages before this one are done with, so the helper thread can
+        // read ahead into their buffers. Then wait for this page.
+        {
+            std::unique_lock<std::mutex> lock(_lock);
+            _released = page;
+            _changed.notify_all();
+            _changed.wait(lock, [&]() { return _fetched > page; });
+        }
+        int slot = page % _depth;
+        _keys = _keyPages[slot];
+        _vals = _valPages[slot];
+        _f += _pageSize;
+        _b = 0;
+        return;
+    }
+
+    if (_ring)
+    {
+        // The page before this one is done with, so its buffer can take the
+        // next page to read ahead. Then wait for both halves of this page.
+        if (_ahead < page + _depth)
+        {
+            readAhead();
+            _ring->Submit();
+        }
+        int slot = page % _depth;
+        while (_arrived[slot] < 2)
+            complete();
+        _arrived[slot] = 0;
+        _keys = _keyPages[slot];
+        _vals = _valPages[slot];
+        _f += _pageSize;
+        _b = 0;
+        return;
+    }
+
+    bool full = _f + _pageSize <= _count;
+    readPage(_cache, *_keyIn, page, _pageSize, full, _keys);
+    readPage(_cache, *_valIn, page, _pageSize, full, _vals);
     _f += _pageSize;
     _b = 0;
 }
@@ -77,13 +328,160 @@ InputMemReader::InputMemReader(kv_key_t* keys, kv_val_t* vals, int count)
 {
 }
 
-void InputMemReader::Next(kv_key_t &key, kv_val_t &val)
+/**
+ * An input reader which reads a skip list in key order.
+ * Used when merging from the memory level when leveling.
+ */
+InputListReader::InputListReader(SkipList* list)
+    : _list(list),
+      _node(list ? list->First() : SkipList::END)
+{
+}
+
+/**
+ * An input reader which merges the sorted runs of a tiered level into one
+ * sorted run. Used when a tiered level is flushed to the next level.
+ * When a key is in more than one run the copies from the newer runs, which
+ * are added later, come first.
+ */
+InputRunReader::InputRunReader()
+    : _next(-1)
+{
+}
+
+/**
+ * Add the next newer run.
+ * @param keyFile The key file to read from.
+ * @param valFile The value file to read from.
+ * @param count The number of values in the files, or the position to stop
+ *              reading at.
+ * @param pageSize The size of disk pages to use.
+ * @param cache Read pages through this cache, or NULL to bypass the cache.
+ * @param start The position to start reading from.
+ * @param depth The number of pages to read ahead with io_uring, or 0.
+ */
+void InputRunReader::Add(File<kv_key_t>& keyFile, File<kv_val_t>& valFile, int count,
+    int pageSize, PageCache* cache, int start, int depth, bool direct, int prefetch)
+{
+    _runs.push_back(new InputFileReader(keyFile, valFile, count, pageSize, cache, start,
+        depth, direct, prefetch));
+    _keys.resize(_runs.size());
+    _vals.resize(_runs.size());
+    _live.resize(_runs.size());
+    advance(_runs.size() - 1);
+}
+
+InputRunReader::~InputRunReader()
+{
+    for (int r = 0; r < _runs.size(); r++)
+    {
+        delete _runs[r];
+    }
+}
+
+void InputRunReader::Next(kv_key_t &key, kv_val_t &val)
+{
+    key = _keys[_next];
+    val = _vals[_next];
+    advance(_next);
+}
+
+/**
+ * Read the next key from a run and find the run with the smallest next key.
+ * There are only ratio runs so they are checked in turn. Checking the newest
+ * run first, and only replacing it with a smaller key, puts the newest copy
+ * of a key first.
+ */
+void InputRunReader::advance(int run)
+{
+    _live[run] = _runs[run]->HasNext();
+    if (_live[run])
+        _runs[run]->Next(_keys[run], _vals[run]);
+
+    _next = -1;
+    for (int r = _runs.size() - 1; r >= 0; r--)
+    {
+        if (_live[r] && (_next < 0 || _keys[r] < _keys[_next]))
+            _next = r;
+    }
+}
+
+/**
+ * An input reader which owns arrays of keys and values.
+ * Used to scan the parts of levels which aren't sorted on disk.
+ */
+InputVectorReader::InputVectorReader()
+    : _i(0)
+{
+}
+
+void InputVectorReader::Next(kv_key_t &key, kv_val_t &val)
 {
     key = _keys[_i];
     val = _vals[_i];
     _i++;
 }
 
-bool InputMemReader::HasNext() { return _i < _count; }
+bool InputVectorReader::HasNext() { return _i < _keys.size(); }
+
+/**
+ * Add a key and value to the end of the arrays.
+ */
+void InputVectorReader::Add(kv_key_t key, kv_val_t val)
+{
+    _keys.push_back(key);
+    _vals.push_back(val);
+}
+
+/**
+ * Sort the keys. The order of equal keys doesn't change.
+ */
+void InputVectorReader::Sort()
+{
+    std::vector<int> order(_keys.size());
+    for (int i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(),
+        [this](int a, int b) { return _keys[a] < _keys[b]; });
+
+    std::vector<kv_key_t> keys(order.size());
+    std::vector<kv_val_t> vals(order.size());
+    for (int i = 0; i < order.size(); i++)
+    {
+        keys[i] = _keys[order[i]];
+        vals[i] = _vals[order[i]];
+    }
+    _keys.swap(keys);
+    _vals.swap(vals);
+}
 
-}
\ No newline at end of file
+/**
+ * An input reader which reads a level's files from a position.
+ * Used to scan a range of keys. The files are opened again so merges which
+ * replace the level's files don't change what is read.
+ *
+ * @param filename The path of the level's files without an extension.
+ * @param count The number of values in the files.
+ * @param pageSize The size of disk pages to use.
+ * @param start The position to start reading from.
+ * @param backend How to access the files.
+ */
+InputScanReader::InputScanReader(std::string filename, int count, int pageSize, int start,
+    FileBackend backend)
+{
+    _keyFile.Open(filename + ".key", false, backend);
+    _valFile.Open(filename + ".dat", false, backend);
+    _reader = new InputFileReader(_keyFile, _valFile, count, pageSize, NULL, start);
+}
+
+InputScanReader::~InputScanReader()
+{
+    delete _reader;
+}
+
+void InputScanReader::Next(kv_key_t &key, kv_val_t &val) { _reader->Next(key, val); }
+bool InputScanReader::HasNext() { return _reader->HasNext(); }
+
+}
@@ -3,6 +3,9 @@
  *
  * These wrappers are designed for sequencal access to the level data.
  * For random access see FileKeyValues and MemKeyValues.
+ *
+ * The readers used by merges are final and read their next item in the
+ * header, so a merge compiled for a concrete reader inlines them.
  */
 
 #ifndef KVINPUTREADER_H
@@ -10,6 +13,14 @@
 
 #include "file.hpp"
 #include "types.hpp"
+#include "skiplist.hpp"
+#include "pagecache.hpp"
+#include "ioring.hpp"
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 namespace kv
 {
@@ -25,6 +36,7 @@ namespace kv
 class InputReader
 {
 public:
+    virtual ~InputReader() {}
     virtual void Next(kv_key_t &key, kv_val_t &val) {}
     virtual bool HasNext() { return false; }
 };
@@ -34,12 +46,19 @@ public:
  * Used when merging from the memory level (level 0) to the first disk level.
  * For sequental access see MemKeyValues.
  */
-class InputMemReader : public InputReader
+class InputMemReader final : public InputReader
 {
 public:
     InputMemReader(kv_key_t* keys, kv_val_t* vals, int count);
-    void Next(kv_key_t &key, kv_val_t &val) override;
-    bool HasNext() override;
+
+    void Next(kv_key_t &key, kv_val_t &val) override
+    {
+        key = _keys[_i];
+        val = _vals[_i];
+        _i++;
+    }
+
+    bool HasNext() override { return _i < _count; }
 
 private:
     kv_key_t* _keys;
@@ -48,31 +67,205 @@ private:
     int _i;
 };
 
+/**
+ * An input reader which reads a skip list in key order.
+ * Used when merging from the memory level when leveling.
+ */
+class InputListReader final : public InputReader
+{
+public:
+    InputListReader(SkipList* list);
+
+    void Next(kv_key_t &key, kv_val_t &val) override
+    {
+        key = _list->Key(_node);
+        val = _list->Val(_node);
+        _node = _list->Next(_node);
+    }
+
+    bool HasNext() override { return _node != SkipList::END; }
+
+private:
+    SkipList* _list;
+    int _node;      // The next node to read.
+};
+
 /**
  * An input reader which reads from files.
  * Used when merging from a disk level to another disk level.
  * For sequental access see FileKeyValues.
+ *
+ * It can read pages ahead with io_uring, so the next pages are on their way
+ * while the merge loop works on this one. Then it has a buffer for each page
+ * in flight, and Next moves on to the next buffer. Without io_uring it can
+ * read pages ahead into the buffers on a helper thread instead.
+ *
+ * It can also read the files with direct I/O, so a merge doesn't fill the
+ * kernel's page cache with pages lookups won't read. Then it opens the files
+ * again for direct I/O and reads whole pages, which must be aligned to
+ * DIRECT_ALIGN. The files are read through the page cache when they aren't.
  */
-class InputFileReader : public InputReader
+class InputFileReader final : public InputReader
 {
 public:
-    InputFileReader(File<kv_key_t>& keys, File<kv_val_t>& vals, int count, int pageSize);
+    InputFileReader(File<kv_key_t>& keys, File<kv_val_t>& vals, int count, int pageSize,
+        PageCache* cache = NULL, int start = 0, int depth = 0, bool direct = false,
+        int prefetch = 0);
     ~InputFileReader();
-    void Next(kv_key_t &key, kv_val_t &val) override;
-    bool HasNext() override;
+
+    void Next(kv_key_t &key, kv_val_t &val) override
+    {
+        // If we read all items in the arrays get more.
+        if (_b == _pageSize)
+            fetch();
+
+        key = _keys[_b];
+        val = _vals[_b];
+        _b++;
+        _i++;
+    }
+
+    bool HasNext() override { return _i < _count; }
 
 private:
     void fetch();
 
+    /**
+     * Open the files again for direct I/O, if their pages are aligned.
+     */
+    void openDirect();
+
+    /**
+     * Set up a ring and start reading pages ahead.
+     * @return false if the ring couldn't be set up.
+     */
+    bool startReadAhead(int depth);
+
+    /**
+     * Queue the read of the next page into its buffer, if it is in the
+     * stream.
+     */
+    void readAhead();
+
+    /**
+     * Wait for a read to finish. A read which fails, or is short, is done
+     * again without the ring.
+     */
+    void complete();
+
+    /**
+     * Start a helper thread which reads pages ahead.
+     * @param pages The number of pages to read ahead of the one being read.
+     * @return false if the files can't be read by another thread.
+     */
+    bool startPrefetch(int pages);
+
+    /**
+     * Read pages into their buffers on the helper thread, until the stream
+     * ends or the reader is freed.
+     * @param page The first page.
+     */
+    void prefetch(int page);
+
     kv_key_t* _keys;
     kv_val_t* _vals;
     File<kv_key_t>& _keyFile;
     File<kv_val_t>& _valFile;
+    File<kv_key_t>* _keyIn;             // The files pages are read from, which
+    File<kv_val_t>* _valIn;             //   are opened again for direct I/O.
+    PageCache* _cache;
     int _pageSize;
     int _count;
     int _f;
     int _b;
     int _i;
+    IoRing* _ring;                      // Reads pages ahead, or NULL.
+    int _depth;                         // The number of pages read ahead.
+    std::vector<kv_key_t*> _keyPages;   // The buffer for each page in flight.
+    std::vector<kv_val_t*> _valPages;
+    std::vector<int> _arrived;          // The reads of each buffer which are done.
+    int _ahead;                         // The next page to read ahead.
+    int _inflight;                      // The reads which haven't been waited for.
+    std::thread* _prefetcher;           // Reads pages ahead, or NULL.
+    std::mutex _lock;                   // Guards the pages read and released.
+    std::condition_variable _changed;   // Signalled when they change.
+    int _fetched;                       // The pages before this have been read.
+    int _released;                      // The pages before this are done with.
+    bool _stop;                         // Tells the helper thread to stop.
+};
+
+/**
+ * An input reader which merges the sorted runs of a tiered level into one
+ * sorted run. Used when a tiered level is flushed to the next level.
+ * When a key is in more than one run the copies from the newer runs, which
+ * are added later, come first.
+ */
+class InputRunReader final : public InputReader
+{
+public:
+    InputRunReader();
+    ~InputRunReader();
+    void Add(File<kv_key_t>& keys, File<kv_val_t>& vals, int count, int pageSize,
+        PageCache* cache = NULL, int start = 0, int depth = 0, bool direct = false,
+        int prefetch = 0);
+    void Next(kv_key_t &key, kv_val_t &val) override;
+    bool HasNext() override { return _next >= 0; }
+
+private:
+    void advance(int run);
+
+    std::vector<InputFileReader*> _runs;
+    std::vector<kv_key_t> _keys;    // The next key from each run.
+    std::vector<kv_val_t> _vals;    // The next value from each run.
+    std::vector<bool> _live;        // Does the run have a next key.
+    int _next;                      // The run with the smallest key, or -1.
+};
+
+/**
+ * An input reader which owns arrays of keys and values.
+ * Used to scan the parts of levels which aren't sorted on disk.
+ */
+class InputVectorReader final : public InputReader
+{
+public:
+    InputVectorReader();
+    void Next(kv_key_t &key, kv_val_t &val) override;
+    bool HasNext() override;
+
+    /**
+     * Add a key and value to the end of the arrays.
+     */
+    void Add(kv_key_t key, kv_val_t val);
+
+    /**
+     * Sort the keys. The order of equal keys doesn't change.
+     */
+    void Sort();
+
+private:
+    std::vector<kv_key_t> _keys;
+    std::vector<kv_val_t> _vals;
+    int _i;
+};
+
+/**
+ * An input reader which reads a level's files from a position.
+ * Used to scan a range of keys. The files are opened again so merges which
+ * replace the level's files don't change what is read.
+ */
+class InputScanReader final : public InputReader
+{
+public:
+    InputScanReader(std::string filename, int count, int pageSize, int start,
+        FileBackend backend);
+    ~InputScanReader();
+    void Next(kv_key_t &key, kv_val_t &val) override;
+    bool HasNext() override;
+
+private:
+    File<kv_key_t> _keyFile;
+    File<kv_val_t> _valFile;
+    InputFileReader* _reader;
 };
 
 }
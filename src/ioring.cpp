@@ -0,0 +1,226 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * A small io_uring wrapper, used by merges to keep reads and writes in flight
+ * while the merge loop runs.
+ */
+
+#include "ioring.hpp"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+namespace kv
+{
+
+IoRing::IoRing()
+    : _fd(-1),
+      _sqRing(NULL),
+      _sqRingSize(0),
+      _cqRing(NULL),
+      _cqRingSize(0),
+      _sqes(NULL),
+      _sqesSize(0),
+      _queued(0),
+      _registered(false)
+{
+}
+
+/**
+ * Close the ring. Any requests still in flight must have been waited for.
+ */
+IoRing::~IoRing()
+{
+    close();
+}
+
+/**
+ * Set up a ring.
+ * @param entries The most requests which can be queued at once.
+ * @return false if the kernel doesn't have io_uring.
+ */
+bool IoRing::Open(unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    _fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (_fd < 0)
+    {
+        _fd = -1;
+        return false;
+    }
+
+    // Map the submission ring, the completion ring and the submission
+    // entries. Newer kernels put both rings in one mapping.
+    _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single)
+        _sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+
+    void* sqRing = mmap(NULL, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        _fd, IORING_OFF_SQ_RING);
+    _sqRing = sqRing == MAP_FAILED ? NULL : sqRing;
+    if (single)
+    {
+        _cqRing = _sqRing;
+    }
+    else
+    {
+        void* cqRing = mmap(NULL, _cqRingSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+        _cqRing = cqRing == MAP_FAILED ? NULL : cqRing;
+    }
+    _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(NULL, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        _fd, IORING_OFF_SQES);
+    _sqes = sqes == MAP_FAILED ? NULL : (io_uring_sqe*)sqes;
+    if (!_sqRing || !_cqRing || !_sqes)
+    {
+        close();
+        return false;
+    }
+
+    char* sq = (char*)_sqRing;
+    _sqHead = (unsigned*)(sq + params.sq_off.head);
+    _sqTail = (unsigned*)(sq + params.sq_off.tail);
+    _sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    _sqArray = (unsigned*)(sq + params.sq_off.array);
+    char* cq = (char*)_cqRing;
+    _cqHead = (unsigned*)(cq + params.cq_off.head);
+    _cqTail = (unsigned*)(cq + params.cq_off.tail);
+    _cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    _cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+/**
+ * Register buffers which requests will use.
+ * @return false if they couldn't be registered, e.g. the locked memory limit
+ *         is too low. Requests still work, without the speed up.
+ */
+bool IoRing::Register(const std::vector<iovec>& buffers)
+{
+    _registered = syscall(__NR_io_uring_register, _fd, IORING_REGISTER_BUFFERS,
+        buffers.data(), buffers.size()) == 0;
+    return _registered;
+}
+
+/**
+ * Queue a read from a file.
+ * @param fd The file to read from.
+ * @param data Where to read to.
+ * @param len The number of bytes to read.
+ * @param offset The position in the file to read from, in bytes.
+ * @param buffer The index of the registered buffer data is in, or -1.
+ * @param tag Returned by Wait with the result.
+ */
+void IoRing::Read(int fd, void* data, unsigned len, off_t offset, int buffer, uint64_t tag)
+{
+    bool fixed = buffer >= 0 && _registered;
+    queue(fixed ? IORING_OP_READ_FIXED : IORING_OP_READ, fd, data, len, offset, buffer, tag);
+}
+
+/**
+ * Queue a write to a file. The parameters are the same as Read.
+ */
+void IoRing::Write(int fd, const void* data, unsigned len, off_t offset, int buffer,
+    uint64_t tag)
+{
+    bool fixed = buffer >= 0 && _registered;
+    queue(fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, fd, data, len, offset, buffer, tag);
+}
+
+/**
+ * Queue a request.
+ */
+void IoRing::queue(uint8_t op, int fd, const void* data, unsigned len, off_t offset,
+    int buffer, uint64_t tag)
+{
+    // Only this thread moves the tail, so it can be read without a barrier.
+    // The entry must be filled in before the kernel can see the new tail.
+    unsigned tail = *_sqTail;
+    unsigned index = tail & _sqMask;
+    io_uring_sqe* sqe = &_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = (uint64_t)(uintptr_t)data;
+    sqe->len = len;
+    sqe->user_data = tag;
+    if (op == IORING_OP_READ_FIXED || op == IORING_OP_WRITE_FIXED)
+        sqe->buf_index = buffer;
+    _sqArray[index] = index;
+    __atomic_store_n(_sqTail, tail + 1, __ATOMIC_RELEASE);
+    _queued++;
+}
+
+/**
+ * Send the queued requests to the kernel.
+ */
+void IoRing::Submit()
+{
+    while (_queued > 0)
+    {
+        int n = syscall(__NR_io_uring_enter, _fd, _queued, 0, 0, NULL, 0);
+        if (n >= 0)
+            _queued -= n;
+        else if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            return;
+    }
+}
+
+/**
+ * Send the queued requests to the kernel and wait for one to finish.
+ * @param tag Set to the tag of the request.
+ * @param result Set to the number of bytes read or written, or to minus the
+ *               error number.
+ */
+void IoRing::Wait(uint64_t& tag, int& result)
+{
+    while (true)
+    {
+        // Only this thread moves the head. The kernel fills in a result
+        // before it moves the tail past it.
+        unsigned head = *_cqHead;
+        if (head != __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE))
+        {
+            io_uring_cqe* cqe = &_cqes[head & _cqMask];
+            tag = cqe->user_data;
+            result = cqe->res;
+            __atomic_store_n(_cqHead, head + 1, __ATOMIC_RELEASE);
+            return;
+        }
+
+        int n = syscall(__NR_io_uring_enter, _fd, _queued, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (n >= 0)
+            _queued -= n;
+    }
+}
+
+/**
+ * Unmap the rings and close the ring's file descriptor.
+ */
+void IoRing::close()
+{
+    if (_sqes)
+        munmap(_sqes, _sqesSize);
+    if (_cqRing && _cqRing != _sqRing)
+        munmap(_cqRing, _cqRingSize);
+    if (_sqRing)
+        munmap(_sqRing, _sqRingSize);
+    _sqes = NULL;
+    _cqRing = NULL;
+    _sqRing = NULL;
+    if (_fd >= 0)
+        ::close(_fd);
+    _fd = -1;
+    _registered = false;
+}
+
+}
@@ -0,0 +1,129 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * A small io_uring wrapper, used by merges to keep reads and writes in flight
+ * while the merge loop runs.
+ *
+ * The ring is set up with the io_uring system calls directly, so the store
+ * doesn't need liburing. Requests are queued with Read and Write, sent to the
+ * kernel with Submit, and their results collected with Wait. Each request has
+ * a tag which its result comes back with. Buffers which are used again and
+ * again can be registered, so the kernel doesn't map their pages for every
+ * request.
+ *
+ * When the kernel doesn't have io_uring, e.g. it is older than 5.1 or it has
+ * been turned off, Open returns false and the caller uses blocking reads and
+ * writes instead.
+ */
+
+#ifndef KVIORING_H
+#define KVIORING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace kv
+{
+
+/**
+ * A ring of reads and writes which the kernel does in the background.
+ */
+class IoRing
+{
+public:
+    /**
+     * Creating a ring does nothing.
+     * You need to call Open.
+     */
+    IoRing();
+
+    /**
+     * Close the ring. Any requests still in flight must have been waited for.
+     */
+    ~IoRing();
+
+    /**
+     * Set up a ring.
+     * @param entries The most requests which can be queued at once.
+     * @return false if the kernel doesn't have io_uring.
+     */
+    bool Open(unsigned entries);
+
+    /**
+     * Register buffers which requests will use.
+     * @return false if they couldn't be registered, e.g. the locked memory
+     *         limit is too low. Requests still work, without the speed up.
+     */
+    bool Register(const std::vector<iovec>& buffers);
+
+    /**
+     * Queue a read from a file.
+     * @param fd The file to read from.
+     * @param data Where to read to.
+     * @param len The number of bytes to read.
+     * @param offset The position in the file to read from, in bytes.
+     * @param buffer The index of the registered buffer data is in, or -1.
+     * @param tag Returned by Wait with the result.
+     */
+    void Read(int fd, void* data, unsigned len, off_t offset, int buffer, uint64_t tag);
+
+    /**
+     * Queue a write to a file. The parameters are the same as Read.
+     */
+    void Write(int fd, const void* data, unsigned len, off_t offset, int buffer, uint64_t tag);
+
+    /**
+     * Send the queued requests to the kernel.
+     */
+    void Submit();
+
+    /**
+     * Send the queued requests to the kernel and wait for one to finish.
+     * @param tag Set to the tag of the request.
+     * @param result Set to the number of bytes read or written, or to minus
+     *               the error number.
+     */
+    void Wait(uint64_t& tag, int& result);
+
+    bool isOpen() { return _fd >= 0; }
+    bool isRegistered() { return _registered; }
+
+private:
+    /**
+     * Queue a request.
+     */
+    void queue(uint8_t op, int fd, const void* data, unsigned len, off_t offset, int buffer,
+        uint64_t tag);
+
+    /**
+     * Unmap the rings and close the ring's file descriptor.
+     */
+    void close();
+
+    int _fd;                    // The ring, or -1.
+    void* _sqRing;              // The mapped submission ring.
+    size_t _sqRingSize;
+    void* _cqRing;              // The mapped completion ring. The same as the
+    size_t _cqRingSize;         //   submission ring when the kernel shares them.
+    io_uring_sqe* _sqes;        // The mapped submission entries.
+    size_t _sqesSize;
+    unsigned* _sqHead;          // Advanced by the kernel as it takes requests.
+    unsigned* _sqTail;          // Advanced by us as we queue requests.
+    unsigned _sqMask;
+    unsigned* _sqArray;         // The entry of each slot in the submission ring.
+    unsigned* _cqHead;          // Advanced by us as we take results.
+    unsigned* _cqTail;          // Advanced by the kernel as requests finish.
+    unsigned _cqMask;
+    io_uring_cqe* _cqes;        // The results.
+    unsigned _queued;           // Requests queued since the last Submit.
+    bool _registered;           // Have buffers been registered.
+};
+
+}
+#endif
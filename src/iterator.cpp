@@ -0,0 +1,83 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * An iterator over the keys in a range, returned by Store::Scan.
+ */
+
+#include "iterator.hpp"
+#include "memlevel.hpp"
+
+namespace kv
+{
+
+/**
+ * Start a scan of the keys between lo and hi, inclusive.
+ * @param level The top level of the tree.
+ */
+Iterator::Iterator(MemLevel& level, kv_key_t lo, kv_key_t hi)
+    : _hi(hi)
+{
+    if (lo > hi)
+        return;
+
+    level.Scan(lo, hi, _sources);
+    _vals.resize(_sources.size());
+    for (int i = 0; i < _sources.size(); i++)
+    {
+        advance(i);
+    }
+}
+
+Iterator::~Iterator()
+{
+    for (int i = 0; i < _sources.size(); i++)
+    {
+        delete _sources[i];
+    }
+}
+
+/**
+ * Are there any more keys in the range.
+ */
+bool Iterator::HasNext()
+{
+    return !_heap.empty();
+}
+
+/**
+ * Get the next key in the range and its most recent value.
+ */
+void Iterator::Next(kv_key_t& key, std::string& value)
+{
+    // The top of the heap is the newest copy of the smallest key.
+    Head head = _heap.top();
+    _heap.pop();
+    key = head.first;
+    value2string(_vals[head.second], value);
+    advance(head.second);
+
+    // Skip the older copies of the key.
+    while (!_heap.empty() && _heap.top().first == key)
+    {
+        int source = _heap.top().second;
+        _heap.pop();
+        advance(source);
+    }
+}
+
+/**
+ * Read the next key from a source and add it to the heap, unless it is
+ * past the end of the range.
+ */
+void Iterator::advance(int source)
+{
+    if (!_sources[source]->HasNext())
+        return;
+
+    kv_key_t key;
+    _sources[source]->Next(key, _vals[source]);
+    if (key <= _hi)
+        _heap.push(Head(key, source));
+}
+
+}
@@ -0,0 +1,77 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * An iterator over the keys in a range, returned by Store::Scan.
+ *
+ * Each level provides a source which is sorted by key, with the newest copy
+ * of a key first, and the sources are ordered from the newest level to the
+ * oldest. A heap merges the sources, so the next key is always at the top.
+ * When the same key is in more than one source the copy from the newest
+ * source is returned and the others are skipped.
+ *
+ * The file levels are read a page at a time through their own file handles,
+ * so the range is never read into memory all at once. The keys from the
+ * memory level, and from tiered file levels which aren't sorted on disk, are
+ * copied when the scan starts.
+ */
+
+#ifndef KVITERATOR_H
+#define KVITERATOR_H
+
+#include "types.hpp"
+#include "inputreader.hpp"
+#include <vector>
+#include <queue>
+#include <string>
+#include <utility>
+#include <functional>
+
+namespace kv
+{
+
+class MemLevel;
+
+/**
+ * An iterator over the keys in a range, in key order.
+ */
+class Iterator
+{
+public:
+    /**
+     * Start a scan of the keys between lo and hi, inclusive.
+     * @param level The top level of the tree.
+     */
+    Iterator(MemLevel& level, kv_key_t lo, kv_key_t hi);
+    Iterator(const Iterator&) = delete;
+    Iterator& operator=(const Iterator&) = delete;
+    ~Iterator();
+
+    /**
+     * Are there any more keys in the range.
+     */
+    bool HasNext();
+
+    /**
+     * Get the next key in the range and its most recent value.
+     */
+    void Next(kv_key_t& key, std::string& value);
+
+private:
+    /**
+     * Read the next key from a source and add it to the heap, unless it is
+     * past the end of the range.
+     */
+    void advance(int source);
+
+    // A key and the source it is from. The heap puts the smallest key first
+    // and, for equal keys, the newest source.
+    typedef std::pair<kv_key_t, int> Head;
+
+    std::vector<InputReader*> _sources;     // Newest first.
+    std::vector<kv_val_t> _vals;            // The value of each source's head.
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> _heap;
+    kv_key_t _hi;                           // The end of the range.
+};
+
+}
+#endif
@@ -9,6 +9,7 @@
  */
 
 #include "keyvalues.hpp"
+#include <vector>
 
 namespace kv
 {
@@ -20,32 +21,64 @@ MemKeyValues::MemKeyValues(kv_key_t* keys, kv_val_t* vals, int count)
 {
 }
 
-kv_key_t MemKeyValues::Key(int i) { return _keys[i]; }
-kv_val_t MemKeyValues::Val(int i) { return _vals[i]; }
-int MemKeyValues::Count() { return _count; }
 
 
-FileKeyValues::FileKeyValues(File<kv_key_t> &keys, File<kv_val_t> &vals, int count)
+FileKeyValues::FileKeyValues(File<kv_key_t> &keys, File<kv_val_t> &vals, int count,
+    PageCache* cache, int pageSize)
     : _count(count),
         _keys(keys),
-        _vals(vals)
+        _vals(vals),
+        _cache(cache),
+        _pageSize(pageSize)
 {
 }
 
 kv_key_t FileKeyValues::Key(int i)
 {
     kv_key_t key;
-    _keys.Read(key, i);
+    read(_keys, i, key);
     return key;
 }
 
 kv_val_t FileKeyValues::Val(int i)
 {
     kv_val_t val;
-    _vals.Read(val, i);
+    read(_vals, i, val);
     return val;
 }
 
+/**
+ * Read an item from the cache, or read the whole page it is in from the file
+ * into the cache. Pages which aren't full are always read from the file.
+ */
+template<class T>
+void FileKeyValues::read(File<T>& file, int i, T& data)
+{
+    int page = _cache ? i / _pageSize : 0;
+    if (!_cache || (page + 1) * _pageSize > _count)
+    {
+        file.Read(data, i);
+        return;
+    }
+
+    size_t offset = (i % _pageSize) * sizeof(T);
+    if (_cache->Read(file.getId(), page, offset, sizeof(T), &data))
+        return;
+
+    std::vector<T> buffer(_pageSize);
+    readPage(_cache, file, page, _pageSize, true, buffer.data());
+    data = buffer[i % _pageSize];
+}
+
 int FileKeyValues::Count() { return _count; }
 
+
+
+MappedKeyValues::MappedKeyValues(MappedFile &keys, MappedFile &vals, int count)
+    : _keys((const kv_key_t*)keys.getData()),
+      _vals((const kv_val_t*)vals.getData()),
+      _count(count)
+{
+}
+
 }
\ No newline at end of file
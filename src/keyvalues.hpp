@@ -5,7 +5,8 @@
  * arrays or files.
  *
  * The searching alogritms use this type to seach both the memory level and disk
- * levels.
+ * levels. The wrappers are final and the in-memory ones are defined here, so
+ * a search given a concrete wrapper inlines its reads.
  */
 
 #ifndef KVKEYVALUES_H
@@ -13,6 +14,8 @@
 
 #include "types.hpp"
 #include "file.hpp"
+#include "mappedfile.hpp"
+#include "pagecache.hpp"
 
 namespace kv
 {
@@ -37,13 +40,13 @@ private:
 /**
  * Random access to the memory arrays.
  */
-class MemKeyValues : public KeyValues
+class MemKeyValues final : public KeyValues
 {
 public:
     MemKeyValues(kv_key_t* keys, kv_val_t* vals, int count);
-    kv_key_t Key(int i) override;
-    kv_val_t Val(int i) override;
-    int Count() override;
+    kv_key_t Key(int i) override { return _keys[i]; }
+    kv_val_t Val(int i) override { return _vals[i]; }
+    int Count() override { return _count; }
 
 private:
     kv_key_t* _keys;
@@ -54,19 +57,45 @@ private:
 
 /**
  * Random access to the keys and values in files.
+ * If there is a page cache the whole page with an item is read into it.
  */
-class FileKeyValues : public KeyValues
+class FileKeyValues final : public KeyValues
 {
 public:
-    FileKeyValues(File<kv_key_t> &keys, File<kv_val_t> &vals, int count);
+    FileKeyValues(File<kv_key_t> &keys, File<kv_val_t> &vals, int count,
+        PageCache* cache = NULL, int pageSize = 0);
     kv_key_t Key(int i) override;
     kv_val_t Val(int i) override;
     int Count();
 
 private:
+    template<class T>
+    void read(File<T>& file, int i, T& data);
+
     File<kv_key_t>& _keys;
     File<kv_val_t>& _vals;
     int _count;
+    PageCache* _cache;
+    int _pageSize;
+};
+
+
+/**
+ * Random access to the keys and values in memory mapped files.
+ * Reading a key is a memory read instead of a system call.
+ */
+class MappedKeyValues final : public KeyValues
+{
+public:
+    MappedKeyValues(MappedFile &keys, MappedFile &vals, int count);
+    kv_key_t Key(int i) override { return _keys[i]; }
+    kv_val_t Val(int i) override { return _vals[i]; }
+    int Count() override { return _count; }
+
+private:
+    const kv_key_t* _keys;
+    const kv_val_t* _vals;
+    int _count;
 };
 
 }
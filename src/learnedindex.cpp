@@ -0,0 +1,142 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * A learned index of the positions of the keys in a sorted file level.
+ */
+
+#include "learnedindex.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace kv
+{
+
+/**
+ * Create an empty index.
+ * @param epsilon The most a predicted position can be from the real one.
+ */
+LearnedIndex::LearnedIndex(int epsilon)
+    : _epsilon(epsilon),
+      _lo(0),
+      _hi(INFINITY),
+      _last(0)
+{
+}
+
+/**
+ * Forget all the keys.
+ */
+void LearnedIndex::Clear()
+{
+    _segments.clear();
+}
+
+/**
+ * Add the next key. Keys must be added in order. Only the position of the
+ * first copy of a key is kept.
+ * @param key The key.
+ * @param pos The position of the key in the level.
+ */
+void LearnedIndex::Add(kv_key_t key, int pos)
+{
+    if (!_segments.empty())
+    {
+        if (key == _last)
+            return;
+
+        // Narrow the open segment's slopes to the ones which predict this
+        // key's position within epsilon. If there are any left the key is
+        // part of the segment.
+        Segment& s = _segments.back();
+        double dx = distance(s.key, key);
+        double lo = std::max(_lo, (pos - _epsilon - s.pos) / dx);
+        double hi = std::min(_hi, (pos + _epsilon - s.pos) / dx);
+        if (lo <= hi)
+        {
+            _lo = lo;
+            _hi = hi;
+            s.slope = (lo + hi) / 2;
+            _last = key;
+            return;
+        }
+    }
+
+    // Start a new segment at this key.
+    Segment s = {key, pos, 0};
+    _segments.push_back(s);
+    _lo = 0;
+    _hi = INFINITY;
+    _last = key;
+}
+
+/**
+ * The distance from one key to a larger one. The keys are subtracted as
+ * unsigned numbers, so the distance between 64 bit keys can't overflow and
+ * is exact until it is rounded to a double.
+ */
+double LearnedIndex::distance(kv_key_t from, kv_key_t to)
+{
+    return (double)((uint64_t)to - (uint64_t)from);
+}
+
+/**
+ * Find the positions the first copy of a key must be between, if it was
+ * added.
+ * @param key The key to look for.
+ * @param count The number of items in the level.
+ * @param start Set to the first position to search.
+ * @param end Set to one past the last position to search.
+ */
+void LearnedIndex::Find(kv_key_t key, int count, int& start, int& end)
+{
+    start = end = 0;
+    if (_segments.empty() || key < _segments[0].key)
+        return;
+
+    // The last segment which starts at or before the key.
+    auto s = std::upper_bound(_segments.begin(), _segments.end(), key,
+        [](kv_key_t key, const Segment& s) { return key < s.key; }) - 1;
+    double pos = std::floor(s->pos + s->slope * distance(s->key, key));
+
+    // Allow one more position each side for rounding.
+    start = (int)std::max(0.0, std::min((double)count, pos - _epsilon - 1));
+    end = (int)std::max(0.0, std::min((double)count, pos + _epsilon + 2));
+}
+
+/**
+ * Write the segments to a stream.
+ */
+void LearnedIndex::Save(std::ostream& output)
+{
+    uint64_t size = _segments.size();
+    output.write((char*)&_epsilon, sizeof(_epsilon));
+    output.write((char*)&size, sizeof(size));
+    output.write((char*)_segments.data(), size * sizeof(Segment));
+}
+
+/**
+ * Replace the segments with ones written by Save.
+ * @return false if the stream could not be read or the index was written with
+ *         a different epsilon.
+ */
+bool LearnedIndex::Load(std::istream& input)
+{
+    int epsilon;
+    uint64_t size;
+    input.read((char*)&epsilon, sizeof(epsilon));
+    input.read((char*)&size, sizeof(size));
+    if (input.fail() || epsilon != _epsilon)
+        return false;
+
+    std::vector<Segment> segments(size);
+    input.read((char*)segments.data(), size * sizeof(Segment));
+    if (input.fail())
+        return false;
+
+    _segments.swap(segments);
+    if (!_segments.empty())
+        _last = _segments.back().key;
+    return true;
+}
+
+}
@@ -0,0 +1,113 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * A learned index of the positions of the keys in a sorted file level.
+ *
+ * The index is a list of line segments which map a key to its position in
+ * the level. Every key added to a segment is predicted to within epsilon of
+ * its real position, so a lookup only has to search 2 * epsilon + 1 keys.
+ * Uniform keys fit on a few long segments, and a dense run of keys starts a
+ * new segment with a steeper slope. See the PGM-index paper:
+ *     https://doi.org/10.14778/3389133.3389135
+ *
+ * The segments are built in one pass as the keys are written, using the
+ * shrinking cone algorithm. A segment starts at a key and keeps the range of
+ * slopes which predict every key in it within epsilon. When a key narrows
+ * the range to nothing it starts the next segment. This uses more segments
+ * than the optimal algorithm in the paper but is much simpler.
+ */
+
+#ifndef KVLEARNEDINDEX_H
+#define KVLEARNEDINDEX_H
+
+#include "types.hpp"
+#include <stddef.h>
+#include <vector>
+#include <iostream>
+
+namespace kv
+{
+
+/**
+ * A piecewise linear model of the positions of sorted keys.
+ */
+class LearnedIndex
+{
+public:
+    /**
+     * Create an empty index.
+     * @param epsilon The most a predicted position can be from the real one.
+     */
+    LearnedIndex(int epsilon);
+
+    /**
+     * Forget all the keys.
+     */
+    void Clear();
+
+    /**
+     * Add the next key. Keys must be added in order. Only the position of
+     * the first copy of a key is kept.
+     * @param key The key.
+     * @param pos The position of the key in the level.
+     */
+    void Add(kv_key_t key, int pos);
+
+    /**
+     * Find the positions the first copy of a key must be between, if it was
+     * added.
+     * @param key The key to look for.
+     * @param count The number of items in the level.
+     * @param start Set to the first position to search.
+     * @param end Set to one past the last position to search.
+     */
+    void Find(kv_key_t key, int count, int& start, int& end);
+
+    /**
+     * Write the segments to a stream.
+     */
+    void Save(std::ostream& output);
+
+    /**
+     * Replace the segments with ones written by Save.
+     * @return false if the stream could not be read or the index was written
+     *         with a different epsilon.
+     */
+    bool Load(std::istream& input);
+
+    int getEpsilon() { return _epsilon; }
+    size_t getSegments() { return _segments.size(); }
+
+    /**
+     * The number of bytes used by the segments.
+     */
+    size_t getMemory() { return _segments.size() * sizeof(Segment); }
+
+private:
+    /**
+     * A line through the first key in the segment. The position of a key
+     * is predicted as pos + slope * (key - this key).
+     */
+    struct Segment
+    {
+        kv_key_t key;
+        int pos;
+        double slope;
+    };
+
+    /**
+     * The distance from one key to a larger one. The keys are subtracted as
+     * unsigned numbers, so the distance between 64 bit keys can't overflow
+     * and is exact until it is rounded to a double.
+     */
+    static double distance(kv_key_t from, kv_key_t to);
+
+    int _epsilon;                   // The most a prediction can be out by.
+    std::vector<Segment> _segments; // Sorted by key. The last one is open.
+    double _lo;                     // The smallest slope for the open segment.
+    double _hi;                     // The largest slope for the open segment.
+    kv_key_t _last;                 // The last key added.
+};
+
+}
+#endif
@@ -0,0 +1,167 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * The manifest records the shape of the LSM tree so that a store can be
+ * reopened from the files it left on disk.
+ */
+
+#include "manifest.hpp"
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace kv
+{
+
+/**
+ * @param dir The directory the store keeps its files in.
+ */
+Manifest::Manifest(std::string dir)
+    : _filename(dir + "/lsm.manifest")
+{
+}
+
+/**
+ * Read the manifest file.
+ * @return false if there is no manifest or it can't be read.
+ */
+bool Manifest::Load()
+{
+    _levels.clear();
+
+    std::ifstream input(_filename);
+    if (!input.is_open())
+        return false;
+
+    int keyBits = 32;
+    int valLen = 20;
+    std::string line;
+    while (std::getline(input, line))
+    {
+        if (line.empty())
+            continue;
+
+        // Each value is preceded by its name.
+        std::stringstream fields(line);
+        std::string name;
+        if (line.compare(0, 5, "keys ") == 0)
+        {
+            fields >> name >> keyBits >> name >> valLen;
+            continue;
+        }
+
+        int depth;
+        int filter;
+        LevelInfo info;
+        fields >> name >> depth
+               >> name >> info.leveling
+               >> name >> info.size
+               >> name >> info.ratio
+               >> name >> info.pageSize
+               >> name >> info.count
+               >> name >> info.bits
+               >> name >> info.hashes
+               >> name >> filter
+               >> name >> info.generation;
+        info.filter = (FilterType)filter;
+
+        bool valid = !fields.fail();
+
+        // Read the partitions of a file level. Without them the level is one
+        // partition with the level's files.
+        int parts;
+        if (valid && fields >> name >> parts)
+        {
+            info.partitions.resize(parts);
+            for (int i = 0; i < parts; i++)
+            {
+                fields >> info.partitions[i].generation >> info.partitions[i].count;
+            }
+            valid = !fields.fail();
+        }
+        else if (valid && depth > 0)
+        {
+            PartitionInfo part = {info.generation++, info.count};
+            info.partitions.push_back(part);
+        }
+
+        if (!valid || depth != _levels.size())
+        {
+            _levels.clear();
+            return false;
+        }
+        _levels.push_back(info);
+    }
+
+    // The files can't be read with other widths.
+    if (keyBits != KV_KEY_BITS || valLen != VAL_LEN)
+    {
+        _levels.clear();
+        return false;
+    }
+
+    // There must at least be a memory level.
+    return !_levels.empty();
+}
+
+/**
+ * Write the manifest file. The file is written to a temp file and then
+ * renamed so a reader never sees half a manifest.
+ */
+void Manifest::Save()
+{
+    std::stringstream output;
+    output << "keys " << KV_KEY_BITS << " values " << VAL_LEN << "\n";
+    for (int i = 0; i < _levels.size(); i++)
+    {
+        LevelInfo& info = _levels[i];
+        output << "level " << i
+               << " leveling " << info.leveling
+               << " size " << info.size
+               << " ratio " << info.ratio
+               << " page " << info.pageSize
+               << " count " << info.count
+               << " bits " << info.bits
+               << " hashes " << info.hashes
+               << " filter " << (int)info.filter
+               << " gen " << info.generation
+               << " parts " << info.partitions.size();
+        for (int j = 0; j < info.partitions.size(); j++)
+        {
+            output << " " << info.partitions[j].generation << " " << info.partitions[j].count;
+        }
+        output << "\n";
+    }
+    writeFile(_filename, output.str());
+}
+
+/**
+ * Replace a file with new contents. The contents are written to a temp file
+ * which is synced and then renamed over the file.
+ */
+void writeFile(std::string filename, const std::string& contents)
+{
+    std::string tmp = filename + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return;
+
+    const char* data = contents.data();
+    size_t len = contents.size();
+    while (len > 0)
+    {
+        ssize_t n = ::write(fd, data, len);
+        if (n <= 0)
+            break;
+        data += n;
+        len -= n;
+    }
+    fsync(fd);
+    ::close(fd);
+
+    std::rename(tmp.c_str(), filename.c_str());
+}
+
+}
\ No newline at end of file
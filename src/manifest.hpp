@@ -0,0 +1,116 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * The manifest records the shape of the LSM tree so that a store can be
+ * reopened from the files it left on disk.
+ *
+ * The manifest is a text file with a line for the width of the keys and values
+ * in the files, one line for the memory level and one line for each file
+ * level, e.g.:
+ *
+ *     keys 32 values 20
+ *     level 0 leveling 1 size 1024 ratio 3 page 0 count 17 bits 0 hashes 0 filter 0 gen 0
+ *     level 1 leveling 1 size 3072 ratio 3 page 1024 count 2048 bits 1048576 hashes 4 filter 0 gen 6 parts 2 4 1024 5 1024
+ *
+ * A file level is a list of partitions, each with its own key and value
+ * files. The line ends with the number of partitions and then the generation
+ * and count of each one, in key order. gen is the next unused generation. A
+ * manifest written before levels were partitioned has no parts, and the
+ * level is one partition with the generation and count of the level.
+ *
+ * A store can only be reopened by a build with the same key and value widths,
+ * see types.hpp. A build with other widths can't read the manifest, the same
+ * as if it were damaged. A manifest written before the widths could be
+ * changed has no keys line, and its files have 32 bit keys and 20 character
+ * values.
+ *
+ * The bloom filters and fence posts for each partition are kept in a
+ * separate binary file next to the partition's key and value files.
+ *
+ * A file level writes new partitions whenever it replaces some of its
+ * contents, and the old partitions are only deleted after the next manifest
+ * has been saved. So the files named by a saved manifest are never changed
+ * except by appending past the count it records.
+ */
+
+#ifndef KVMANIFEST_H
+#define KVMANIFEST_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "types.hpp"
+#include "bloomfilter.hpp"
+
+namespace kv
+{
+
+/**
+ * What the manifest records about one partition of a file level.
+ */
+struct PartitionInfo
+{
+    int generation;     // The generation of the partition's files.
+    int count;          // The number of items in the partition.
+};
+
+/**
+ * What the manifest records about one level.
+ */
+struct LevelInfo
+{
+    bool leveling;      // Are we doing leveling or tiering.
+    int size;           // The number of items the level can store.
+    int ratio;          // Size ratio between adjacent levels.
+    int pageSize;       // The size of file pages. 0 for the memory level.
+    int count;          // The number of items in the level.
+    uint64_t bits;      // The number of bits in the bloom filter.
+    uint64_t hashes;    // The number of hashes in the bloom filter.
+    FilterType filter;  // How the bloom filter lays out its bits.
+    int generation;     // The next generation of the level's files.
+    std::vector<PartitionInfo> partitions;  // The partitions in key order.
+};
+
+/**
+ * Replace a file with new contents. The contents are written to a temp file
+ * which is synced and then renamed over the file.
+ */
+void writeFile(std::string filename, const std::string& contents);
+
+/**
+ * The manifest file for the store kept in a directory.
+ */
+class Manifest
+{
+public:
+    /**
+     * @param dir The directory the store keeps its files in.
+     */
+    Manifest(std::string dir);
+
+    /**
+     * Read the manifest file.
+     * @return false if there is no manifest or it can't be read.
+     */
+    bool Load();
+
+    /**
+     * Write the manifest file. The file is written to a temp file and then
+     * renamed so a reader never sees half a manifest.
+     */
+    void Save();
+
+    /**
+     * The levels, starting with the memory level.
+     */
+    std::vector<LevelInfo>& getLevels() { return _levels; }
+
+    std::string getFilename() { return _filename; }
+
+private:
+    std::string _filename;
+    std::vector<LevelInfo> _levels;
+};
+
+}
+#endif
@@ -0,0 +1,75 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * A read only memory mapping of a whole file. Used to search the key and value
+ * files of a level without a system call for every key read.
+ */
+
+#include "mappedfile.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace kv
+{
+
+MappedFile::MappedFile()
+    : _data(NULL),
+      _size(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    Unmap();
+}
+
+/**
+ * Map the current contents of a file. If the file is already mapped then
+ * the old mapping is replaced. This must be called again after the file
+ * is replaced or grows.
+ */
+bool MappedFile::Map(std::string filename)
+{
+    Unmap();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    // The mapping keeps the file alive so the descriptor can be closed.
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    // Lookups jump around the file so don't read ahead.
+    madvise(data, st.st_size, MADV_RANDOM);
+
+    _data = (char*)data;
+    _size = st.st_size;
+    return true;
+}
+
+/**
+ * Remove the mapping.
+ */
+void MappedFile::Unmap()
+{
+    if (_data)
+    {
+        munmap(_data, _size);
+        _data = NULL;
+        _size = 0;
+    }
+}
+
+}
@@ -0,0 +1,57 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * A read only memory mapping of a whole file. Used to search the key and value
+ * files of a level without a system call for every key read.
+ */
+
+#ifndef KVMAPPEDFILE_H
+#define KVMAPPEDFILE_H
+
+#include <string>
+#include <stddef.h>
+
+namespace kv
+{
+
+/**
+ * A read only memory mapping of a whole file.
+ */
+class MappedFile
+{
+public:
+    /**
+     * Creating a mapping does nothing.
+     * You need to call Map.
+     */
+    MappedFile();
+
+    /**
+     * Unmap the file if it is mapped.
+     */
+    ~MappedFile();
+
+    /**
+     * Map the current contents of a file. If the file is already mapped then
+     * the old mapping is replaced. This must be called again after the file
+     * is replaced or grows.
+     * @param filename The file path.
+     * @return false if the file could not be mapped, e.g. it is empty.
+     */
+    bool Map(std::string filename);
+
+    /**
+     * Remove the mapping.
+     */
+    void Unmap();
+
+    const char* getData() { return _data; }
+    size_t getSize() { return _size; }
+
+private:
+    char* _data;    // The start of the mapping or NULL.
+    size_t _size;   // The number of bytes mapped.
+};
+
+}
+#endif
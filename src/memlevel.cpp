@@ -5,171 +5,474 @@
  *
  * At this level there is no bloom filter or fence posts. The key array always
  * is searched for values.
+ *
+ * In background mode a full table is frozen and a new table takes the new
+ * writes while a worker thread merges the frozen table into the file levels.
+ *
+ * Lookups read the current version of the tree, see version.hpp. Each flush
+ * and merge publishes a new version, so many threads can look up keys while
+ * one thread puts.
  */
 
 #include "memlevel.hpp"
 #include "keyvalues.hpp"
-#include "algorithms.hpp"
+#include "manifest.hpp"
+#include "inputreader.hpp"
 #include <sstream>
 #include <cstring>
+#include <cstdio>
+#include <sys/stat.h>
+#include <dirent.h>
 
 namespace kv
 {
 
 /**
  * Create the memory level.
- * @param leveling true if using leveling, else use tiering.
- * @param size The number of items to store in this level.
- * @param ratio Size ratio between adjacent levels.
- * @param bits The number of bits int the bloom filter.
- * @param hashes The number of hashes in the bloom filter.
- */
-MemLevel::MemLevel(bool leveling, int size, int ratio, int bits, int hashes)
-    : _leveling(leveling),
-      _size(size),
-      _ratio(ratio),
-      _count(0),
-      _keys(new kv_key_t[size]),
-      _vals(new kv_val_t[size]),
+ * @param options The settings for the store.
+ * @param listener Told when the level is flushed. May be NULL.
+ */
+MemLevel::MemLevel(const Options& options, FlushListener* listener)
+    : _options(options),
+      _listener(listener),
+      _closed(false),
+      _leveling(options.levelingAt(0)),
+      _size(options.size),
+      _ratio(options.ratio),
+      _table(NULL),
       _next(NULL),
-      _bits(bits),
-      _hashes(hashes)
+      _cache(NULL),
+      _bits(options.bits),
+      _hashes(options.hashes),
+      _background(options.background),
+      _frozen(NULL),
+      _stop(false),
+      _version(NULL)
 {
+    // Make sure there is somewhere to put the level files.
+    mkdir(_options.dir.c_str(), 0755);
+
+    // The file levels share one page cache.
+    if (_options.cacheSize > 0)
+        _cache = new PageCache(_options.cacheSize);
+
+    if (_options.reopen)
+    {
+        restore();
+    }
+    else
+    {
+        clean();
+        _table = new MemTable(_leveling, _size);
+    }
+
+    // Lookups can start once there is a version to read.
+    publish(_table, NULL, true);
+
+    if (_background)
+        _worker = std::thread(&MemLevel::drain, this);
 }
 
 MemLevel::~MemLevel()
 {
-    delete [] _keys;
-    delete [] _vals;
+    Close();
+
+    // Release the current version before the levels, so the levels free the
+    // partitions in it.
+    _version->Unref();
+    _table->Unref();
     if (_next)
         delete _next;
+    delete _cache;
+}
+
+/**
+ * Finish any background merge and write the manifest so the store can be
+ * reopened. Nothing can be put after this.
+ */
+void MemLevel::Close()
+{
+    if (_closed)
+        return;
+    _closed = true;
+
+    // Let the worker finish any merge it has been given and then exit.
+    if (_background)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cond.notify_all();
+        _worker.join();
+    }
+
+    // Record the tree so it can be reopened.
+    std::lock_guard<std::mutex> lock(_levelMutex);
+    save(true);
+}
+
+/**
+ * Reopen the tree from the manifest and files left by a previous store.
+ */
+void MemLevel::restore()
+{
+    Manifest manifest(_options.dir);
+    if (!manifest.Load())
+    {
+        _table = new MemTable(_leveling, _size);
+        return;
+    }
+
+    // The shape of the tree comes from the manifest, not the options.
+    std::vector<LevelInfo>& levels = manifest.getLevels();
+    LevelInfo& info = levels[0];
+    _options.leveling = _leveling = info.leveling;
+    _options.ratio = _ratio = info.ratio;
+    _options.size = _size = info.size;
+    _options.filter = info.filter;
+    _table = new MemTable(_leveling, _size);
+
+    // Read the values which were in memory when the store was closed.
+    // If the store was using a write-ahead log the count will be 0 and the
+    // store replays the log instead.
+    File<kv_key_t> keyFile;
+    File<kv_val_t> valFile;
+    keyFile.Open(filename() + ".key", false);
+    valFile.Open(filename() + ".dat", false);
+    kv_key_t* keys = new kv_key_t[info.count];
+    kv_val_t* vals = new kv_val_t[info.count];
+    keyFile.Read(keys, 0, info.count);
+    valFile.Read(vals, 0, info.count);
+
+    // When tiering the values were saved in the order they were put. When
+    // leveling the most recent value for a key comes first in the files, so
+    // put them backwards so it also comes first in the list.
+    for (int i = 0; i < info.count; i++)
+    {
+        int j = _leveling ? info.count - 1 - i : i;
+        _table->Put(keys[j], vals[j]);
+    }
+    delete [] keys;
+    delete [] vals;
+
+    if (levels.size() > 1)
+        _next = new FileLevel(_options, _cache, levels, 1);
+}
+
+/**
+ * Delete the manifest and the level files left by a previous store, so a
+ * new store doesn't leave them behind. The write-ahead log deletes its
+ * own old segments.
+ */
+void MemLevel::clean()
+{
+    // Each generation of a level has its own files, so a new store doesn't
+    // overwrite the files of an old one.
+    DIR* d = opendir(_options.dir.c_str());
+    if (!d)
+        return;
+    std::vector<std::string> old;
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL)
+    {
+        if (strncmp(entry->d_name, "lsm.", 4) == 0 &&
+            strncmp(entry->d_name, "lsm.wal.", 8) != 0)
+        {
+            old.push_back(_options.dir + "/" + entry->d_name);
+        }
+    }
+    closedir(d);
+    for (int i = 0; i < old.size(); i++)
+    {
+        std::remove(old[i].c_str());
+    }
+}
+
+/**
+ * Write the manifest and the bloom filters and fence posts of the file
+ * levels. Then delete the files the manifest no longer needs.
+ * @param closing If true, and there is no write-ahead log, also write the
+ *                values in this level.
+ */
+void MemLevel::save(bool closing)
+{
+    Manifest manifest(_options.dir);
+    LevelInfo info;
+    info.leveling = _leveling;
+    info.size = _size;
+    info.ratio = _ratio;
+    info.pageSize = 0;
+    info.count = 0;
+    info.bits = 0;
+    info.hashes = 0;
+    info.filter = _options.filter;
+    info.generation = 0;
+    manifest.getLevels().push_back(info);
+
+    // When checkpointing after a flush the values in memory are either in the
+    // write-ahead log or they are lost on a crash.
+    if (closing && !_options.wal)
+    {
+        info.count = _table->Count();
+        manifest.getLevels()[0] = info;
+
+        File<kv_key_t> keyFile;
+        File<kv_val_t> valFile;
+        keyFile.Open(filename() + ".key", true);
+        valFile.Open(filename() + ".dat", true);
+        kv_key_t key;
+        kv_val_t val;
+        InputMemReader arrays(_table->getKeys(), _table->getVals(), _table->Count());
+        InputListReader list(_table->getList());
+        InputReader* input = _leveling ? (InputReader*)&list : &arrays;
+        while (input->HasNext())
+        {
+            input->Next(key, val);
+            keyFile.Write(key);
+            valFile.Write(val);
+        }
+        keyFile.Sync();
+        valFile.Sync();
+    }
+
+    if (_next)
+        _next->Save(manifest);
+
+    // Write the manifest last so it is only there if everything else is.
+    manifest.Save();
+
+    if (_next)
+        _next->Purge();
+}
+
+/**
+ * The path of the files for this level without an extension.
+ */
+std::string MemLevel::filename()
+{
+    return _options.dir + "/lsm.mem";
 }
 
 /**
  * Add a key/value to this level.
  * If necessery this will merge values into lower levels as the store grows.
+ * Only one thread can put at a time.
  */
 void MemLevel::Put(kv_key_t key, kv_val_t val)
 {
     // If this level is full then flush to the next level.
-    if (_count == _size)
+    if (_table->isFull())
         flush();
 
-    if (_leveling)
-        put_leveling(key, val);
-    else
-        put_tiering(key, val);
-
-    _count++;
+    _table->Put(key, val);
 }
+
 /**
  * Get a value from this level or the levels below it.
+ * Any number of threads can get while one thread puts.
  * @param key The key to lookup.
  * @param val Set to the value, if it is found.
  * @return true if the key was found.
  */
 bool MemLevel::Get(kv_key_t key, kv_val_t &val)
 {
-    // First look at this level.
-    if (_leveling)
-    {
-        if (get_leveling(key, val))
-            return true;
-    }
-    else
-    {
-        if (get_tiering(key, val))
-            return true;
-    }
-
-     // The key is not at this level so try the next level.
-    if (_next)
-    {
-        return _next->Get(key, val);
-    }
-
-    // The key wasn't at this level or any level below it.
-    return false;
+    // A version never changes, so it is searched without holding any locks.
+    Version* version = current();
+    bool found = version->Get(key, val);
+    version->Unref();
+    return found;
 }
+
 /**
- * Return this count of this level plus the levels below it.
+ * Get the values for a batch of keys from this level or the levels below
+ * it. Keys which are found are not searched for in the lower levels.
+ * @param keys The keys to lookup, sorted.
+ * @param vals Set to the value of each key which is found.
+ * @param pending The positions in keys to look for, in order. The
+ *                positions of the keys which are found are removed.
  */
-int MemLevel::Count()
+void MemLevel::MultiGet(const kv_key_t* keys, kv_val_t* vals, std::vector<int>& pending)
 {
-    return _count + (_next ? _next->Count() : 0);
+    Version* version = current();
+    version->MultiGet(keys, vals, pending);
+    version->Unref();
 }
 
 /**
- * Put a value in this level using the tiering algorthm when merging.
+ * Add readers for the keys between lo and hi in this level, and the
+ * levels below it, to a list of sources for a scan. The sources are
+ * added newest first and each one is sorted by key.
  */
-void MemLevel::put_tiering(kv_key_t key, kv_val_t val)
+void MemLevel::Scan(kv_key_t lo, kv_key_t hi, std::vector<InputReader*>& sources)
 {
-    _keys[_count] = key;
-    _vals[_count] = val;
+    // The readers copy the memory tables and open their own files, so the
+    // scan doesn't need the version once they are made.
+    Version* version = current();
+    version->Scan(lo, hi, sources);
+    version->Unref();
 }
 
 /**
- * Put a value in this level using the tiering algorthm when merging.
+ * Return this count of this level plus the levels below it.
  */
-void MemLevel::put_leveling(kv_key_t key, kv_val_t val)
+int MemLevel::Count()
 {
-    // The key is is sorted. Insert the new key before the first value which it
-    // is less than or equal to. Put the value at the same position in the
-    // values array.
-    for (int i = 0; i < _count; i++)
-    {
-        if (key <= _keys[i])
-        {
-            // Shift all the remaining values to make space for the new value.
-            std::memmove(&(_keys[i+1]), &(_keys[i]), (_count-i)*sizeof(kv_key_t));
-            std::memmove(&(_vals[i+1]), &(_vals[i]), (_count-i)*sizeof(kv_val_t));
-            _keys[i] = key;
-            _vals[i] = val;
-            return;
-        }
-    }
-    // We got to the end of the current values without finding a key which was
-    // greather than this key. Put his key and value after the last items.
-    _keys[_count] = key;
-    _vals[_count] = val;
+    // The frozen table is in the current version until the version with it
+    // merged into the file levels replaces it, so no item is counted twice.
+    Version* version = current();
+    int count = version->Count();
+    version->Unref();
+    return count;
 }
 
 /**
- * Look in the current level for a key using a linear seach because this
- * level is not sorted, i.e. tiering, not leveling.
+ * Take a reference to the current version of the tree. The caller removes it
+ * when they are done reading.
  */
-bool MemLevel::get_tiering(kv_key_t key, kv_val_t &val)
+Version* MemLevel::current()
 {
-    MemKeyValues kvs(_keys, _vals, _count);
-    return linearSearch(&kvs, key, val);
+    std::lock_guard<std::mutex> lock(_versionMutex);
+    _version->Ref();
+    return _version;
 }
 
 /**
- * Look in the current level for a key using a binary seach because this
- * level is sorted, i.e. leveling, not tiering.
+ * Make a new version of the tree and make it the current version.
+ * @param table The table which takes new puts.
+ * @param frozen The table being merged in the background, or NULL.
+ * @param levels When true the version has the file levels as they are now,
+ *               and the caller holds _levelMutex. Otherwise it has the file
+ *               levels of the current version.
  */
-bool MemLevel::get_leveling(kv_key_t key, kv_val_t &val)
+void MemLevel::publish(MemTable* table, MemTable* frozen, bool levels)
 {
-    MemKeyValues kvs(_keys, _vals, _count);
-    return binarySearch(&kvs, key, val);
+    Version* version = new Version(table, frozen);
+    if (levels && _next)
+        _next->Snapshot(version);
+
+    Version* old;
+    {
+        std::lock_guard<std::mutex> lock(_versionMutex);
+        if (!levels)
+            version->AddLevels(*_version);
+        old = _version;
+        _version = version;
+    }
+
+    // Lookups which are still reading the old version keep it, and the
+    // partitions in it, until they are done.
+    if (old)
+        old->Unref();
 }
+
 /**
  * Flush the current level to the next level.
+ * In background mode this freezes the current table and returns.
  */
 void MemLevel::flush()
+{
+    if (_listener)
+        _listener->Flushing();
+
+    if (!_background)
+    {
+        // Lookups read the full table until the merge is done and a version
+        // with a new table and the merged file levels replaces it.
+        MemTable* full = _table;
+        {
+            std::lock_guard<std::mutex> levelLock(_levelMutex);
+            merge(full);
+            std::lock_guard<std::mutex> lock(_mutex);
+            _table = new MemTable(_leveling, _size);
+            publish(_table, NULL, true);
+        }
+        full->Unref();
+        if (_listener)
+            _listener->Flushed();
+        return;
+    }
+
+    // Only one table can be frozen. If the worker is still merging the last
+    // one then wait for it.
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cond.wait(lock, [this] { return _frozen == NULL; });
+
+    // Freeze the full table and start a new one for the new values. The
+    // worker hasn't been given the frozen table yet, so the file levels
+    // haven't changed since the current version.
+    _frozen = _table;
+    _table = new MemTable(_leveling, _size);
+    publish(_table, _frozen, false);
+
+    lock.unlock();
+    _cond.notify_all();
+}
+
+/**
+ * Merge a full table into the next level, creating it if needed.
+ * The caller holds _levelMutex.
+ */
+void MemLevel::merge(MemTable* table)
 {
     // If the next level hasn't been created yet then create it.
     if (!_next)
     {
         _next = new FileLevel(
-            _leveling, _size, _size * _ratio, _ratio,
+            _options, _cache, 1, _size, _size * _ratio,
             _bits, _hashes);
     }
 
-    // Merge the files fromt this level to the next level.
-    _next->Merge(_keys, _vals, _size);
+    // Merge the values fromt this level to the next level. A skip list is
+    // read in key order so the merge gets sorted input.
+    if (_leveling)
+    {
+        InputListReader list(table->getList());
+        _next->Merge(&list, table->Count());
+    }
+    else
+    {
+        _next->Merge(table->getKeys(), table->getVals(), table->Count());
+    }
 
-    _count = 0;
+    // Checkpoint the tree so it can be reopened after a crash.
+    save(false);
+}
+
+/**
+ * The background thread. Wait for frozen tables and merge them.
+ */
+void MemLevel::drain()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+        _cond.wait(lock, [this] { return _frozen != NULL || _stop; });
+
+        // Only stop once there is nothing left to merge.
+        if (!_frozen)
+            return;
+
+        // The frozen table won't change, and the current table won't be
+        // replaced, until _frozen is cleared. So they can be used without
+        // holding the lock. Lookups read the frozen table until the version
+        // with the merged file levels is published.
+        MemTable* frozen = _frozen;
+        MemTable* table = _table;
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> levelLock(_levelMutex);
+            merge(frozen);
+            publish(table, NULL, true);
+        }
+        if (_listener)
+            _listener->Flushed();
+        lock.lock();
+
+        _frozen = NULL;
+        frozen->Unref();
+        _cond.notify_all();
+    }
 }
 
 /**
@@ -184,24 +487,40 @@ std::string MemLevel::Dump(bool verbose)
            << " leveling " << _leveling
            << " size: " << _size
            << " ratio: " << _ratio
-           << " count: " << _count
+           << " count: " << _table->Count()
            << " Count: " << Count()
            << "\n";
 
+    if (_cache)
+    {
+        output << "PageCache capacity: " << _cache->getCapacity()
+               << " size: " << _cache->getSize()
+               << " hits: " << _cache->getHits()
+               << " misses: " << _cache->getMisses()
+               << "\n";
+    }
+
     if (verbose)
     {
+        kv_key_t key;
+        kv_val_t val;
         std::string str;
-        for (int i = 0; i < _count; i++)
+        InputMemReader arrays(_table->getKeys(), _table->getVals(), _table->Count());
+        InputListReader list(_table->getList());
+        InputReader* input = _leveling ? (InputReader*)&list : &arrays;
+        while (input->HasNext())
         {
-            value2string(_vals[i], str);
-            output << "  " << _keys[i] << "=\"" << str << "\"\n";
+            input->Next(key, val);
+            value2string(val, str);
+            output << "  " << key << "=\"" << str << "\"\n";
         }
     }
 
+    std::lock_guard<std::mutex> lock(_levelMutex);
     if (_next)
         output << _next->Dump(verbose, 1);
 
     return output.str();
 }
 
-}
\ No newline at end of file
+}
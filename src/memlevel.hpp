@@ -5,6 +5,13 @@
  *
  * At this level there is no bloom filter or fence posts. The key array always
  * is searched for values.
+ *
+ * In background mode a full table is frozen and a new table takes the new
+ * writes while a worker thread merges the frozen table into the file levels.
+ *
+ * Lookups read the current version of the tree, see version.hpp. Each flush
+ * and merge publishes a new version, so many threads can look up keys while
+ * one thread puts.
  */
 
 #ifndef KVMEMLEVEL_H
@@ -13,10 +20,35 @@
 #include "types.hpp"
 #include "filelevel.hpp"
 #include "bloomfilter.hpp"
+#include "options.hpp"
+#include "memtable.hpp"
+#include "version.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 namespace kv
 {
 
+/**
+ * Told when the memory level is flushed. The store uses this to keep the
+ * write-ahead log in step with the memory level.
+ */
+class FlushListener
+{
+public:
+    /**
+     * The level is full and its values are about to be flushed.
+     */
+    virtual void Flushing() {}
+
+    /**
+     * The values from the oldest Flushing call are now in the file levels.
+     * In background mode this is called from the worker thread.
+     */
+    virtual void Flushed() {}
+};
+
 /*
  * The memory level (level 0) in the LSM tree.
  */
@@ -26,29 +58,51 @@ public:
 
     /**
      * Create the memory level.
-     * @param leveling true if using leveling, else use tiering.
-     * @param size The number of items to store in this level.
-     * @param ratio Size ratio between adjacent levels.
-     * @param bits The number of bits int the bloom filter.
-     * @param hashes The number of hashes in the bloom filter.
+     * @param options The settings for the store.
+     * @param listener Told when the level is flushed. May be NULL.
      */
-    MemLevel(bool leveling, int size, int ratio, int bits, int hashes);
+    MemLevel(const Options& options, FlushListener* listener = NULL);
     ~MemLevel();
 
+    /**
+     * Finish any background merge and write the manifest so the store can be
+     * reopened. Nothing can be put after this.
+     */
+    void Close();
+
     /*
      * Add a key/value to this level.
      * If necessery this will merge values into lower levels as the store grows.
+     * Only one thread can put at a time.
      */
     void Put(kv_key_t key, kv_val_t val);
 
     /**
      * Get a value from this level or the levels below it.
+     * Any number of threads can get while one thread puts.
      * @param key The key to lookup.
      * @param val Set to the value, if it is found.
      * @return true if the key was found.
      */
     bool Get(kv_key_t key, kv_val_t &val);
 
+    /**
+     * Get the values for a batch of keys from this level or the levels below
+     * it. Keys which are found are not searched for in the lower levels.
+     * @param keys The keys to lookup, sorted.
+     * @param vals Set to the value of each key which is found.
+     * @param pending The positions in keys to look for, in order. The
+     *                positions of the keys which are found are removed.
+     */
+    void MultiGet(const kv_key_t* keys, kv_val_t* vals, std::vector<int>& pending);
+
+    /**
+     * Add readers for the keys between lo and hi in this level, and the
+     * levels below it, to a list of sources for a scan. The sources are
+     * added newest first and each one is sorted by key.
+     */
+    void Scan(kv_key_t lo, kv_key_t hi, std::vector<InputReader*>& sources);
+
     /**
      * Return this count of this level plus the levels below it.
      */
@@ -60,44 +114,93 @@ public:
      */
     std::string Dump(bool verbose);
 
+    /**
+     * The page cache used by the file levels, or NULL if there isn't one.
+     */
+    PageCache* getCache() { return _cache; }
+
 private:
 
     /**
-     * Put a value in this level using the tiering algorthm when merging.
+     * Take a reference to the current version of the tree. The caller
+     * removes it when they are done reading.
      */
-    void put_tiering(kv_key_t key, kv_val_t val);
+    Version* current();
 
     /**
-     * Put a value in this level using the leveling algorthm when merging.
+     * Make a new version of the tree and make it the current version.
+     * @param table The table which takes new puts.
+     * @param frozen The table being merged in the background, or NULL.
+     * @param levels When true the version has the file levels as they are
+     *               now, and the caller holds _levelMutex. Otherwise it has
+     *               the file levels of the current version.
      */
-    void put_leveling(kv_key_t key, kv_val_t val);
+    void publish(MemTable* table, MemTable* frozen, bool levels);
 
     /**
-     * Look in the current level for a key using a linear seach because this
-     * level is not sorted, i.e. tiering, not leveling.
+     * Flush the current level to the next level.
+     * In background mode this freezes the current table and returns.
      */
-    bool get_tiering(kv_key_t key, kv_val_t &val);
+    void flush();
 
     /**
-     * Look in the current level for a key using a binary seach because this
-     * level is sorted, i.e. leveling, not tiering.
+     * Merge a full table into the next level, creating it if needed.
+     * The caller holds _levelMutex.
      */
-    bool get_leveling(kv_key_t key, kv_val_t &val);
+    void merge(MemTable* table);
 
     /**
-     * Flush the current level to the next level.
+     * The background thread. Wait for frozen tables and merge them.
      */
-    void flush();
+    void drain();
+
+    /**
+     * Reopen the tree from the manifest and files left by a previous store.
+     */
+    void restore();
+
+    /**
+     * Delete the manifest and the level files left by a previous store, so a
+     * new store doesn't leave them behind. The write-ahead log deletes its
+     * own old segments.
+     */
+    void clean();
+
+    /**
+     * Write the manifest and the bloom filters and fence posts of the file
+     * levels. Then delete the files the manifest no longer needs.
+     * @param closing If true, and there is no write-ahead log, also write the
+     *                values in this level.
+     */
+    void save(bool closing);
+
+    /**
+     * The path of the files for this level without an extension.
+     */
+    std::string filename();
 
+    Options _options;   // The settings for the store.
+    FlushListener* _listener;   // Told when the level is flushed.
+    bool _closed;       // Has Close been called.
     bool _leveling;     // Are we doing leveling or tiering.
     int _size;          // The number of items we will store at this level.
     int _ratio;         // Size ratio between adjacent levels.
-    int _count;         // The number of items currently in this level.
     int _bits;          // The number of bits int the bloom filter.
     int _hashes;        // The number of hashes in the bloom filter.
-    kv_key_t *_keys;    // The array of keys.
-    kv_val_t *_vals;    // The array of values.
+    MemTable *_table;   // The values put since the last flush.
     FileLevel *_next;   // The level below this one.
+    PageCache *_cache;  // The page cache for the file levels, or NULL.
+
+    bool _background;           // Are merges done on the worker thread.
+    MemTable *_frozen;          // The full table waiting to be merged, or NULL.
+    bool _stop;                 // Tells the worker thread to exit.
+    std::mutex _mutex;          // Guards the tables and _stop.
+    std::condition_variable _cond;  // Signaled when _frozen changes.
+    std::mutex _levelMutex;     // Held while the file levels are in use.
+    std::thread _worker;        // Merges frozen tables in the background.
+
+    Version *_version;          // The version lookups read.
+    std::mutex _versionMutex;   // Guards _version.
 };
 
 }
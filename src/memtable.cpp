@@ -0,0 +1,118 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * The values held by the memory level between flushes.
+ */
+
+#include "memtable.hpp"
+#include "simd.hpp"
+
+namespace kv
+{
+
+/**
+ * Create an empty table.
+ * @param leveling Keep the values sorted in a skip list, else in arrays.
+ * @param size The number of values the table can hold.
+ */
+MemTable::MemTable(bool leveling, int size)
+    : _leveling(leveling),
+      _size(size),
+      _count(0),
+      _keys(NULL),
+      _vals(NULL),
+      _list(NULL)
+{
+    // Leveling keeps the values sorted in a skip list. Tiering just appends
+    // them to arrays.
+    if (_leveling)
+    {
+        _list = new SkipList(_size);
+    }
+    else
+    {
+        _keys = new kv_key_t[_size];
+        _vals = new kv_val_t[_size];
+    }
+}
+
+MemTable::~MemTable()
+{
+    delete [] _keys;
+    delete [] _vals;
+    delete _list;
+}
+
+/**
+ * Add a key and value. Only one thread can put at a time.
+ */
+void MemTable::Put(kv_key_t key, kv_val_t val)
+{
+    int count = _count.load(std::memory_order_relaxed);
+    if (_leveling)
+    {
+        // The skip list keeps the keys sorted. It puts the new key before any
+        // equal keys so the most recent value is found first.
+        _list->Insert(key, val);
+    }
+    else
+    {
+        _keys[count] = key;
+        _vals[count] = val;
+    }
+
+    // Lookups only read up to the count, so the value is ready before they
+    // can see it.
+    _count.store(count + 1, std::memory_order_release);
+}
+
+/**
+ * Get the most recent value of a key.
+ * @param key The key to lookup.
+ * @param val Set to the value, if it is found.
+ * @return true if the key was found.
+ */
+bool MemTable::Get(kv_key_t key, kv_val_t &val)
+{
+    if (_leveling)
+        return _list->Find(key, val);
+
+    // The arrays aren't sorted, so search them all for the last copy.
+    int i = findLast(_keys, Count(), key);
+    if (i < 0)
+        return false;
+    val = _vals[i];
+    return true;
+}
+
+/**
+ * Copy the keys between lo and hi into a reader, sorted with the newest copy
+ * of each key first. Then the scan doesn't change when more values are put.
+ */
+InputReader* MemTable::Scan(kv_key_t lo, kv_key_t hi)
+{
+    InputVectorReader* reader = new InputVectorReader();
+    if (_leveling)
+    {
+        // The skip list is sorted with the newest copy of a key first.
+        for (int node = _list->Seek(lo);
+             node != SkipList::END && _list->Key(node) <= hi;
+             node = _list->Next(node))
+        {
+            reader->Add(_list->Key(node), _list->Val(node));
+        }
+        return reader;
+    }
+
+    // The arrays are in the order the values were put. Add them backwards so
+    // the newest copy of a key stays first when they are sorted.
+    for (int i = Count() - 1; i >= 0; i--)
+    {
+        if (_keys[i] >= lo && _keys[i] <= hi)
+            reader->Add(_keys[i], _vals[i]);
+    }
+    reader->Sort();
+    return reader;
+}
+
+}
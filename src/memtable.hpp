@@ -0,0 +1,81 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * The values held by the memory level between flushes.
+ *
+ * When leveling the values are kept sorted in a skip list. When tiering they
+ * are appended to arrays in the order they were put.
+ *
+ * One thread puts while other threads look up keys. A value is written
+ * before the count, or the skip list link, which makes it visible. A full
+ * table is never cleared. The memory level starts a new table and the old one
+ * is freed when the last version of the tree which has it is freed.
+ */
+
+#ifndef KVMEMTABLE_H
+#define KVMEMTABLE_H
+
+#include "types.hpp"
+#include "skiplist.hpp"
+#include "inputreader.hpp"
+#include "refcounted.hpp"
+#include <atomic>
+
+namespace kv
+{
+
+/**
+ * The keys and values put in the memory level since it was last flushed.
+ */
+class MemTable : public RefCounted
+{
+public:
+    /**
+     * Create an empty table.
+     * @param leveling Keep the values sorted in a skip list, else in arrays.
+     * @param size The number of values the table can hold.
+     */
+    MemTable(bool leveling, int size);
+    ~MemTable();
+
+    /**
+     * Add a key and value. Only one thread can put at a time.
+     */
+    void Put(kv_key_t key, kv_val_t val);
+
+    /**
+     * Get the most recent value of a key.
+     * @param key The key to lookup.
+     * @param val Set to the value, if it is found.
+     * @return true if the key was found.
+     */
+    bool Get(kv_key_t key, kv_val_t &val);
+
+    /**
+     * Copy the keys between lo and hi into a reader, sorted with the newest
+     * copy of each key first. Then the scan doesn't change when more values
+     * are put.
+     */
+    InputReader* Scan(kv_key_t lo, kv_key_t hi);
+
+    /**
+     * The number of values in the table.
+     */
+    int Count() { return _count.load(std::memory_order_acquire); }
+
+    bool isFull() { return Count() == _size; }
+    SkipList* getList() { return _list; }
+    kv_key_t* getKeys() { return _keys; }
+    kv_val_t* getVals() { return _vals; }
+
+private:
+    bool _leveling;             // Are the values in a skip list or arrays.
+    int _size;                  // The number of values the table can hold.
+    std::atomic<int> _count;    // The number of values in the table.
+    kv_key_t *_keys;            // The array of keys, when tiering.
+    kv_val_t *_vals;            // The array of values, when tiering.
+    SkipList *_list;            // The sorted keys and values, when leveling.
+};
+
+}
+#endif
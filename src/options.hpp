@@ -0,0 +1,145 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * The settings used to create a store. The store passes these down to the
+ * levels of the LSM tree.
+ */
+
+#ifndef KVOPTIONS_H
+#define KVOPTIONS_H
+
+#include "file.hpp"
+#include "wal.hpp"
+#include "bloomfilter.hpp"
+#include <string>
+#include <vector>
+
+namespace kv
+{
+
+/**
+ * The settings used to create a store.
+ * The defaults match the values used by the test program.
+ */
+struct Options
+{
+    bool leveling = true;       // true if using leveling, else use tiering.
+    int size = 1024;            // The number of items to store in the top level.
+    int ratio = 3;              // Size ratio between adjacent levels.
+    int bits = 1024*1024;       // The number of bits int the bloom filter.
+    int hashes = 4;             // The number of hashes in the bloom filter.
+
+    // The merge policy of each level, starting with the memory level. true
+    // is leveling and false is tiering. Levels past the end of the list use
+    // the last policy in it, and when it is empty every level follows
+    // leveling. E.g. { false, false, false, true } tiers the memory level and
+    // the first two file levels and levels the rest, which is lazy leveling
+    // for a tree with three file levels.
+    std::vector<bool> policy;
+
+    // When more than 0 bits and hashes are ignored. Instead the bloom filters
+    // average this many bits per key over the whole tree, with more bits per
+    // key in the upper levels and the best number of hashes for each level.
+    double bitsPerKey = 0;
+
+    // When true leveling merges only keep the most recent value of each key.
+    bool dropSuperseded = false;
+
+    // When more than 0 lookups in the file levels use a learned index
+    // which predicts where a key is to within this many items, instead of
+    // the fence posts.
+    int learnedIndex = 0;
+
+    // When more than 0 leveling file levels are split into partitions of
+    // about this many items, with key ranges which don't overlap. A merge
+    // only rewrites the partitions its keys fall in, and a full level pushes
+    // one partition at a time down to the next level.
+    int partitionSize = 0;
+
+    // When more than 1 a big merge into a leveling level which isn't
+    // partitioned is split by key into ranges, which are merged on up to
+    // this many threads. The files are the same as a merge on one thread
+    // writes. Merges with the stream backend, or which drop superseded
+    // values, use one thread.
+    int mergeThreads = 1;
+
+    // When true merges read their inputs ahead and write their output behind
+    // with io_uring, so the disk is busy while the merge loop runs. When the
+    // kernel doesn't have io_uring, with the stream backend, or when merges
+    // read through the page cache, they use blocking reads and writes.
+    bool ioUring = false;
+
+    // The number of pages of each merge input and output kept in flight
+    // with io_uring.
+    int ioDepth = 4;
+
+    // When more than 0 each merge input which isn't read ahead with io_uring
+    // reads this many pages ahead on a helper thread, so the next page is
+    // ready when the merge gets to it. 1 double buffers the inputs. This is
+    // the number of pages, separate from their size.
+    int prefetch = 0;
+
+    // When true merges read and write the level files with direct I/O, so
+    // they don't push the pages lookups use out of the kernel's page cache.
+    // Lookups still read through the page cache or memory mappings. Pages
+    // must be a multiple of 1024 items, e.g. size 1024, to be aligned for
+    // direct I/O. Otherwise, with the stream backend, when merges read through
+    // the page cache, or when the file system doesn't allow it, merges use
+    // buffered I/O.
+    bool directIo = false;
+
+    // How the bloom filters lay out their bits. A blocked filter needs one
+    // cache miss per test.
+    FilterType filter = FilterType::Classic;
+
+    // When true a full memory level is frozen and merged into the file levels
+    // on a background thread while a new memory level takes the writes.
+    bool background = false;
+
+    // How the file levels read and write their files. Lookups on more than
+    // one thread need the POSIX backend, or memory mapped files.
+    FileBackend backend = FileBackend::Posix;
+
+    // When true lookups read the level files through memory mappings.
+    bool mmap = true;
+
+    // The most bytes of file pages to keep in memory for lookups. When more
+    // than 0 lookups read through the page cache instead of memory mappings.
+    size_t cacheSize = 0;
+
+    // When false merges read straight from the files so they don't push the
+    // pages used by lookups out of the cache.
+    bool cacheMerges = false;
+
+    // The directory the level files and the manifest are kept in.
+    std::string dir = "data";
+
+    // When true the store is reopened from the manifest and files left in
+    // dir by a previous store. The shape of the tree comes from the manifest.
+    // If there is no manifest an empty store is created.
+    bool reopen = false;
+
+    // When true every put is logged to a write-ahead log so the memory level
+    // can be replayed when the store is reopened after a crash.
+    bool wal = false;
+
+    // When the write-ahead log is forced to disk.
+    SyncPolicy sync = SyncPolicy::EveryOp;
+
+    // Milliseconds between syncs when using SyncPolicy::Interval.
+    int syncInterval = 10;
+
+    /**
+     * Does a level use leveling, from the policy.
+     * @param depth The depth of the level. The memory level is 0.
+     */
+    bool levelingAt(int depth) const
+    {
+        if (policy.empty())
+            return leveling;
+        return policy[depth < policy.size() ? depth : policy.size() - 1];
+    }
+};
+
+}
+#endif
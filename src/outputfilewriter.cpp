@@ -17,51 +17,193 @@ namespace kv
  * @param pageSize The size of buffer to use.
  * @param pos The postion to start writing to in the files. This us used
  *            to append values to an existing file.
+ * @param depth The number of pages to write behind with io_uring, or 0 to
+ *              write each page when it is full.
+ * @param direct If true write whole pages with direct I/O, if they are
+ *               aligned.
  */
 OutputFileWriter::OutputFileWriter(
     File<kv_key_t>& keyFile, File<kv_val_t>& valFile,
-    int pageSize, int pos)
+    int pageSize, int pos, int depth, bool direct)
     : _keyFile(keyFile),
       _valFile(valFile),
       _pageSize(pageSize),
-      _f(pos),
-      _b(0)
+      _keyDirect(NULL),
+      _valDirect(NULL),
+      _f(pos - pos % pageSize),
+      _b(pos % pageSize),
+      _skip(pos % pageSize),
+      _ring(NULL),
+      _depth(1),
+      _slot(0)
 {
-    _keys = new kv_key_t[pageSize];
-    _vals = new kv_val_t[pageSize];
+    if (direct)
+        openDirect();
+
+    // Set up a ring with a buffer for each page being written, and register
+    // the buffers. Without a ring there is one buffer.
+    if (depth > 0 && keyFile.getFd() >= 0 && valFile.getFd() >= 0)
+    {
+        _ring = new IoRing();
+        if (_ring->Open(2 * depth))
+        {
+            _depth = depth;
+        }
+        else
+        {
+            delete _ring;
+            _ring = NULL;
+        }
+    }
+
+    std::vector<iovec> buffers;
+    for (int i = 0; i < _depth; i++)
+    {
+        _keyPages.push_back(newPage<kv_key_t>(pageSize));
+        buffers.push_back({_keyPages[i], pageSize * sizeof(kv_key_t)});
+    }
+    for (int i = 0; i < _depth; i++)
+    {
+        _valPages.push_back(newPage<kv_val_t>(pageSize));
+        buffers.push_back({_valPages[i], pageSize * sizeof(kv_val_t)});
+    }
+    if (_ring)
+        _ring->Register(buffers);
+    _pending.assign(_depth, 0);
+    _pos.assign(_depth, 0);
+    _written.assign(_depth, 0);
+    _direct.assign(_depth, false);
+    _keys = _keyPages[0];
+    _vals = _valPages[0];
 }
 
 OutputFileWriter::~OutputFileWriter()
 {
     Flush();
-    delete [] _keys;
-    delete [] _vals;
+    delete _ring;
+    for (int i = 0; i < _depth; i++)
+    {
+        deletePage(_keyPages[i]);
+        deletePage(_valPages[i]);
+    }
+    delete _keyDirect;
+    delete _valDirect;
 }
 
 /**
- * Add a key and value to the end of the files.
+ * Flush all keys and values to disk.
  */
-void OutputFileWriter::Push(kv_key_t key, kv_val_t val)
+void OutputFileWriter::Flush()
 {
-    _keys[_b] = key;
-    _vals[_b] = val;
-    _b++;
+    write();
 
-    if (_b == _pageSize)
-        Flush();
+    // Wait for the writes behind.
+    for (int i = 0; i < _depth; i++)
+    {
+        while (_pending[i] > 0)
+            complete();
+    }
 }
 
 /**
- * Flush all keys and values to disk.
+ * Open the files again for direct I/O, if their pages are aligned.
  */
-void OutputFileWriter::Flush()
+void OutputFileWriter::openDirect()
+{
+    if (_keyFile.getFd() < 0 || !File<kv_key_t>::alignedPages(_pageSize) ||
+        !File<kv_val_t>::alignedPages(_pageSize))
+    {
+        return;
+    }
+
+    // Both files are written the same way, even if only one can be direct.
+    _keyDirect = new File<kv_key_t>();
+    _valDirect = new File<kv_val_t>();
+    _keyDirect->Open(_keyFile.getFilename(), false, FileBackend::Posix, true);
+    _valDirect->Open(_valFile.getFilename(), false, FileBackend::Posix, true);
+    if (!_keyDirect->isDirect() || !_valDirect->isDirect())
+    {
+        delete _keyDirect;
+        delete _valDirect;
+        _keyDirect = NULL;
+        _valDirect = NULL;
+    }
+}
+
+/**
+ * Write the buffer. When writing behind move on to the next buffer, once its
+ * last write is done.
+ */
+void OutputFileWriter::write()
 {
-    if (_b == 0)
+    if (_b == _skip)
         return;
-    _keyFile.Write(_keys, _f, _b);
-    _valFile.Write(_vals, _f, _b);
-    _f += _b;
-    _b = 0;
+
+    // Only whole pages can be written with direct I/O.
+    bool direct = _keyDirect && _skip == 0 && _b == _pageSize;
+    File<kv_key_t>& keyFile = direct ? *_keyDirect : _keyFile;
+    File<kv_val_t>& valFile = direct ? *_valDirect : _valFile;
+    int pos = _f + _skip;
+    int count = _b - _skip;
+
+    if (!_ring)
+    {
+        keyFile.Write(_keys + _skip, pos, count);
+        valFile.Write(_vals + _skip, pos, count);
+    }
+    else
+    {
+        // The tag is the buffer and which file it is for.
+        int slot = _slot;
+        _pos[slot] = pos;
+        _written[slot] = count;
+        _direct[slot] = direct;
+        _ring->Write(keyFile.getFd(), _keys + _skip, count * sizeof(kv_key_t),
+            (off_t)pos * sizeof(kv_key_t), slot, slot * 2);
+        _ring->Write(valFile.getFd(), _vals + _skip, count * sizeof(kv_val_t),
+            (off_t)pos * sizeof(kv_val_t), _depth + slot, slot * 2 + 1);
+        _ring->Submit();
+        _pending[slot] = 2;
+
+        _slot = (slot + 1) % _depth;
+        while (_pending[_slot] > 0)
+            complete();
+        _keys = _keyPages[_slot];
+        _vals = _valPages[_slot];
+    }
+
+    // The next buffer starts at the page the output has got to. If the
+    // output stopped part way through a page then the rest of it is next.
+    _skip = (pos + count) % _pageSize;
+    _f = pos + count - _skip;
+    _b = _skip;
+}
+
+/**
+ * Wait for a write to finish. A write which fails, or is short, is done again
+ * without the ring.
+ */
+void OutputFileWriter::complete()
+{
+    uint64_t tag;
+    int result;
+    _ring->Wait(tag, result);
+
+    int slot = tag / 2;
+    int pos = _pos[slot];
+    int count = _written[slot];
+    int skip = pos % _pageSize;
+    if (tag % 2 == 0 && result != (int)(count * sizeof(kv_key_t)))
+    {
+        File<kv_key_t>& keyFile = _direct[slot] ? *_keyDirect : _keyFile;
+        keyFile.Write(_keyPages[slot] + skip, pos, count);
+    }
+    if (tag % 2 == 1 && result != (int)(count * sizeof(kv_val_t)))
+    {
+        File<kv_val_t>& valFile = _direct[slot] ? *_valDirect : _valFile;
+        valFile.Write(_valPages[slot] + skip, pos, count);
+    }
+    _pending[slot]--;
 }
 
-}
\ No newline at end of file
+}
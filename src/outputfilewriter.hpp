@@ -2,6 +2,16 @@
  * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
  *
  * Buffered wrapper to write keys and values to files. Used when merging levels.
+ *
+ * It can write pages behind with io_uring. Then a full buffer is handed to
+ * the kernel and the merge carries on filling the next buffer while it is
+ * written.
+ *
+ * It can also write with direct I/O, so a merge doesn't fill the kernel's
+ * page cache with pages lookups won't read. Each buffer holds a page of the
+ * files, so whole pages can be written with direct I/O when pages are aligned
+ * to DIRECT_ALIGN. The parts of pages at the start and end of the output go
+ * through the page cache.
  */
 
 #ifndef OUTPUTFILEWRITER_H
@@ -10,6 +20,8 @@
 #include "types.hpp"
 #include "file.hpp"
 #include "bloomfilter.hpp"
+#include "ioring.hpp"
+#include <vector>
 
 namespace kv
 {
@@ -29,8 +41,13 @@ public:
      * @param pageSize The size of buffer to use.
      * @param pos The postion to start writing to in the files. This us used
      *            to append values to an existing file.
+     * @param depth The number of pages to write behind with io_uring, or 0
+     *              to write each page when it is full.
+     * @param direct If true write whole pages with direct I/O, if they are
+     *               aligned.
      */
-    OutputFileWriter(File<kv_key_t>& keys, File<kv_val_t>& vals, int pageSize, int pos);
+    OutputFileWriter(File<kv_key_t>& keys, File<kv_val_t>& vals, int pageSize, int pos,
+        int depth = 0, bool direct = false);
 
     /**
      * Flush all keys and values to disk.
@@ -40,7 +57,15 @@ public:
     /**
      * Add a key and value to the end of the files.
      */
-    void Push(kv_key_t key, kv_val_t val);
+    void Push(kv_key_t key, kv_val_t val)
+    {
+        _keys[_b] = key;
+        _vals[_b] = val;
+        _b++;
+
+        if (_b == _pageSize)
+            write();
+    }
 
     /**
      * Flush all keys and values to disk.
@@ -48,13 +73,42 @@ public:
     void Flush();
 
 private:
+    /**
+     * Open the files again for direct I/O, if their pages are aligned.
+     */
+    void openDirect();
+
+    /**
+     * Write the buffer. When writing behind move on to the next buffer, once
+     * its last write is done.
+     */
+    void write();
+
+    /**
+     * Wait for a write to finish. A write which fails, or is short, is done
+     * again without the ring.
+     */
+    void complete();
+
     File<kv_key_t>& _keyFile;   // The files.
     File<kv_val_t>& _valFile;
     kv_key_t* _keys;    // The buffers.
     kv_val_t* _vals;
     int _pageSize;      // The buffer size.
-    int _f;             // The position in the file to write to.
+    File<kv_key_t>* _keyDirect;     // The files opened again for direct I/O,
+    File<kv_val_t>* _valDirect;     //   or NULL.
+    int _f;             // The position in the file of the start of the buffer.
     int _b;             // The position in the buffer.
+    int _skip;          // The items at the start of the buffer before the output.
+    IoRing* _ring;      // Writes pages behind, or NULL.
+    int _depth;         // The number of buffers.
+    int _slot;          // The buffer being filled.
+    std::vector<kv_key_t*> _keyPages;   // The buffers.
+    std::vector<kv_val_t*> _valPages;
+    std::vector<int> _pending;  // The writes of each buffer in flight.
+    std::vector<int> _pos;      // Where each buffer is being written to.
+    std::vector<int> _written;  // The items each buffer is writing.
+    std::vector<bool> _direct;  // Is each buffer being written with direct I/O.
 };
 
 }
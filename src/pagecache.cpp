@@ -0,0 +1,113 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * A cache of pages read from the key and value files of the file levels.
+ */
+
+#include "pagecache.hpp"
+#include <cstring>
+
+namespace kv
+{
+
+/**
+ * Create an empty cache.
+ * @param capacity The most bytes of pages to keep.
+ */
+PageCache::PageCache(size_t capacity)
+    : _capacity(capacity),
+      _shardCapacity(capacity / SHARDS),
+      _hits(0),
+      _misses(0)
+{
+}
+
+/**
+ * Copy part of a page out of the cache.
+ * @param file The id of the file the page is from.
+ * @param page The page number.
+ * @param offset The byte in the page to start copying from.
+ * @param len The number of bytes to copy.
+ * @param data Where to copy the bytes to.
+ * @return false if the page isn't in the cache.
+ */
+bool PageCache::Read(uint64_t file, int page, size_t offset, size_t len, void* data)
+{
+    uint64_t key = pageKey(file, page);
+    Shard& s = shard(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    auto found = s.index.find(key);
+    if (found == s.index.end())
+    {
+        _misses++;
+        return false;
+    }
+
+    // Move the page to the front of the list so it is evicted last.
+    s.pages.splice(s.pages.begin(), s.pages, found->second);
+    std::memcpy(data, found->second->data.data() + offset, len);
+    _hits++;
+    return true;
+}
+
+/**
+ * Add a page to the cache, evicting the least recently used pages in its
+ * shard to make room.
+ */
+void PageCache::Insert(uint64_t file, int page, const void* data, size_t len)
+{
+    if (len > _shardCapacity)
+        return;
+
+    uint64_t key = pageKey(file, page);
+    Shard& s = shard(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    // Another reader may have added the page since we missed it.
+    if (s.index.count(key))
+        return;
+
+    while (s.size + len > _shardCapacity)
+    {
+        Page& last = s.pages.back();
+        s.size -= last.data.size();
+        s.index.erase(last.key);
+        s.pages.pop_back();
+    }
+
+    s.pages.push_front(Page());
+    Page& p = s.pages.front();
+    p.key = key;
+    p.data.assign((const char*)data, (const char*)data + len);
+    s.index[key] = s.pages.begin();
+    s.size += len;
+}
+
+/**
+ * The number of bytes of pages in the cache.
+ */
+size_t PageCache::getSize()
+{
+    size_t size = 0;
+    for (int i = 0; i < SHARDS; i++)
+    {
+        std::lock_guard<std::mutex> lock(_shards[i].mutex);
+        size += _shards[i].size;
+    }
+    return size;
+}
+
+/**
+ * The shard a page belongs in. The key is mixed so the pages of one file are
+ * spread over all the shards.
+ */
+PageCache::Shard& PageCache::shard(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    return _shards[key % SHARDS];
+}
+
+}
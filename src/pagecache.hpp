@@ -0,0 +1,128 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * A cache of pages read from the key and value files of the file levels.
+ *
+ * A page is identified by the id of the file it was read from and its page
+ * number. Every time a file is opened it gets a new id, so when a level
+ * starts a new generation of its files the old pages are never found again
+ * and just age out of the cache.
+ *
+ * Only whole pages are cached. Tiering appends to the last page of a level's
+ * files, but a page which is full never changes.
+ *
+ * The cache is split into shards, each with its own lock and LRU list, so
+ * threads reading different pages rarely wait for each other.
+ */
+
+#ifndef KVPAGECACHE_H
+#define KVPAGECACHE_H
+
+#include "file.hpp"
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace kv
+{
+
+/**
+ * A sharded LRU cache of file pages.
+ */
+class PageCache
+{
+public:
+    static const int SHARDS = 16;
+
+    /**
+     * Create an empty cache.
+     * @param capacity The most bytes of pages to keep.
+     */
+    PageCache(size_t capacity);
+
+    /**
+     * Copy part of a page out of the cache.
+     * @param file The id of the file the page is from.
+     * @param page The page number.
+     * @param offset The byte in the page to start copying from.
+     * @param len The number of bytes to copy.
+     * @param data Where to copy the bytes to.
+     * @return false if the page isn't in the cache.
+     */
+    bool Read(uint64_t file, int page, size_t offset, size_t len, void* data);
+
+    /**
+     * Add a page to the cache, evicting the least recently used pages in its
+     * shard to make room.
+     */
+    void Insert(uint64_t file, int page, const void* data, size_t len);
+
+    size_t getCapacity() { return _capacity; }
+    uint64_t getHits() { return _hits; }
+    uint64_t getMisses() { return _misses; }
+
+    /**
+     * The number of bytes of pages in the cache.
+     */
+    size_t getSize();
+
+private:
+    /**
+     * A page's file id and page number packed into one number.
+     */
+    static uint64_t pageKey(uint64_t file, int page)
+    {
+        return (file << 32) | (uint32_t)page;
+    }
+
+    struct Page
+    {
+        uint64_t key;
+        std::vector<char> data;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::list<Page> pages;  // Most recently used first.
+        std::unordered_map<uint64_t, std::list<Page>::iterator> index;
+        size_t size = 0;        // The bytes of pages in this shard.
+    };
+
+    Shard& shard(uint64_t key);
+
+    size_t _capacity;           // The most bytes of pages to keep.
+    size_t _shardCapacity;      // The most bytes of pages in each shard.
+    Shard _shards[SHARDS];
+    std::atomic<uint64_t> _hits;
+    std::atomic<uint64_t> _misses;
+};
+
+/**
+ * Read a page of items from a file through a cache. If there is no cache, or
+ * the page isn't full, the file is read directly.
+ * @param cache The cache or NULL.
+ * @param file The file to read.
+ * @param page The page number.
+ * @param pageSize The number of items in a page.
+ * @param full True if all the items in the page have been written.
+ * @param data Where to read the items to.
+ */
+template<class T>
+void readPage(PageCache* cache, File<T>& file, int page, int pageSize, bool full, T* data)
+{
+    size_t len = pageSize * sizeof(T);
+    if (cache && full && cache->Read(file.getId(), page, 0, len, data))
+        return;
+
+    file.Read(data, page * pageSize, pageSize);
+    if (cache && full)
+        cache->Insert(file.getId(), page, data, len);
+}
+
+}
+#endif
@@ -0,0 +1,551 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * A partition of a file level in the LSM tree.
+ */
+
+#include "partition.hpp"
+#include "algorithms.hpp"
+#include "manifest.hpp"
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+
+namespace kv
+{
+
+/**
+ * Create a partition with empty files.
+ * @param options The settings for the store.
+ * @param cache The page cache for the store, or NULL.
+ * @param filename The path of the partition's files without an extension.
+ * @param generation The generation of the files, which the level records.
+ * @param pageSize The size of disk pages.
+ * @param bits The number of bits in the bloom filter.
+ * @param hashes The number of hashes in the bloom filter.
+ * @param seed The seed of the bloom filter.
+ */
+Partition::Partition(const Options& options, PageCache* cache, std::string filename,
+    int generation, int pageSize, uint64_t bits, uint64_t hashes, uint32_t seed)
+    : _options(options),
+      _cache(cache),
+      _filename(filename),
+      _generation(generation),
+      _pageSize(pageSize),
+      _count(0),
+      _filter(bits, hashes, seed, options.filter),
+      _index(options.learnedIndex),
+      _writer(NULL),
+      _dirty(true),             // The meta file needs to be written.
+      _remove(false)
+{
+    _keyFile.Open(_filename + ".key", true, _options.backend);
+    _valFile.Open(_filename + ".dat", true, _options.backend);
+    initFences();
+}
+
+/**
+ * Reopen a partition from the files left by a previous store.
+ * @param count The number of items in the files.
+ * The other parameters are the same as when the partition was created.
+ */
+Partition::Partition(const Options& options, PageCache* cache, std::string filename,
+    int generation, int pageSize, uint64_t bits, uint64_t hashes, uint32_t seed, int count)
+    : _options(options),
+      _cache(cache),
+      _filename(filename),
+      _generation(generation),
+      _pageSize(pageSize),
+      _count(count),
+      _filter(bits, hashes, seed, options.filter),
+      _index(options.learnedIndex),
+      _writer(NULL),
+      _dirty(false),
+      _remove(false)
+{
+    // Open the files without truncating them. Read the bloom filter and
+    // fence posts instead of rebuilding them from the key file.
+    _keyFile.Open(_filename + ".key", false, _options.backend);
+    _valFile.Open(_filename + ".dat", false, _options.backend);
+    initFences();
+    load();
+    remap();
+}
+
+Partition::~Partition()
+{
+    delete _writer;
+
+    // No lookup can be reading the partition any more, so its files can go.
+    if (_remove)
+    {
+        _keyMap.Unmap();
+        _valMap.Unmap();
+        _keyFile.Close();
+        _valFile.Close();
+        std::remove((_filename + ".key").c_str());
+        std::remove((_filename + ".dat").c_str());
+        std::remove((_filename + ".meta").c_str());
+    }
+}
+
+/**
+ * Write the bloom filter, fence posts and learned index, if they have changed
+ * since the last time.
+ */
+void Partition::Save()
+{
+    if (!_dirty)
+        return;
+
+    std::stringstream output;
+    _filter.Save(output);
+    int fenceCount = _fenceMins.size();
+    output.write((char*)&fenceCount, sizeof(fenceCount));
+    output.write((char*)_fenceMins.data(), fenceCount * sizeof(kv_key_t));
+    output.write((char*)_fenceMaxs.data(), fenceCount * sizeof(kv_key_t));
+    if (useIndex())
+        _index.Save(output);
+    writeFile(_filename + ".meta", output.str());
+    _dirty = false;
+}
+
+/**
+ * Read the bloom filter, fence posts and learned index written by Save. If
+ * they can't be read then they are rebuilt from the key file.
+ */
+void Partition::load()
+{
+    std::ifstream input(_filename + ".meta", std::ifstream::binary);
+    int fenceCount = 0;
+    if (_filter.Load(input))
+        input.read((char*)&fenceCount, sizeof(fenceCount));
+
+    // There is a fence for each page with items in it.
+    if (!input.fail() && fenceCount == (_count + _pageSize - 1) / _pageSize)
+    {
+        _fenceMins.resize(fenceCount);
+        _fenceMaxs.resize(fenceCount);
+        input.read((char*)_fenceMins.data(), fenceCount * sizeof(kv_key_t));
+        input.read((char*)_fenceMaxs.data(), fenceCount * sizeof(kv_key_t));
+        if (!input.fail() && (!useIndex() || _index.Load(input)))
+        {
+            for (int i = 0; i < fenceCount; i++)
+            {
+                _minKey = std::min(_minKey, _fenceMins[i]);
+                _maxKey = std::max(_maxKey, _fenceMaxs[i]);
+            }
+            return;
+        }
+    }
+
+    // Scan the key file to rebuild them.
+    _filter.Clear();
+    initFences();
+    InputFileReader keys(_keyFile, _valFile, _count, _pageSize);
+    kv_key_t key;
+    kv_val_t val;
+    for (int i = 0; i < _count; i++)
+    {
+        keys.Next(key, val);
+        _filter.Add(key);
+        fence(key, i);
+    }
+    _dirty = true;
+}
+
+/**
+ * Get the newest value of a key in this partition.
+ * @param key The key to lookup.
+ * @param val Set to the value, if it is found.
+ * @return true if the key was found.
+ */
+bool Partition::Get(kv_key_t key, kv_val_t &val)
+{
+    // Check the smallest and largest keys and then the bloom filter.
+    if (key < _minKey || key > _maxKey || !_filter.Test(key))
+        return false;
+
+    // Ask the learned index where the key is, or find the only page it can
+    // be in.
+    int start, end;
+    if (useIndex())
+    {
+        _index.Find(key, _count, start, end);
+    }
+    else
+    {
+        int page = findPage(key);
+        if (page < 0)
+            return false;
+        start = page * _pageSize;
+        end = std::min(start + _pageSize, _count);
+    }
+    return search(key, val, start, end);
+}
+
+/**
+ * Get the values for a batch of keys from this partition.
+ * @param keys The keys to lookup, sorted.
+ * @param vals Set to the value of each key which is found.
+ * @param pending The positions in keys to look for, in order.
+ * @param missing The positions of the keys which aren't found are added to
+ *                this, in order.
+ */
+void Partition::MultiGet(const kv_key_t* keys, kv_val_t* vals, const std::vector<int>& pending,
+    std::vector<int>& missing)
+{
+    // Test the whole batch against the bloom filter and the fence posts
+    // first. Keep the keys which might be in this partition and the page
+    // each one is in.
+    std::vector<int> candidates;
+    std::vector<int> pages;
+    for (int i = 0; i < pending.size(); i++)
+    {
+        kv_key_t key = keys[pending[i]];
+        int page = -1;
+        if (key >= _minKey && key <= _maxKey && _filter.Test(key))
+            page = findPage(key);
+
+        if (page >= 0)
+        {
+            candidates.push_back(pending[i]);
+            pages.push_back(page);
+        }
+    }
+
+    // Search for the keys which survived, in key order. The search is
+    // compiled once for the mappings and once for the files so the reads
+    // aren't virtual calls. A key which isn't a candidate is missing.
+    auto resolve = [&](auto* kvs)
+    {
+        int lower = 0;
+        int next = 0;
+        for (int i = 0; i < pending.size(); i++)
+        {
+            int p = pending[i];
+            if (next == candidates.size() || candidates[next] != p)
+            {
+                missing.push_back(p);
+                continue;
+            }
+
+            // The keys are sorted so each key is after the one before it.
+            // Start searching where the last search ended, so the files are
+            // read forwards.
+            int start = std::max(pages[next] * _pageSize, lower);
+            int end = std::min((pages[next] + 1) * _pageSize, _count);
+            next++;
+            lower = lowerBound(kvs, keys[p], start, end);
+            if (lower < end && kvs->Key(lower) == keys[p])
+                vals[p] = kvs->Val(lower);
+            else
+                missing.push_back(p);
+        }
+    };
+
+    MappedKeyValues mapped(_keyMap, _valMap, _count);
+    FileKeyValues files(_keyFile, _valFile, _count, _cache, _pageSize);
+    if (_keyMap.getData())
+        resolve(&mapped);
+    else
+        resolve(&files);
+}
+
+/**
+ * Add a reader for the keys between lo and hi in this partition to a list of
+ * sources for a scan, if there are any.
+ */
+void Partition::Scan(kv_key_t lo, kv_key_t hi, std::vector<InputReader*>& sources)
+{
+    if (hi < _minKey || lo > _maxKey)
+        return;
+
+    // Use the fence posts to find the first page which could have keys in
+    // the range. Then find where the range starts in it and read the files
+    // from there.
+    int page = std::lower_bound(_fenceMaxs.begin(), _fenceMaxs.end(), lo) - _fenceMaxs.begin();
+    if (page == _fenceMaxs.size() || _fenceMins[page] > hi)
+        return;
+
+    MappedKeyValues mapped(_keyMap, _valMap, _count);
+    FileKeyValues files(_keyFile, _valFile, _count, _cache, _pageSize);
+    KeyValues* kvs = _keyMap.getData() ? (KeyValues*)&mapped : &files;
+    int pageEnd = std::min((page + 1) * _pageSize, _count);
+    int pos = lowerBound(kvs, lo, page * _pageSize, pageEnd);
+
+    // Only open the files if there are keys in the range.
+    if (pos < pageEnd && kvs->Key(pos) <= hi)
+    {
+        sources.push_back(new InputScanReader(
+            _filename, _count, _pageSize, pos, _options.backend));
+    }
+}
+
+/**
+ * Search part of the partition for the first copy of a key.
+ * @param start The first position to search.
+ * @param end One past the last position to search.
+ */
+bool Partition::search(kv_key_t key, kv_val_t &val, int start, int end)
+{
+    // Search the mapping if there is one.
+    if (_keyMap.getData())
+    {
+        MappedKeyValues mapped(_keyMap, _valMap, _count);
+        return binarySearch(&mapped, key, val, start, end);
+    }
+
+    // Otherwise read the keys with one read and search them in memory. If
+    // they are all in one page read the whole page through the cache.
+    int page = start / _pageSize;
+    int first = start;
+    std::vector<kv_key_t> keys;
+    if (_cache && start < end && page == (end - 1) / _pageSize)
+    {
+        first = page * _pageSize;
+        keys.resize(_pageSize);
+        readPage(_cache, _keyFile, page, _pageSize, first + _pageSize <= _count, keys.data());
+    }
+    else
+    {
+        keys.resize(end - start);
+        _keyFile.Read(keys.data(), start, end - start);
+    }
+
+    auto found = std::lower_bound(keys.begin() + (start - first), keys.begin() + (end - first), key);
+    if (found == keys.begin() + (end - first) || *found != key)
+        return false;
+
+    // Then read the value.
+    FileKeyValues files(_keyFile, _valFile, _count, _cache, _pageSize);
+    val = files.Val(first + (found - keys.begin()));
+    return true;
+}
+
+/**
+ * Find the page which the first copy of a key would be in, using a binary
+ * search of the fence posts.
+ * @return The page number, or -1 if no page can have the key.
+ */
+int Partition::findPage(kv_key_t key)
+{
+    // The first page which ends at or after the key. A key with more than
+    // one copy can span pages, and the newest copy is in the first one.
+    int page = std::lower_bound(_fenceMaxs.begin(), _fenceMaxs.end(), key) - _fenceMaxs.begin();
+    if (page == _fenceMaxs.size() || _fenceMins[page] > key)
+        return -1;
+    return page;
+}
+
+/**
+ * Start adding keys and values to the end of the files.
+ */
+void Partition::StartWriting()
+{
+    _writer = new OutputFileWriter(_keyFile, _valFile, _pageSize, _count,
+        _options.ioUring ? _options.ioDepth : 0, _options.directIo);
+    _dirty = true;
+}
+
+/**
+ * Add a key and value to the end of the files. Update the bloom filter,
+ * fence posts and learned index with the key. The keys must be added in
+ * order.
+ */
+void Partition::Push(kv_key_t key, kv_val_t val)
+{
+    _writer->Push(key, val);
+    _filter.Add(key);
+    fence(key, _count);
+    _count++;
+}
+
+/**
+ * Start writing count keys and values on several threads at once. Each thread
+ * writes the keys of a range to their positions, see Write.
+ */
+void Partition::StartWriting(int count)
+{
+    // Every page gets its fence posts from the threads which write its first
+    // and last keys, so the vectors are made up front.
+    _count = count;
+    _fenceMins.resize((count + _pageSize - 1) / _pageSize, KEY_MAX);
+    _fenceMaxs.resize(_fenceMins.size(), KEY_MIN);
+    _dirty = true;
+}
+
+/**
+ * Write a key and value at a position, from one of the threads writing the
+ * partition. Update the bloom filter and the fence posts with the key. Each
+ * thread writes its keys in order through its own writer.
+ */
+void Partition::Write(OutputFileWriter& writer, kv_key_t key, kv_val_t val, int pos)
+{
+    writer.Push(key, val);
+    _filter.AddShared(key);
+
+    // The keys are sorted, so a page's smallest key is its first and its
+    // largest key is its last. Only one thread writes each of them.
+    int f = pos / _pageSize;
+    if (pos % _pageSize == 0)
+        _fenceMins[f] = key;
+    if (pos % _pageSize == _pageSize - 1 || pos == _count - 1)
+        _fenceMaxs[f] = key;
+    if (pos == 0)
+        _minKey = key;
+    if (pos == _count - 1)
+        _maxKey = key;
+}
+
+/**
+ * Flush everything written since StartWriting to the disk.
+ */
+void Partition::FinishWriting()
+{
+    // The end of the merge is the point where the partition must be on disk.
+    // The threads which wrote a partition have flushed their writers. The
+    // learned index needs the keys in order, so it is built from the file.
+    if (_writer)
+    {
+        _writer->Flush();
+        delete _writer;
+        _writer = NULL;
+    }
+    else if (useIndex())
+    {
+        std::vector<kv_key_t> keys(_pageSize);
+        for (int pos = 0; pos < _count; pos += _pageSize)
+        {
+            int count = std::min(_pageSize, _count - pos);
+            _keyFile.Read(keys.data(), pos, count);
+            for (int i = 0; i < count; i++)
+            {
+                _index.Add(keys[i], pos + i);
+            }
+        }
+    }
+    _keyFile.Sync();
+    _valFile.Sync();
+    remap();
+}
+
+/**
+ * The position of the first key in this partition which is larger than a key,
+ * or the count if there isn't one.
+ */
+int Partition::UpperBound(kv_key_t key)
+{
+    // Only the first page which ends after the key can have the position.
+    int page = std::upper_bound(_fenceMaxs.begin(), _fenceMaxs.end(), key) - _fenceMaxs.begin();
+    if (page == _fenceMaxs.size())
+        return _count;
+    int start = page * _pageSize;
+    int end = std::min(start + _pageSize, _count);
+    if (_fenceMins[page] > key)
+        return start;
+
+    FileKeyValues files(_keyFile, _valFile, _count, _cache, _pageSize);
+    return lowerBound(&files, key + 1, start, end);
+}
+
+/**
+ * Delete the files when the partition is freed. Called by the level once a
+ * manifest which doesn't need them has been saved.
+ */
+void Partition::RemoveFiles()
+{
+    _remove = true;
+}
+
+/**
+ * Update the fence posts, the smallest and largest keys, and the learned index
+ * for a key at a position in this partition.
+ */
+void Partition::fence(kv_key_t key, int pos)
+{
+    int f = pos / _pageSize;
+    if (f == _fenceMins.size())
+    {
+        _fenceMins.push_back(KEY_MAX);
+        _fenceMaxs.push_back(KEY_MIN);
+    }
+    if (key < _fenceMins[f])
+        _fenceMins[f] = key;
+    if (key > _fenceMaxs[f])
+        _fenceMaxs[f] = key;
+    if (key < _minKey)
+        _minKey = key;
+    if (key > _maxKey)
+        _maxKey = key;
+    if (useIndex())
+        _index.Add(key, pos);
+}
+
+/**
+ * Remove all the fence posts and empty the learned index.
+ */
+void Partition::initFences()
+{
+    _fenceMins.clear();
+    _fenceMaxs.clear();
+    _minKey = KEY_MAX;
+    _maxKey = KEY_MIN;
+    _index.Clear();
+}
+
+/**
+ * Map the key and value files again after they have been written.
+ */
+void Partition::remap()
+{
+    // When there is a page cache lookups read through it instead.
+    if (!_options.mmap || _cache)
+        return;
+
+    // If either file can't be mapped then lookups use the files.
+    if (!_keyMap.Map(_keyFile.getFilename()) || !_valMap.Map(_valFile.getFilename()))
+    {
+        _keyMap.Unmap();
+        _valMap.Unmap();
+    }
+}
+
+/**
+ * Return a string with a description of this partition.
+ * @param verbose When true include the fences, keys and values.
+ */
+std::string Partition::Dump(bool verbose)
+{
+    std::stringstream output;
+    output << "Partition " << _filename
+           << " count: " << _count
+           << " keys: [ " << _minKey << ", " << _maxKey << " ]"
+           << std::endl;
+
+    if (verbose)
+    {
+        output << "Fence ";
+        for (int i = 0; i < _fenceMins.size(); i++)
+        {
+            output << "[ " << _fenceMins[i] << ", " << _fenceMaxs[i] << " ]";
+        }
+        output << std::endl;
+
+        kv_key_t key;
+        kv_val_t val;
+        std::string str;
+        for (int i = 0; i < _count; i++)
+        {
+            _keyFile.Read(key, i);
+            _valFile.Read(val, i);
+            value2string(val, str);
+            output << "  " << key << "=\"" << str << "\"" << std::endl;
+        }
+    }
+
+    return output.str();
+}
+
+}
@@ -0,0 +1,231 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * A partition of a file level in the LSM tree.
+ *
+ * A partition is one sorted run in a key and value file pair, with the bloom
+ * filter, fence posts and learned index for it. Every page has fence posts,
+ * so a lookup reads at most one page of keys from a partition.
+ *
+ * A leveling level which isn't partitioned is one partition. A partitioned
+ * level is a list of partitions with key ranges which don't overlap, so a
+ * merge into it only has to rewrite the partitions the merged keys fall in.
+ * A tiered level has a partition for each merge into it.
+ *
+ * A partition is shared by its level and the versions of the tree which
+ * lookups are reading, see version.hpp. Once it has been written it doesn't
+ * change, so lookups on any number of threads can read it.
+ */
+
+#ifndef KVPARTITION_H
+#define KVPARTITION_H
+
+#include "types.hpp"
+#include "keyvalues.hpp"
+#include "file.hpp"
+#include "mappedfile.hpp"
+#include "inputreader.hpp"
+#include "outputfilewriter.hpp"
+#include "bloomfilter.hpp"
+#include "options.hpp"
+#include "learnedindex.hpp"
+#include "refcounted.hpp"
+#include <vector>
+
+namespace kv
+{
+
+/**
+ * A key and value file pair in a file level.
+ */
+class Partition : public RefCounted
+{
+public:
+    /**
+     * Create a partition with empty files.
+     * @param options The settings for the store.
+     * @param cache The page cache for the store, or NULL.
+     * @param filename The path of the partition's files without an extension.
+     * @param generation The generation of the files, which the level records.
+     * @param pageSize The size of disk pages.
+     * @param bits The number of bits in the bloom filter.
+     * @param hashes The number of hashes in the bloom filter.
+     * @param seed The seed of the bloom filter.
+     */
+    Partition(const Options& options, PageCache* cache, std::string filename, int generation,
+        int pageSize, uint64_t bits, uint64_t hashes, uint32_t seed);
+
+    /**
+     * Reopen a partition from the files left by a previous store.
+     * @param count The number of items in the files.
+     * The other parameters are the same as when the partition was created.
+     */
+    Partition(const Options& options, PageCache* cache, std::string filename, int generation,
+        int pageSize, uint64_t bits, uint64_t hashes, uint32_t seed, int count);
+
+    ~Partition();
+
+    /**
+     * Write the bloom filter, fence posts and learned index, if they have
+     * changed since the last time.
+     */
+    void Save();
+
+    /**
+     * Get the newest value of a key in this partition.
+     * @param key The key to lookup.
+     * @param val Set to the value, if it is found.
+     * @return true if the key was found.
+     */
+    bool Get(kv_key_t key, kv_val_t &val);
+
+    /**
+     * Get the values for a batch of keys from this partition.
+     * @param keys The keys to lookup, sorted.
+     * @param vals Set to the value of each key which is found.
+     * @param pending The positions in keys to look for, in order.
+     * @param missing The positions of the keys which aren't found are added
+     *                to this, in order.
+     */
+    void MultiGet(const kv_key_t* keys, kv_val_t* vals, const std::vector<int>& pending,
+        std::vector<int>& missing);
+
+    /**
+     * Add a reader for the keys between lo and hi in this partition to a
+     * list of sources for a scan, if there are any.
+     */
+    void Scan(kv_key_t lo, kv_key_t hi, std::vector<InputReader*>& sources);
+
+    /**
+     * Start adding keys and values to the end of the files.
+     */
+    void StartWriting();
+
+    /**
+     * Add a key and value to the end of the files. Update the bloom filter,
+     * fence posts and learned index with the key. The keys must be added in
+     * order.
+     */
+    void Push(kv_key_t key, kv_val_t val);
+
+    /**
+     * Start writing count keys and values on several threads at once. Each
+     * thread writes the keys of a range to their positions, see Write.
+     */
+    void StartWriting(int count);
+
+    /**
+     * Write a key and value at a position, from one of the threads writing
+     * the partition. Update the bloom filter and the fence posts with the
+     * key. Each thread writes its keys in order through its own writer.
+     */
+    void Write(OutputFileWriter& writer, kv_key_t key, kv_val_t val, int pos);
+
+    /**
+     * Flush everything written since StartWriting to the disk.
+     */
+    void FinishWriting();
+
+    /**
+     * The position of the first key in this partition which is larger than
+     * a key, or the count if there isn't one.
+     */
+    int UpperBound(kv_key_t key);
+
+    /**
+     * Delete the files when the partition is freed. Called by the level once
+     * a manifest which doesn't need them has been saved.
+     */
+    void RemoveFiles();
+
+    /**
+     * Return a string with a description of this partition.
+     * @param verbose When true include the fences, keys and values.
+     */
+    std::string Dump(bool verbose);
+
+    std::string getFilename() { return _filename; }
+    int getGeneration() { return _generation; }
+    File<kv_key_t>& getKeyFile() { return _keyFile; }
+    File<kv_val_t>& getValFile() { return _valFile; }
+    int getCount() { return _count; }
+    kv_key_t getMinKey() { return _minKey; }
+    kv_key_t getMaxKey() { return _maxKey; }
+    uint64_t getNumHashes() { return _filter.getNumHashes(); }
+    uint64_t getFilterBits() { return _filter.getNumBits(); }
+
+    /**
+     * The number of bytes used by the fence posts.
+     */
+    size_t getFenceBytes() { return 2 * _fenceMins.size() * sizeof(kv_key_t); }
+
+    /**
+     * The learned index, or NULL if the partition doesn't use one.
+     */
+    LearnedIndex* getIndex() { return useIndex() ? &_index : NULL; }
+
+private:
+    /**
+     * Find the page which the first copy of a key would be in, using a
+     * binary search of the fence posts.
+     * @return The page number, or -1 if no page can have the key.
+     */
+    int findPage(kv_key_t key);
+
+    /**
+     * Search part of the partition for the first copy of a key.
+     * @param start The first position to search.
+     * @param end One past the last position to search.
+     */
+    bool search(kv_key_t key, kv_val_t &val, int start, int end);
+
+    /**
+     * Update the fence posts, the smallest and largest keys, and the learned
+     * index for a key at a position in this partition.
+     */
+    void fence(kv_key_t key, int pos);
+
+    /**
+     * Remove all the fence posts and empty the learned index.
+     */
+    void initFences();
+
+    /**
+     * Read the bloom filter, fence posts and learned index written by Save.
+     * If they can't be read then they are rebuilt from the key file.
+     */
+    void load();
+
+    /**
+     * Map the key and value files again after they have been written.
+     */
+    void remap();
+
+    /**
+     * Does this partition use a learned index for lookups.
+     */
+    bool useIndex() { return _options.learnedIndex > 0; }
+
+    Options _options;           // The settings for the store.
+    PageCache *_cache;          // The page cache for lookups, or NULL.
+    std::string _filename;      // The path of the files without an extension.
+    int _generation;            // The generation of the files.
+    int _pageSize;              // The size of file pages.
+    int _count;                 // The number of items in the files.
+    File<kv_key_t> _keyFile;    // The file with keys.
+    File<kv_val_t> _valFile;    // The file with values.
+    MappedFile _keyMap;         // The key file mapped for lookups.
+    MappedFile _valMap;         // The value file mapped for lookups.
+    BloomFilter _filter;        // The bloom filter of the keys.
+    std::vector<kv_key_t> _fenceMins;   // The smallest key in each page.
+    std::vector<kv_key_t> _fenceMaxs;   // The largest key in each page.
+    kv_key_t _minKey;           // The smallest key in this partition.
+    kv_key_t _maxKey;           // The largest key in this partition.
+    LearnedIndex _index;        // Predicts where keys are in the partition.
+    OutputFileWriter* _writer;  // Buffers writes between StartWriting and FinishWriting.
+    bool _dirty;                // Has the partition changed since Save.
+    bool _remove;               // Delete the files when the partition is freed.
+};
+
+}
+#endif
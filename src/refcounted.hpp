@@ -0,0 +1,52 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * A base class for the parts of the tree which lookups share with merges.
+ *
+ * A lookup holds a reference to the version of the tree it is reading, see
+ * version.hpp, and the version holds references to the tables and partitions
+ * in it. A merge which replaces one of them only removes its own reference,
+ * so it is freed when the last lookup reading it is done.
+ */
+
+#ifndef KVREFCOUNTED_H
+#define KVREFCOUNTED_H
+
+#include <atomic>
+
+namespace kv
+{
+
+/**
+ * An object which deletes itself when its last reference is removed.
+ * It starts with one reference, which belongs to whoever created it.
+ */
+class RefCounted
+{
+public:
+    RefCounted() : _refs(1) {}
+    virtual ~RefCounted() {}
+
+    /**
+     * Add a reference.
+     */
+    void Ref()
+    {
+        _refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Remove a reference. The last one deletes the object.
+     */
+    void Unref()
+    {
+        if (_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete this;
+    }
+
+private:
+    std::atomic<int> _refs;     // The number of references.
+};
+
+}
+#endif
@@ -0,0 +1,292 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * A key/value store split into shards, so puts and merges can use more than
+ * one core.
+ */
+
+#include "shardedstore.hpp"
+#include "simd.hpp"
+#include "lib/MurmurHash3.h"
+#include <sstream>
+#include <iomanip>
+#include <sys/stat.h>
+
+namespace kv
+{
+
+// The most puts which can wait for a shard. A put waits when its shard's
+// queue is full, so a slow shard slows the puts down instead of the queue
+// growing without a limit.
+static const int MAX_QUEUED = 4096;
+
+// The seed of the hash which picks a key's shard. It is different from the
+// bloom filter seeds so the keys of a shard still spread over the filters.
+static const uint32_t SHARD_SEED = 0x5A4D;
+
+/**
+ * Create the store. If options.reopen is true then each shard is reopened
+ * from the files in its directory.
+ * @param options The settings for each shard. options.dir is the root
+ *                directory, and each shard uses a directory in it.
+ * @param shards The number of shards.
+ */
+ShardedStore::ShardedStore(const Options& options, int shards)
+{
+    mkdir(options.dir.c_str(), 0755);
+    for (int i = 0; i < shards; i++)
+    {
+        std::stringstream dir;
+        dir << options.dir << "/shard." << std::setfill('0') << std::setw(2) << i;
+        Options shardOptions = options;
+        shardOptions.dir = dir.str();
+
+        Shard* shard = new Shard();
+        shard->store = new Store(shardOptions);
+        shard->stop = false;
+        shard->failed = false;
+        shard->worker = std::thread(&ShardedStore::drain, this, std::ref(*shard));
+        _shards.push_back(shard);
+    }
+}
+
+/**
+ * Finish the queued puts and close the shards.
+ */
+ShardedStore::~ShardedStore()
+{
+    for (int i = 0; i < _shards.size(); i++)
+    {
+        Shard* shard = _shards[i];
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            shard->stop = true;
+        }
+        shard->cond.notify_all();
+        shard->worker.join();
+        delete shard->store;
+        delete shard;
+    }
+}
+
+/**
+ * The shard a key belongs to.
+ */
+int ShardedStore::ShardOf(kv_key_t key)
+{
+    uint32_t hash;
+    MurmurHash3_x86_32(&key, sizeof(key), SHARD_SEED, &hash);
+    return hash % _shards.size();
+}
+
+/**
+ * Put a value in the store with a key. Puts from one thread are done in the
+ * order they were made.
+ * @return false if the key's shard has failed. The put is queued before it is
+ *         logged, so it can still fail after this returns true.
+ */
+bool ShardedStore::Put(kv_key_t key, std::string value)
+{
+    return enqueue(*_shards[ShardOf(key)], key, value);
+}
+
+/**
+ * Put a batch of values in the store.
+ * @return false if the shard of any of the keys has failed.
+ */
+bool ShardedStore::Put(const std::vector<kv_key_t>& keys, const std::vector<std::string>& values)
+{
+    bool ok = true;
+    for (int i = 0; i < keys.size(); i++)
+    {
+        if (!enqueue(*_shards[ShardOf(keys[i])], keys[i], values[i]))
+            ok = false;
+    }
+    return ok;
+}
+
+/**
+ * Add a put to a shard's queue, waiting if the queue is full.
+ * @return false if the shard has failed.
+ */
+bool ShardedStore::enqueue(Shard& shard, kv_key_t key, const std::string& value)
+{
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    shard.cond.wait(lock, [&shard] { return shard.queued.size() < MAX_QUEUED; });
+
+    // The thread only waits when the queue is empty.
+    bool wake = shard.queued.empty();
+    shard.queued.push_back(key);
+    shard.queuedVals.push_back(value);
+    bool failed = shard.failed;
+    lock.unlock();
+    if (wake)
+        shard.cond.notify_all();
+    return !failed;
+}
+
+/**
+ * A shard's thread. Put the queued values in batches until told to stop.
+ */
+void ShardedStore::drain(Shard& shard)
+{
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    while (true)
+    {
+        shard.cond.wait(lock, [&shard] { return !shard.queued.empty() || shard.stop; });
+
+        // Only stop once there is nothing left to put.
+        if (shard.queued.empty())
+            return;
+
+        // Take the whole queue, so new puts go in an empty queue while this
+        // batch is put. Lookups search the batch until it is in the store.
+        shard.putting.swap(shard.queued);
+        shard.puttingVals.swap(shard.queuedVals);
+        lock.unlock();
+        shard.cond.notify_all();
+
+        // A failed log stays failed, so once a batch fails the shard does.
+        bool ok = shard.store->Put(shard.putting, shard.puttingVals);
+
+        lock.lock();
+        if (!ok)
+            shard.failed = true;
+        shard.putting.clear();
+        shard.puttingVals.clear();
+        shard.cond.notify_all();
+    }
+}
+
+/**
+ * Look for the newest queued value of a key in a shard.
+ * @return true if the key was found.
+ */
+bool ShardedStore::findQueued(Shard& shard, kv_key_t key, std::string& value)
+{
+    // The queue is newer than the batch being put.
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    int i = findLast(shard.queued.data(), shard.queued.size(), key);
+    if (i >= 0)
+    {
+        value = shard.queuedVals[i];
+        return true;
+    }
+    i = findLast(shard.putting.data(), shard.putting.size(), key);
+    if (i >= 0)
+    {
+        value = shard.puttingVals[i];
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Get a value from the store using a key.
+ * @param key The key to lookup.
+ * @param val Set to the value, if it is found.
+ * @return true if the key was found.
+ */
+bool ShardedStore::Get(kv_key_t key, std::string &value)
+{
+    Shard& shard = *_shards[ShardOf(key)];
+    if (findQueued(shard, key, value))
+        return true;
+    return shard.store->Get(key, value);
+}
+
+/**
+ * Get the values for a batch of keys. The keys are split between the shards
+ * and each shard looks up its keys as one batch.
+ * @param keys The keys to lookup.
+ * @param values Set to the value of each key which is found.
+ * @param found Set to true for each key which is found.
+ */
+void ShardedStore::MultiGet(const std::vector<kv_key_t>& keys, std::vector<std::string>& values,
+    std::vector<bool>& found)
+{
+    values.assign(keys.size(), std::string());
+    found.assign(keys.size(), false);
+
+    // The positions of the keys which belong to each shard and aren't queued.
+    std::vector<std::vector<int>> positions(_shards.size());
+    for (int i = 0; i < keys.size(); i++)
+    {
+        int s = ShardOf(keys[i]);
+        if (findQueued(*_shards[s], keys[i], values[i]))
+            found[i] = true;
+        else
+            positions[s].push_back(i);
+    }
+
+    std::vector<kv_key_t> batch;
+    std::vector<std::string> batchValues;
+    std::vector<bool> batchFound;
+    for (int s = 0; s < _shards.size(); s++)
+    {
+        if (positions[s].empty())
+            continue;
+
+        batch.clear();
+        for (int i = 0; i < positions[s].size(); i++)
+        {
+            batch.push_back(keys[positions[s][i]]);
+        }
+        _shards[s]->store->MultiGet(batch, batchValues, batchFound);
+        for (int i = 0; i < positions[s].size(); i++)
+        {
+            values[positions[s][i]].swap(batchValues[i]);
+            found[positions[s][i]] = batchFound[i];
+        }
+    }
+}
+
+/**
+ * Wait until the shards have done every put made before this call.
+ * @return false if a shard has failed, so some puts may not survive a crash.
+ */
+bool ShardedStore::Wait()
+{
+    bool ok = true;
+    for (int i = 0; i < _shards.size(); i++)
+    {
+        Shard& shard = *_shards[i];
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        shard.cond.wait(lock, [&shard] { return shard.queued.empty() && shard.putting.empty(); });
+        if (shard.failed)
+            ok = false;
+    }
+    return ok;
+}
+
+/**
+ * Get the number of items in the store. If a key is added twice then it will
+ * be counted twice here.
+ */
+int ShardedStore::Count()
+{
+    Wait();
+    int count = 0;
+    for (int i = 0; i < _shards.size(); i++)
+    {
+        count += _shards[i]->store->Count();
+    }
+    return count;
+}
+
+/**
+ * Return a string with a description of each shard.
+ * @param verbose When true include the key and values in the output.
+ */
+std::string ShardedStore::Dump(bool verbose)
+{
+    Wait();
+    std::stringstream output;
+    for (int i = 0; i < _shards.size(); i++)
+    {
+        output << "Shard " << i << "\n" << _shards[i]->store->Dump(verbose);
+    }
+    return output.str();
+}
+
+}
@@ -0,0 +1,153 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * A key/value store split into shards, so puts and merges can use more than
+ * one core.
+ *
+ * Each key belongs to one shard, picked by a hash of the key. A shard is a
+ * Store with its own directory under the root directory, so it has its own
+ * memory level, file levels, manifest and write-ahead log. Each shard has a
+ * thread which does its puts, and the merges they start, so the shards fill
+ * in parallel.
+ *
+ * A put is queued for its shard's thread and returns. Lookups look in the
+ * queue before the shard, so they always see the puts made before them. A
+ * queued put isn't in the write-ahead log yet. Wait returns once every put
+ * made before it has been done by its shard.
+ *
+ * If a shard's write-ahead log fails the shard stays failed, and Put and Wait
+ * report it, because the puts it has done since may not survive a crash.
+ *
+ * A sharded store must be reopened with the same number of shards.
+ */
+
+#ifndef KVSHARDEDSTORE_H
+#define KVSHARDEDSTORE_H
+
+#include "store.hpp"
+#include "options.hpp"
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace kv
+{
+
+/**
+ * A key/value store split by key into shards which put in parallel.
+ */
+class ShardedStore
+{
+public:
+    /**
+     * Create the store. If options.reopen is true then each shard is
+     * reopened from the files in its directory.
+     * @param options The settings for each shard. options.dir is the root
+     *                directory, and each shard uses a directory in it.
+     * @param shards The number of shards.
+     */
+    ShardedStore(const Options& options, int shards);
+
+    /**
+     * Finish the queued puts and close the shards.
+     */
+    ~ShardedStore();
+
+    /**
+     * Put a value in the store with a key. Puts from one thread are done in
+     * the order they were made.
+     * @return false if the key's shard has failed. The put is queued before
+     *         it is logged, so it can still fail after this returns true.
+     */
+    bool Put(kv_key_t key, std::string value);
+
+    /**
+     * Put a batch of values in the store.
+     * @return false if the shard of any of the keys has failed.
+     */
+    bool Put(const std::vector<kv_key_t>& keys, const std::vector<std::string>& values);
+
+    /**
+     * Get a value from the store using a key.
+     * @param key The key to lookup.
+     * @param val Set to the value, if it is found.
+     * @return true if the key was found.
+     */
+    bool Get(kv_key_t key, std::string &value);
+
+    /**
+     * Get the values for a batch of keys. The keys are split between the
+     * shards and each shard looks up its keys as one batch.
+     * @param keys The keys to lookup.
+     * @param values Set to the value of each key which is found.
+     * @param found Set to true for each key which is found.
+     */
+    void MultiGet(const std::vector<kv_key_t>& keys, std::vector<std::string>& values,
+        std::vector<bool>& found);
+
+    /**
+     * Wait until the shards have done every put made before this call.
+     * @return false if a shard has failed, so some puts may not survive a
+     *         crash.
+     */
+    bool Wait();
+
+    /**
+     * Get the number of items in the store. If a key is added twice then it
+     * will be counted twice here.
+     */
+    int Count();
+
+    /**
+     * Return a string with a description of each shard.
+     * @param verbose When true include the key and values in the output.
+     */
+    std::string Dump(bool verbose = false);
+
+    /**
+     * The shard a key belongs to.
+     */
+    int ShardOf(kv_key_t key);
+
+private:
+    /**
+     * A store and the puts waiting for its thread.
+     */
+    struct Shard
+    {
+        Store* store;
+        std::vector<kv_key_t> queued;       // Keys waiting to be put, oldest first.
+        std::vector<std::string> queuedVals;
+        std::vector<kv_key_t> putting;      // Keys the thread is putting now.
+        std::vector<std::string> puttingVals;
+        bool stop;                          // Tells the thread to exit.
+        bool failed;                        // Has a put to the store failed.
+        std::mutex mutex;                   // Guards everything but store.
+        std::condition_variable cond;       // Signaled when the queue changes.
+        std::thread worker;                 // Puts the queued values.
+    };
+
+    /**
+     * Add a put to a shard's queue, waiting if the queue is full.
+     * @return false if the shard has failed.
+     */
+    bool enqueue(Shard& shard, kv_key_t key, const std::string& value);
+
+    /**
+     * Look for the newest queued value of a key in a shard.
+     * @return true if the key was found.
+     */
+    bool findQueued(Shard& shard, kv_key_t key, std::string& value);
+
+    /**
+     * A shard's thread. Put the queued values in batches until told to stop.
+     */
+    void drain(Shard& shard);
+
+    std::vector<Shard*> _shards;
+};
+
+}
+#endif
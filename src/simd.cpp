@@ -0,0 +1,201 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * Vectorized kernels for searching arrays of keys.
+ */
+
+#include "simd.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KV_X86
+#endif
+
+namespace kv
+{
+
+/**
+ * The scalar version of findLast, used when the CPU has no vector kernel.
+ */
+int findLastScalar(const kv_key_t* keys, int count, kv_key_t key)
+{
+    for (int i = count - 1; i >= 0; i--)
+    {
+        if (keys[i] == key)
+            return i;
+    }
+    return -1;
+}
+
+#if defined(KV_X86) && KV_KEY_BITS == 32
+
+/**
+ * Compare 4 keys at a time, starting at the end of the array.
+ */
+__attribute__((target("sse2")))
+static int findLastSse2(const kv_key_t* keys, int count, kv_key_t key)
+{
+    __m128i k = _mm_set1_epi32(key);
+    int i = count;
+    while (i >= 4)
+    {
+        i -= 4;
+        __m128i v = _mm_loadu_si128((const __m128i*)(keys + i));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, k)));
+        if (mask)
+            return i + 31 - __builtin_clz(mask);
+    }
+    return findLastScalar(keys, i, key);
+}
+
+/**
+ * Compare 16 keys at a time, as two vectors of 8, starting at the end of the
+ * array. The two comparisons are combined so there is one branch for both.
+ */
+__attribute__((target("avx2")))
+static int findLastAvx2(const kv_key_t* keys, int count, kv_key_t key)
+{
+    __m256i k = _mm256_set1_epi32(key);
+    int i = count;
+    while (i >= 16)
+    {
+        i -= 16;
+        __m256i lo = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(keys + i)), k);
+        __m256i hi = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(keys + i + 8)), k);
+        if (!_mm256_testz_si256(_mm256_or_si256(lo, hi), _mm256_or_si256(lo, hi)))
+        {
+            int mask = _mm256_movemask_ps(_mm256_castsi256_ps(hi));
+            if (mask)
+                return i + 8 + 31 - __builtin_clz(mask);
+            mask = _mm256_movemask_ps(_mm256_castsi256_ps(lo));
+            return i + 31 - __builtin_clz(mask);
+        }
+    }
+    while (i >= 8)
+    {
+        i -= 8;
+        __m256i v = _mm256_loadu_si256((const __m256i*)(keys + i));
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, k)));
+        if (mask)
+            return i + 31 - __builtin_clz(mask);
+    }
+    return findLastScalar(keys, i, key);
+}
+
+#endif
+
+#if defined(KV_X86) && KV_KEY_BITS == 64
+
+/**
+ * Compare 2 keys at a time, starting at the end of the array. Comparing 64
+ * bit integers needs SSE4.1.
+ */
+__attribute__((target("sse4.1")))
+static int findLastSse41(const kv_key_t* keys, int count, kv_key_t key)
+{
+    __m128i k = _mm_set1_epi64x(key);
+    int i = count;
+    while (i >= 2)
+    {
+        i -= 2;
+        __m128i v = _mm_loadu_si128((const __m128i*)(keys + i));
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v, k)));
+        if (mask)
+            return i + 31 - __builtin_clz(mask);
+    }
+    return findLastScalar(keys, i, key);
+}
+
+/**
+ * Compare 8 keys at a time, as two vectors of 4, starting at the end of the
+ * array. The two comparisons are combined so there is one branch for both.
+ */
+__attribute__((target("avx2")))
+static int findLastAvx2(const kv_key_t* keys, int count, kv_key_t key)
+{
+    __m256i k = _mm256_set1_epi64x(key);
+    int i = count;
+    while (i >= 8)
+    {
+        i -= 8;
+        __m256i lo = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(keys + i)), k);
+        __m256i hi = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(keys + i + 4)), k);
+        if (!_mm256_testz_si256(_mm256_or_si256(lo, hi), _mm256_or_si256(lo, hi)))
+        {
+            int mask = _mm256_movemask_pd(_mm256_castsi256_pd(hi));
+            if (mask)
+                return i + 4 + 31 - __builtin_clz(mask);
+            mask = _mm256_movemask_pd(_mm256_castsi256_pd(lo));
+            return i + 31 - __builtin_clz(mask);
+        }
+    }
+    while (i >= 4)
+    {
+        i -= 4;
+        __m256i v = _mm256_loadu_si256((const __m256i*)(keys + i));
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, k)));
+        if (mask)
+            return i + 31 - __builtin_clz(mask);
+    }
+    return findLastScalar(keys, i, key);
+}
+
+#endif
+
+typedef int (*FindLast)(const kv_key_t*, int, kv_key_t);
+
+/**
+ * The kernel to use on this CPU and its name.
+ */
+static FindLast pickFindLast(const char** name)
+{
+#ifdef KV_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        *name = "avx2";
+        return findLastAvx2;
+    }
+#if KV_KEY_BITS == 32
+    if (__builtin_cpu_supports("sse2"))
+    {
+        *name = "sse2";
+        return findLastSse2;
+    }
+#else
+    if (__builtin_cpu_supports("sse4.1"))
+    {
+        *name = "sse4.1";
+        return findLastSse41;
+    }
+#endif
+#endif
+    *name = "scalar";
+    return findLastScalar;
+}
+
+static const char* findLastName;
+static FindLast findLastKernelFn = pickFindLast(&findLastName);
+
+/**
+ * Find the last copy of a key in an array of keys. The newest copy of a key
+ * in a tiered level is the last one.
+ * @param keys The keys to search.
+ * @param count The number of keys.
+ * @param key The key to look for.
+ * @return The highest position with the key, or -1 if it isn't there.
+ */
+int findLast(const kv_key_t* keys, int count, kv_key_t key)
+{
+    return findLastKernelFn(keys, count, key);
+}
+
+/**
+ * The name of the kernel findLast uses on this CPU.
+ */
+const char* findLastKernel()
+{
+    return findLastName;
+}
+
+}
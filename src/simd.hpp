@@ -0,0 +1,41 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * Vectorized kernels for searching arrays of keys.
+ *
+ * A tiered level isn't sorted, so a lookup compares the key with every key
+ * in the level. The kernels compare 4 (SSE2) or 8 (AVX2) keys at a time, or
+ * with 64 bit keys 2 (SSE4.1) or 4 (AVX2). The best kernel the CPU supports
+ * is picked when the program starts. Other CPUs use the scalar kernel.
+ */
+
+#ifndef KVSIMD_H
+#define KVSIMD_H
+
+#include "types.hpp"
+
+namespace kv
+{
+
+/**
+ * Find the last copy of a key in an array of keys. The newest copy of a key
+ * in a tiered level is the last one.
+ * @param keys The keys to search.
+ * @param count The number of keys.
+ * @param key The key to look for.
+ * @return The highest position with the key, or -1 if it isn't there.
+ */
+int findLast(const kv_key_t* keys, int count, kv_key_t key);
+
+/**
+ * The scalar version of findLast, used when the CPU has no vector kernel.
+ */
+int findLastScalar(const kv_key_t* keys, int count, kv_key_t key);
+
+/**
+ * The name of the kernel findLast uses on this CPU.
+ */
+const char* findLastKernel();
+
+}
+#endif
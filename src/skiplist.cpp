@@ -0,0 +1,172 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * A skip list used by the memory level when leveling.
+ */
+
+#include "skiplist.hpp"
+#include <algorithm>
+
+namespace kv
+{
+
+/**
+ * Create an empty skip list.
+ * @param capacity The number of items the list can hold.
+ * @param seed The seed for the heights of the nodes. With 0 every node is
+ *             as tall as it can be, which is the worst case for the arena.
+ */
+SkipList::SkipList(int capacity, uint64_t seed)
+    : _capacity(capacity),
+      _keys(new kv_key_t[capacity]),
+      _vals(new kv_val_t[capacity]),
+      _offsets(new int[capacity]),
+      // On average a node has 4/3 links. Twice that is enough for any list
+      // which isn't very unlucky. Insert makes sure it never runs out.
+      _linkCapacity(capacity * 2 + MAX_HEIGHT),
+      _random(seed)
+{
+    _links = new std::atomic<int>[_linkCapacity];
+    Clear();
+}
+
+SkipList::~SkipList()
+{
+    delete [] _keys;
+    delete [] _vals;
+    delete [] _offsets;
+    delete [] _links;
+}
+
+/**
+ * Add a key and value. The key is put before any items with the same key
+ * so the most recent value for a key is found first.
+ */
+void SkipList::Insert(kv_key_t key, kv_val_t val)
+{
+    // Find the last node at each level with a key less than this key.
+    // -1 means the new node goes right after the head.
+    int prev[MAX_HEIGHT];
+    int node = -1;
+    int top = _height.load(std::memory_order_relaxed);
+    for (int level = top - 1; level >= 0; level--)
+    {
+        while (true)
+        {
+            int n = next(node, level).load(std::memory_order_relaxed);
+            if (n == END || _keys[n] >= key)
+                break;
+            node = n;
+        }
+        prev[level] = node;
+    }
+
+    // Keep a link for each node which can still be inserted after this one,
+    // so an unlucky run of tall nodes can't use up the arena.
+    int height = std::min(randomHeight(),
+        _linkCapacity - _linkCount - (_capacity - _count - 1));
+    for (int level = top; level < height; level++)
+    {
+        prev[level] = -1;
+    }
+    if (height > top)
+        _height.store(height, std::memory_order_relaxed);
+
+    // Take the next node from the arena and link it in at each level.
+    node = _count++;
+    _keys[node] = key;
+    _vals[node] = val;
+    _offsets[node] = _linkCount;
+    _linkCount += height;
+    // Set the node's links before linking it in. The release store makes
+    // the node visible to searches on other threads only once it is ready.
+    for (int level = 0; level < height; level++)
+    {
+        int after = next(prev[level], level).load(std::memory_order_relaxed);
+        next(node, level).store(after, std::memory_order_relaxed);
+        next(prev[level], level).store(node, std::memory_order_release);
+    }
+}
+
+/**
+ * Find the most recent value for a key.
+ * @return true if the key was found.
+ */
+bool SkipList::Find(kv_key_t key, kv_val_t &val)
+{
+    int node = Seek(key);
+    if (node == END || _keys[node] != key)
+        return false;
+
+    val = _vals[node];
+    return true;
+}
+
+/**
+ * The first node with a key greater than or equal to a key, or END.
+ */
+int SkipList::Seek(kv_key_t key)
+{
+    // A search can see a new height before the head links of the new levels,
+    // which are still END, so it just skips those levels.
+    int node = -1;
+    for (int level = _height.load(std::memory_order_relaxed) - 1; level >= 0; level--)
+    {
+        while (true)
+        {
+            int n = next(node, level).load(std::memory_order_acquire);
+            if (n == END || _keys[n] >= key)
+                break;
+            node = n;
+        }
+    }
+    return next(node, 0).load(std::memory_order_acquire);
+}
+
+/**
+ * Remove all the items. No other thread can be searching the list.
+ */
+void SkipList::Clear()
+{
+    _count = 0;
+    _height = 1;
+    _linkCount = 0;
+    for (int level = 0; level < MAX_HEIGHT; level++)
+    {
+        _head[level] = END;
+    }
+}
+
+/**
+ * Pick a random height for a new node. Each level has a quarter of the
+ * nodes of the level below.
+ */
+int SkipList::randomHeight()
+{
+    // xorshift64
+    _random ^= _random << 13;
+    _random ^= _random >> 7;
+    _random ^= _random << 17;
+
+    int height = 1;
+    uint64_t bits = _random;
+    while (height < MAX_HEIGHT && (bits & 3) == 0)
+    {
+        height++;
+        bits >>= 2;
+    }
+    return height;
+}
+
+/**
+ * The index of the next node at a level after a node, with -1 meaning
+ * the head of the list.
+ */
+std::atomic<int>& SkipList::next(int node, int level)
+{
+    if (node < 0)
+        return _head[level];
+    return _links[_offsets[node] + level];
+}
+
+}
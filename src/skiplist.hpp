@@ -0,0 +1,112 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * A skip list used by the memory level when leveling.
+ *
+ * Keeping the memory level sorted in arrays costs O(n) per insert because the
+ * arrays have to be shifted. The skip list inserts in O(log n) and can still
+ * be read in sorted order when the level is flushed.
+ *
+ * All the nodes are allocated up front from arrays (an arena) which are
+ * sized for the number of items the level can hold. Nodes are referred to by
+ * their index in the arrays rather than by pointers.
+ *
+ * One thread can insert while other threads search. A node is filled in
+ * before it is linked into the list, and the links are atomic, so a search
+ * only ever follows links to nodes which are ready.
+ */
+
+#ifndef KVSKIPLIST_H
+#define KVSKIPLIST_H
+
+#include "types.hpp"
+#include <stdint.h>
+#include <atomic>
+
+namespace kv
+{
+
+/**
+ * A skip list of keys and values with a fixed capacity.
+ */
+class SkipList
+{
+public:
+    static const int MAX_HEIGHT = 20;   // The most levels a node can have.
+    static const int END = -1;          // The index used for no node.
+
+    /**
+     * Create an empty skip list.
+     * @param capacity The number of items the list can hold.
+     * @param seed The seed for the heights of the nodes. With 0 every node is
+     *             as tall as it can be, which is the worst case for the arena.
+     */
+    SkipList(int capacity, uint64_t seed = 0x9E3779B97F4A7C15ull);
+    ~SkipList();
+
+    /**
+     * Add a key and value. The key is put before any items with the same key
+     * so the most recent value for a key is found first. Only one thread can
+     * insert at a time.
+     */
+    void Insert(kv_key_t key, kv_val_t val);
+
+    /**
+     * Find the most recent value for a key.
+     * @return true if the key was found.
+     */
+    bool Find(kv_key_t key, kv_val_t &val);
+
+    /**
+     * The first node with a key greater than or equal to a key, or END.
+     */
+    int Seek(kv_key_t key);
+
+    /**
+     * Remove all the items. No other thread can be searching the list.
+     */
+    void Clear();
+
+    int Count() { return _count; }
+
+    /**
+     * The first node in key order, or END.
+     */
+    int First() { return _head[0].load(std::memory_order_acquire); }
+
+    /**
+     * The node after a node in key order, or END.
+     */
+    int Next(int node) { return _links[_offsets[node]].load(std::memory_order_acquire); }
+
+    kv_key_t Key(int node) { return _keys[node]; }
+    kv_val_t Val(int node) { return _vals[node]; }
+
+private:
+    /**
+     * Pick a random height for a new node. Each level has a quarter of the
+     * nodes of the level below.
+     */
+    int randomHeight();
+
+    /**
+     * The index of the next node at a level after a node, with -1 meaning
+     * the head of the list.
+     */
+    std::atomic<int>& next(int node, int level);
+
+    int _capacity;          // The number of items the list can hold.
+    int _count;             // The number of items in the list.
+    std::atomic<int> _height;   // The tallest node in the list.
+    std::atomic<int> _head[MAX_HEIGHT]; // The first node at each level.
+    kv_key_t* _keys;        // The key of each node.
+    kv_val_t* _vals;        // The value of each node.
+    int* _offsets;          // Where each node's links start in _links.
+    std::atomic<int>* _links;   // The next node at each level for every node.
+    int _linkCount;         // The number of links used.
+    int _linkCapacity;      // The size of _links.
+    uint64_t _random;       // The state of the random number generator.
+};
+
+}
+#endif
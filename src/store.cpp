@@ -8,10 +8,25 @@
 #include "store.hpp"
 #include "types.hpp"
 #include "memlevel.hpp"
+#include <algorithm>
 
 namespace kv
 {
 
+/**
+ * Build the settings used by the original constructor.
+ */
+static Options options(bool leveling, int size, int ratio, int bits, int hashes)
+{
+    Options options;
+    options.leveling = leveling;
+    options.size = size;
+    options.ratio = ratio;
+    options.bits = bits;
+    options.hashes = hashes;
+    return options;
+}
+
 /**
  * Create the store by initilizeing the top level of the LSM tree.
  *
@@ -22,19 +37,130 @@ namespace kv
  * @param hashes The number of hashes in the bloom filter.
  */
 Store::Store(bool leveling, int size, int ratio, int bits, int hashes)
-    : _next(leveling, size, ratio, bits, hashes)
+    : Store(options(leveling, size, ratio, bits, hashes))
+{
+}
+
+/**
+ * Create the store using the given settings.
+ */
+Store::Store(const Options& options)
+    : _wal(NULL),
+      _next(options, this)
 {
+    if (options.wal)
+    {
+        _wal = new WriteAheadLog(options.dir, options.sync, options.syncInterval);
+        if (options.reopen)
+            replay();
+        _wal->Forget();
+    }
+}
+
+/**
+ * Write the manifest and close the write-ahead log.
+ */
+Store::~Store()
+{
+    // Background merges still use the log so finish them first.
+    _next.Close();
+    delete _wal;
 }
 
 /**
  * Put a value in the store with a key.
+ * Puts from different threads are logged with a shared sync.
+ * @return false if the write-ahead log has failed, so the value may not
+ *         survive a crash.
  */
-void Store::Put(int key, std::string val)
+bool Store::Put(kv_key_t key, std::string val)
 {
     kv_key_t k = key;
     kv_val_t v;
     string2value(val, v);
-    _next.Put(k, v);
+
+    uint64_t lsn = 0;
+    {
+        // Log the value after putting it, so that if the put starts a flush
+        // the value goes in the new log segment.
+        std::lock_guard<std::mutex> lock(_writeMutex);
+        _next.Put(k, v);
+        if (_wal)
+            lsn = _wal->Append(k, v);
+    }
+
+    // Wait for the log without holding the lock so other puts can join the
+    // same sync.
+    return !_wal || _wal->Commit(lsn);
+}
+
+/**
+ * Put a batch of values in the store. The batch is logged with one sync.
+ * @return false if the write-ahead log has failed.
+ */
+bool Store::Put(const std::vector<kv_key_t>& keys, const std::vector<std::string>& vals)
+{
+    uint64_t lsn = 0;
+    {
+        std::lock_guard<std::mutex> lock(_writeMutex);
+        for (int i = 0; i < keys.size(); i++)
+        {
+            kv_key_t k = keys[i];
+            kv_val_t v;
+            string2value(vals[i], v);
+            _next.Put(k, v);
+            if (_wal)
+                lsn = _wal->Append(k, v);
+        }
+    }
+
+    return !_wal || _wal->Commit(lsn);
+}
+
+/**
+ * The page cache, with its capacity and hit and miss counts, or NULL if
+ * options.cacheSize is 0.
+ */
+PageCache* Store::getCache()
+{
+    return _next.getCache();
+}
+
+/**
+ * Seal the write-ahead log segment for the values being flushed.
+ */
+void Store::Flushing()
+{
+    if (_wal)
+        _wal->Rotate();
+}
+
+/**
+ * Delete the write-ahead log segment for the values which were flushed.
+ */
+void Store::Flushed()
+{
+    if (_wal)
+        _wal->Release();
+}
+
+/**
+ * Replay the write-ahead log left by a previous store.
+ */
+void Store::replay()
+{
+    std::vector<kv_key_t> keys;
+    std::vector<kv_val_t> vals;
+    _wal->Replay(keys, vals);
+
+    // The values are logged again in the new segments before the old
+    // segments are deleted.
+    for (int i = 0; i < keys.size(); i++)
+    {
+        _next.Put(keys[i], vals[i]);
+        _wal->Append(keys[i], vals[i]);
+    }
+    _wal->Sync();
 }
 
 /**
@@ -43,7 +169,7 @@ void Store::Put(int key, std::string val)
  * @param val Set to the value, if it is found.
  * @return true if the key was found.
  */
-bool Store::Get(int key, std::string &val)
+bool Store::Get(kv_key_t key, std::string &val)
 {
     kv_key_t k = key;
     kv_val_t v;
@@ -55,12 +181,75 @@ bool Store::Get(int key, std::string &val)
     return false;
 }
 
+/**
+ * Get the values for a batch of keys. The batch is sorted once and each
+ * level is searched for all the keys which weren't found above it, in
+ * key order.
+ * @param keys The keys to lookup.
+ * @param values Set to the value of each key which is found.
+ * @param found Set to true for each key which is found.
+ */
+void Store::MultiGet(const std::vector<kv_key_t>& keys, std::vector<std::string>& values,
+    std::vector<bool>& found)
+{
+    int count = keys.size();
+
+    // Sort the positions of the keys by key.
+    std::vector<int> order(count);
+    for (int i = 0; i < count; i++)
+    {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(),
+        [&keys](int a, int b) { return keys[a] < keys[b]; });
+
+    kv_key_t* sorted = new kv_key_t[count];
+    kv_val_t* vals = new kv_val_t[count];
+    for (int i = 0; i < count; i++)
+    {
+        sorted[i] = keys[order[i]];
+    }
+
+    // The levels remove the keys they find from pending.
+    std::vector<int> pending(order.size());
+    for (int i = 0; i < count; i++)
+    {
+        pending[i] = i;
+    }
+    _next.MultiGet(sorted, vals, pending);
+
+    values.assign(count, std::string());
+    found.assign(count, true);
+    for (int i = 0; i < pending.size(); i++)
+    {
+        found[order[pending[i]]] = false;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (found[order[i]])
+            value2string(vals[i], values[order[i]]);
+    }
+
+    delete [] sorted;
+    delete [] vals;
+}
+
+/**
+ * Get the keys between lo and hi, inclusive, in key order with the most
+ * recent value of each key. The iterator reads the store as it was when
+ * Scan was called.
+ */
+Iterator Store::Scan(kv_key_t lo, kv_key_t hi)
+{
+    return Iterator(_next, lo, hi);
+}
+
 /**
  * Check if a key is in the store.
  * @param key The key to lookup.
  * @return true if the key was found.
  */
-bool Store::Contains(int key)
+bool Store::Contains(kv_key_t key)
 {
     std::string value;
     return Get(key, value);
@@ -9,7 +9,12 @@
 #define KVSTORE_H
 
 #include "memlevel.hpp"
+#include "options.hpp"
+#include "wal.hpp"
+#include "iterator.hpp"
 #include <string>
+#include <vector>
+#include <mutex>
 
 namespace kv
 {
@@ -18,7 +23,7 @@ namespace kv
  * The key/value store. Keys are integers and values are be strings.
  * The strings will be limited the lenght defined by VAL_LEN in types.h.
  */
-class Store
+class Store : public FlushListener
 {
 public:
 
@@ -33,10 +38,31 @@ public:
      */
     Store(bool leveling, int size, int ratio, int bits, int hashes);
 
+    /**
+     * Create the store using the given settings. If options.reopen is true
+     * then the tree is reopened from the files in options.dir.
+     * When the store is destroyed a manifest is written so it can be reopened.
+     */
+    Store(const Options& options);
+
+    /**
+     * Write the manifest and close the write-ahead log.
+     */
+    ~Store();
+
     /**
      * Put a value in the store with a key.
+     * Puts from different threads are logged with a shared sync.
+     * @return false if the write-ahead log has failed, so the value may not
+     *         survive a crash.
+     */
+    bool Put(kv_key_t key, std::string value);
+
+    /**
+     * Put a batch of values in the store. The batch is logged with one sync.
+     * @return false if the write-ahead log has failed.
      */
-    void Put(int key, std::string value);
+    bool Put(const std::vector<kv_key_t>& keys, const std::vector<std::string>& values);
 
     /**
      * Get a value from the store using a key.
@@ -44,14 +70,32 @@ public:
      * @param val Set to the value, if it is found.
      * @return true if the key was found.
      */
-    bool Get(int key, std::string &value);
+    bool Get(kv_key_t key, std::string &value);
+
+    /**
+     * Get the values for a batch of keys. The batch is sorted once and each
+     * level is searched for all the keys which weren't found above it, in
+     * key order.
+     * @param keys The keys to lookup.
+     * @param values Set to the value of each key which is found.
+     * @param found Set to true for each key which is found.
+     */
+    void MultiGet(const std::vector<kv_key_t>& keys, std::vector<std::string>& values,
+        std::vector<bool>& found);
+
+    /**
+     * Get the keys between lo and hi, inclusive, in key order with the most
+     * recent value of each key. The iterator reads the store as it was when
+     * Scan was called.
+     */
+    Iterator Scan(kv_key_t lo, kv_key_t hi);
 
     /**
      * Check if a key is in the store.
      * @param key The key to lookup.
      * @return true if the key was found.
      */
-    bool Contains(int key);
+    bool Contains(kv_key_t key);
 
     /**
      * Get the number of items in the store. If a key is added twice then it will
@@ -65,7 +109,30 @@ public:
      */
     std::string Dump(bool verbose = false);
 
+    /**
+     * The page cache, with its capacity and hit and miss counts, or NULL if
+     * options.cacheSize is 0.
+     */
+    PageCache* getCache();
+
+    /**
+     * Seal the write-ahead log segment for the values being flushed.
+     */
+    void Flushing() override;
+
+    /**
+     * Delete the write-ahead log segment for the values which were flushed.
+     */
+    void Flushed() override;
+
 private:
+    /**
+     * Replay the write-ahead log left by a previous store.
+     */
+    void replay();
+
+    WriteAheadLog* _wal;    // The log, or NULL if there isn't one.
+    std::mutex _writeMutex; // Serializes puts.
     MemLevel _next;
 };
 
@@ -14,9 +14,9 @@ namespace kv
  * Make a list of all the even numbers between 0 and n-1. The list will is
  * shuffled.
  */
-std::vector<int> makeRandomKeys(int n)
+std::vector<kv_key_t> makeRandomKeys(int n)
 {
-    std::vector<int> tests(n);
+    std::vector<kv_key_t> tests(n);
 
     for (int i = 0; i < n; i++)
     {
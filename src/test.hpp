@@ -17,7 +17,7 @@ namespace kv
  * Make a list of all the even numbers between 0 and n-1. The list will is
  * shuffled.
  */
-std::vector<int> makeRandomKeys(int n);
+std::vector<kv_key_t> makeRandomKeys(int n);
 
 }
 #endif
\ No newline at end of file
@@ -3,21 +3,47 @@
  *
  * The types used for keys and values in the LSM tree.
  * Also contains some functions for converting between types.
+ *
+ * The width of keys and values is picked when the store is built. Keys are
+ * 32 bit integers unless KV_KEY_BITS is defined as 64, e.g. -DKV_KEY_BITS=64,
+ * and values are 20 characters unless KV_VAL_LEN is defined. Files written
+ * with one width can't be read with another, see Manifest.
  */
 
 #ifndef KVTYPES_H
 #define KVTYPES_H
 
 #include <array>
+#include <string>
+#include <limits>
+#include <stdint.h>
+
+#ifndef KV_KEY_BITS
+#define KV_KEY_BITS 32
+#endif
+
+#ifndef KV_VAL_LEN
+#define KV_VAL_LEN 20
+#endif
 
 namespace kv
 {
 
-const int VAL_LEN = 20;     // The lenght of a value.
+const int VAL_LEN = KV_VAL_LEN; // The lenght of a value.
 
-using kv_key_t = int;       // The key type.
+#if KV_KEY_BITS == 64
+using kv_key_t = int64_t;   // The key type.
+#elif KV_KEY_BITS == 32
+using kv_key_t = int32_t;   // The key type.
+#else
+#error "KV_KEY_BITS must be 32 or 64."
+#endif
 using kv_val_t = std::array<char, VAL_LEN>; // The value type.
 
+// The smallest and largest keys, used as sentinels.
+const kv_key_t KEY_MIN = std::numeric_limits<kv_key_t>::min();
+const kv_key_t KEY_MAX = std::numeric_limits<kv_key_t>::max();
+
 /**
  * Convert a string to a value type.
  */
@@ -0,0 +1,240 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * A version of the LSM tree, which lookups read.
+ */
+
+#include "version.hpp"
+#include <algorithm>
+
+namespace kv
+{
+
+/**
+ * Create a version with the memory level's tables and no file levels.
+ * @param table The table which takes new puts.
+ * @param frozen The full table being merged in the background, or NULL.
+ */
+Version::Version(MemTable* table, MemTable* frozen)
+    : _table(table),
+      _frozen(frozen)
+{
+    _table->Ref();
+    if (_frozen)
+        _frozen->Ref();
+}
+
+Version::~Version()
+{
+    _table->Unref();
+    if (_frozen)
+        _frozen->Unref();
+    for (int i = 0; i < _levels.size(); i++)
+    {
+        for (int j = 0; j < _levels[i].partitions.size(); j++)
+        {
+            _levels[i].partitions[j]->Unref();
+        }
+    }
+}
+
+/**
+ * Add the next file level to this version.
+ * @param leveling Is the level leveling or tiering.
+ * @param partitions The level's partitions. In key order when leveling, or
+ *                   oldest first when tiering.
+ */
+void Version::AddLevel(bool leveling, const std::vector<Partition*>& partitions)
+{
+    Level level = {leveling, partitions};
+    for (int i = 0; i < partitions.size(); i++)
+    {
+        partitions[i]->Ref();
+    }
+    _levels.push_back(level);
+}
+
+/**
+ * Add the file levels of another version to this version.
+ */
+void Version::AddLevels(const Version& other)
+{
+    for (int i = 0; i < other._levels.size(); i++)
+    {
+        AddLevel(other._levels[i].leveling, other._levels[i].partitions);
+    }
+}
+
+/**
+ * The number of items in the tables and partitions of this version. Each item
+ * is in one of them, so it is counted once.
+ */
+int Version::Count()
+{
+    int count = _table->Count() + (_frozen ? _frozen->Count() : 0);
+    for (int i = 0; i < _levels.size(); i++)
+    {
+        for (int j = 0; j < _levels[i].partitions.size(); j++)
+        {
+            count += _levels[i].partitions[j]->getCount();
+        }
+    }
+    return count;
+}
+
+/**
+ * Get the newest value of a key.
+ * @param key The key to lookup.
+ * @param val Set to the value, if it is found.
+ * @return true if the key was found.
+ */
+bool Version::Get(kv_key_t key, kv_val_t &val)
+{
+    // Frozen values are older than the current ones but newer than anything
+    // in the file levels.
+    if (_table->Get(key, val))
+        return true;
+    if (_frozen && _frozen->Get(key, val))
+        return true;
+
+    // Then look in each file level from the top down. Only one partition of
+    // a leveling level can have the key. Each run of a tiered level can have
+    // it, so they are searched from the newest to the oldest. A partition
+    // checks its smallest and largest keys and then its bloom filter.
+    for (int i = 0; i < _levels.size(); i++)
+    {
+        Level& level = _levels[i];
+        if (level.leveling)
+        {
+            Partition* partition = findPartition(level, key);
+            if (partition && partition->Get(key, val))
+                return true;
+            continue;
+        }
+
+        for (int p = level.partitions.size() - 1; p >= 0; p--)
+        {
+            if (level.partitions[p]->Get(key, val))
+                return true;
+        }
+    }
+
+    // The key wasn't at any level.
+    return false;
+}
+
+/**
+ * Get the values for a batch of keys. Keys which are found are not searched
+ * for in the lower levels.
+ * @param keys The keys to lookup, sorted.
+ * @param vals Set to the value of each key which is found.
+ * @param pending The positions in keys to look for, in order. The positions
+ *                of the keys which are found are removed.
+ */
+void Version::MultiGet(const kv_key_t* keys, kv_val_t* vals, std::vector<int>& pending)
+{
+    // Look in the current values, then the frozen ones.
+    std::vector<int> missing;
+    for (int i = 0; i < pending.size(); i++)
+    {
+        int p = pending[i];
+        bool found = _table->Get(keys[p], vals[p]);
+        if (!found && _frozen)
+            found = _frozen->Get(keys[p], vals[p]);
+        if (!found)
+            missing.push_back(p);
+    }
+    pending.swap(missing);
+
+    // Look for the keys which weren't found in the file levels.
+    for (int i = 0; i < _levels.size() && !pending.empty(); i++)
+    {
+        multiGet(_levels[i], keys, vals, pending);
+    }
+}
+
+/**
+ * Get the values for a batch of keys from a file level.
+ */
+void Version::multiGet(Level& level, const kv_key_t* keys, kv_val_t* vals,
+    std::vector<int>& pending)
+{
+    std::vector<Partition*>& partitions = level.partitions;
+
+    // Look for the whole batch in each run of a tiered level, from the newest
+    // to the oldest.
+    std::vector<int> missing;
+    if (!level.leveling)
+    {
+        for (int p = partitions.size() - 1; p >= 0 && !pending.empty(); p--)
+        {
+            missing.clear();
+            partitions[p]->MultiGet(keys, vals, pending, missing);
+            pending.swap(missing);
+        }
+        return;
+    }
+
+    // The keys and the partitions of a leveling level are both sorted, so
+    // split the batch between the partitions in one pass. Keys between
+    // partitions can't be at this level.
+    std::vector<int> batch;
+    int i = 0;
+    for (int p = 0; p < partitions.size(); p++)
+    {
+        batch.clear();
+        for (; i < pending.size() && keys[pending[i]] <= partitions[p]->getMaxKey(); i++)
+        {
+            if (keys[pending[i]] >= partitions[p]->getMinKey())
+                batch.push_back(pending[i]);
+            else
+                missing.push_back(pending[i]);
+        }
+        if (!batch.empty())
+            partitions[p]->MultiGet(keys, vals, batch, missing);
+    }
+    missing.insert(missing.end(), pending.begin() + i, pending.end());
+
+    // Keep the positions in key order for the next level.
+    std::sort(missing.begin(), missing.end());
+    pending.swap(missing);
+}
+
+/**
+ * Add readers for the keys between lo and hi to a list of sources for a scan.
+ * The sources are added newest first and each one is sorted by key.
+ */
+void Version::Scan(kv_key_t lo, kv_key_t hi, std::vector<InputReader*>& sources)
+{
+    // The memory tables are small, so their keys in the range are copied.
+    sources.push_back(_table->Scan(lo, hi));
+    if (_frozen)
+        sources.push_back(_frozen->Scan(lo, hi));
+
+    // The runs of a tiered level are added newest first. The partitions of
+    // a leveling level don't share any keys, so their order doesn't matter.
+    for (int i = 0; i < _levels.size(); i++)
+    {
+        std::vector<Partition*>& partitions = _levels[i].partitions;
+        for (int p = partitions.size() - 1; p >= 0; p--)
+        {
+            partitions[p]->Scan(lo, hi, sources);
+        }
+    }
+}
+
+/**
+ * Find the partition of a leveling level which could have a key.
+ * @return The partition, or NULL if no partition's keys cover the key.
+ */
+Partition* Version::findPartition(Level& level, kv_key_t key)
+{
+    // The first partition which ends at or after the key.
+    auto found = std::lower_bound(level.partitions.begin(), level.partitions.end(), key,
+        [](Partition* p, kv_key_t key) { return p->getMaxKey() < key; });
+    if (found == level.partitions.end() || (*found)->getMinKey() > key)
+        return NULL;
+    return *found;
+}
+
+}
@@ -0,0 +1,114 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * A version of the LSM tree, which lookups read.
+ *
+ * A version has the memory level's tables and the partitions of each file
+ * level as they were when it was made, and it never changes. When a flush or
+ * a merge changes the tree the memory level makes a new version and
+ * publishes it. A lookup takes a reference to the current version and reads
+ * it without any locks, so many threads can look up keys while another
+ * thread puts and merges. Lookups which started before a merge finished
+ * carry on reading the version they have, and the tables and partitions the
+ * merge replaced are only freed, and their files deleted, when the last of
+ * those lookups is done.
+ */
+
+#ifndef KVVERSION_H
+#define KVVERSION_H
+
+#include "types.hpp"
+#include "memtable.hpp"
+#include "partition.hpp"
+#include "inputreader.hpp"
+#include "refcounted.hpp"
+#include <vector>
+
+namespace kv
+{
+
+/**
+ * The tables and partitions of the tree which a lookup reads.
+ */
+class Version : public RefCounted
+{
+public:
+    /**
+     * Create a version with the memory level's tables and no file levels.
+     * @param table The table which takes new puts.
+     * @param frozen The full table being merged in the background, or NULL.
+     */
+    Version(MemTable* table, MemTable* frozen);
+    ~Version();
+
+    /**
+     * Add the next file level to this version.
+     * @param leveling Is the level leveling or tiering.
+     * @param partitions The level's partitions. In key order when leveling,
+     *                   or oldest first when tiering.
+     */
+    void AddLevel(bool leveling, const std::vector<Partition*>& partitions);
+
+    /**
+     * Add the file levels of another version to this version.
+     */
+    void AddLevels(const Version& other);
+
+    /**
+     * Get the newest value of a key.
+     * @param key The key to lookup.
+     * @param val Set to the value, if it is found.
+     * @return true if the key was found.
+     */
+    bool Get(kv_key_t key, kv_val_t &val);
+
+    /**
+     * Get the values for a batch of keys. Keys which are found are not
+     * searched for in the lower levels.
+     * @param keys The keys to lookup, sorted.
+     * @param vals Set to the value of each key which is found.
+     * @param pending The positions in keys to look for, in order. The
+     *                positions of the keys which are found are removed.
+     */
+    void MultiGet(const kv_key_t* keys, kv_val_t* vals, std::vector<int>& pending);
+
+    /**
+     * Add readers for the keys between lo and hi to a list of sources for a
+     * scan. The sources are added newest first and each one is sorted by key.
+     */
+    void Scan(kv_key_t lo, kv_key_t hi, std::vector<InputReader*>& sources);
+
+    /**
+     * The number of items in the tables and partitions of this version.
+     * Each item is in one of them, so it is counted once.
+     */
+    int Count();
+
+private:
+    /**
+     * The partitions of a file level.
+     */
+    struct Level
+    {
+        bool leveling;
+        std::vector<Partition*> partitions;
+    };
+
+    /**
+     * Get the values for a batch of keys from a file level.
+     */
+    void multiGet(Level& level, const kv_key_t* keys, kv_val_t* vals, std::vector<int>& pending);
+
+    /**
+     * Find the partition of a leveling level which could have a key.
+     * @return The partition, or NULL if no partition's keys cover the key.
+     */
+    Partition* findPartition(Level& level, kv_key_t key);
+
+    MemTable* _table;           // The table which takes new puts.
+    MemTable* _frozen;          // The table being merged, or NULL.
+    std::vector<Level> _levels; // The file levels, from the top down.
+};
+
+}
+#endif
@@ -0,0 +1,319 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * A write-ahead log for the memory level.
+ */
+
+#include "wal.hpp"
+#include "lib/MurmurHash3.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace kv
+{
+
+/**
+ * Open a new log segment in a directory. Segments left by a previous
+ * store are kept until Replay and Forget are called.
+ * @param dir The directory the store keeps its files in.
+ * @param policy When the log is forced to disk.
+ * @param interval The number of milliseconds between syncs when using
+ *                 SyncPolicy::Interval.
+ */
+WriteAheadLog::WriteAheadLog(std::string dir, SyncPolicy policy, int interval)
+    : _dir(dir),
+      _policy(policy),
+      _interval(interval),
+      _fd(-1),
+      _seq(0),
+      _appended(0),
+      _written(0),
+      _synced(0),
+      _syncing(false),
+      _failed(false),
+      _stop(false)
+{
+    // Find the segments left by a previous store.
+    DIR* d = opendir(dir.c_str());
+    if (d)
+    {
+        struct dirent* entry;
+        while ((entry = readdir(d)) != NULL)
+        {
+            if (strncmp(entry->d_name, "lsm.wal.", 8) == 0)
+                _old.push_back(strtoull(entry->d_name + 8, NULL, 10));
+        }
+        closedir(d);
+    }
+    std::sort(_old.begin(), _old.end());
+
+    // Start a new segment after the old ones.
+    if (!_old.empty())
+        _seq = _old.back() + 1;
+    _failed = !open();
+
+    if (_policy == SyncPolicy::Interval)
+        _syncerThread = std::thread(&WriteAheadLog::syncer, this);
+}
+
+/**
+ * Sync everything that has been appended and close the log.
+ */
+WriteAheadLog::~WriteAheadLog()
+{
+    if (_syncerThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cond.notify_all();
+        _syncerThread.join();
+    }
+
+    Sync();
+    if (_fd >= 0)
+        ::close(_fd);
+}
+
+/**
+ * Read the records from the segments left by a previous store, oldest
+ * first. A torn record at the end of a segment is ignored.
+ */
+void WriteAheadLog::Replay(std::vector<kv_key_t>& keys, std::vector<kv_val_t>& vals)
+{
+    for (int i = 0; i < _old.size(); i++)
+    {
+        FILE* file = fopen(filename(_old[i]).c_str(), "rb");
+        if (!file)
+            continue;
+
+        Record record;
+        while (fread(&record, sizeof(Record), 1, file) == 1)
+        {
+            if (record.check != check(record))
+                break;
+            keys.push_back(record.key);
+            vals.push_back(record.val);
+        }
+        fclose(file);
+    }
+}
+
+/**
+ * Delete the segments left by a previous store.
+ */
+void WriteAheadLog::Forget()
+{
+    for (int i = 0; i < _old.size(); i++)
+    {
+        std::remove(filename(_old[i]).c_str());
+    }
+    _old.clear();
+}
+
+/**
+ * Add a record to the log.
+ * @return The sequence number of the record, to pass to Commit.
+ */
+uint64_t WriteAheadLog::Append(kv_key_t key, kv_val_t val)
+{
+    Record record;
+    memset(&record, 0, sizeof(Record));
+    record.key = key;
+    record.val = val;
+    record.check = check(record);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _buffer.push_back(record);
+    return ++_appended;
+}
+
+/**
+ * Wait until a record is as durable as the sync policy requires.
+ * Threads waiting at the same time share one write and sync.
+ * @return false if the log has failed.
+ */
+bool WriteAheadLog::Commit(uint64_t lsn)
+{
+    // The syncer thread takes care of the interval policy.
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_policy == SyncPolicy::Interval)
+        return !_failed;
+
+    bool sync = _policy == SyncPolicy::EveryOp;
+    while ((sync ? _synced : _written) < lsn)
+    {
+        // If another thread is already writing then wait for it. It may have
+        // taken our record with it.
+        if (_failed)
+            return false;
+        if (_syncing)
+            _cond.wait(lock);
+        else
+            flush(lock, sync);
+    }
+    return true;
+}
+
+/**
+ * Write and sync everything that has been appended.
+ * @return false if the log has failed.
+ */
+bool WriteAheadLog::Sync()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cond.wait(lock, [this] { return !_syncing; });
+    return flush(lock, true);
+}
+
+/**
+ * Seal the current segment and start a new one. Called when the memory
+ * level starts to flush.
+ * @return false if the log has failed, in which case the segment isn't
+ *         sealed.
+ */
+bool WriteAheadLog::Rotate()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cond.wait(lock, [this] { return !_syncing; });
+
+    // The records in the sealed segment must be as durable as the policy
+    // says before the segment is closed.
+    if (!flush(lock, _policy != SyncPolicy::None))
+        return false;
+
+    ::close(_fd);
+    _sealed.push_back(_seq);
+    _seq++;
+    _failed = !open();
+    return !_failed;
+}
+
+/**
+ * Delete the oldest sealed segment. Called when a flush is finished.
+ * Nothing is deleted once the log has failed.
+ */
+void WriteAheadLog::Release()
+{
+    // The values in the flush may not be in any segment which is on disk.
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_sealed.empty() || _failed)
+        return;
+    std::remove(filename(_sealed.front()).c_str());
+    _sealed.pop_front();
+}
+
+/**
+ * Write the buffered records to the current segment and optionally sync
+ * it. The lock is released while writing so more records can be appended.
+ * @return false if the log has failed.
+ */
+bool WriteAheadLog::flush(std::unique_lock<std::mutex>& lock, bool sync)
+{
+    if (_failed)
+        return false;
+
+    _syncing = true;
+    std::vector<Record> records;
+    records.swap(_buffer);
+    uint64_t lsn = _appended;
+    int fd = _fd;
+    lock.unlock();
+
+    bool ok = write(fd, (const char*)records.data(), records.size() * sizeof(Record), sync);
+
+    // A failed write or sync doesn't move the records written or synced on,
+    // so no thread waiting for them is told they are durable.
+    lock.lock();
+    if (ok)
+    {
+        _written = lsn;
+        if (sync)
+            _synced = lsn;
+    }
+    else
+    {
+        _failed = true;
+    }
+    _syncing = false;
+    _cond.notify_all();
+    return ok;
+}
+
+/**
+ * Write bytes to the end of the current segment and optionally sync it.
+ * @return false if the write or the sync failed.
+ */
+bool WriteAheadLog::write(int fd, const char* data, size_t len, bool sync)
+{
+    while (len > 0)
+    {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+    if (!sync)
+        return true;
+
+    int result;
+    do
+    {
+        result = fdatasync(fd);
+    } while (result < 0 && errno == EINTR);
+    return result == 0;
+}
+
+/**
+ * Create the file for the current segment.
+ * @return false if it couldn't be created.
+ */
+bool WriteAheadLog::open()
+{
+    _fd = ::open(filename(_seq).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    return _fd >= 0;
+}
+
+/**
+ * The path of a segment file.
+ */
+std::string WriteAheadLog::filename(uint64_t seq)
+{
+    return _dir + "/lsm.wal." + std::to_string(seq);
+}
+
+/**
+ * The hash used to detect torn records.
+ */
+uint32_t WriteAheadLog::check(const Record& record)
+{
+    uint32_t hash;
+    MurmurHash3_x86_32(&record, offsetof(Record, check), 0, &hash);
+    return hash;
+}
+
+/**
+ * The background thread used by SyncPolicy::Interval.
+ */
+void WriteAheadLog::syncer()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_stop)
+    {
+        _cond.wait_for(lock, std::chrono::milliseconds(_interval), [this] { return _stop; });
+        if (!_syncing && !_failed && _synced < _appended)
+            flush(lock, true);
+    }
+}
+
+}
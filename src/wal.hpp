@@ -0,0 +1,177 @@
+/**
+ * Pat Leahy pat@patleahy.com - CSEP 544 SP21 - Mini-project - Lemur
+ *
+ * A write-ahead log for the memory level.
+ *
+ * Every put is appended to the log before the store returns, so the values in
+ * the memory level can be replayed after a crash. The log is kept as a series
+ * of segment files. When the memory level starts a flush the current segment
+ * is sealed and a new one is started. Once the flushed values are safely in
+ * the file levels the sealed segment is deleted.
+ *
+ * Group commit: records are appended to a memory buffer. The first thread
+ * which needs its record on disk becomes the leader, writes everything in the
+ * buffer and calls fdatasync once for all the waiting threads.
+ *
+ * If a write or sync fails the log has failed. Records which were written
+ * may not be on disk, so no record is reported durable after that, and no
+ * segment is sealed or deleted. The segments are left for a new store to
+ * replay.
+ */
+
+#ifndef KVWAL_H
+#define KVWAL_H
+
+#include "types.hpp"
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+namespace kv
+{
+
+/**
+ * When the log is forced to disk.
+ */
+enum class SyncPolicy
+{
+    EveryOp,    // A put returns after its record has been synced.
+    Interval,   // A background thread syncs the log every few milliseconds.
+    None        // Records are written to the OS but never synced.
+};
+
+/**
+ * A write-ahead log for the memory level.
+ */
+class WriteAheadLog
+{
+public:
+    /**
+     * Open a new log segment in a directory. Segments left by a previous
+     * store are kept until Replay and Forget are called.
+     * @param dir The directory the store keeps its files in.
+     * @param policy When the log is forced to disk.
+     * @param interval The number of milliseconds between syncs when using
+     *                 SyncPolicy::Interval.
+     */
+    WriteAheadLog(std::string dir, SyncPolicy policy, int interval);
+
+    /**
+     * Sync everything that has been appended and close the log.
+     */
+    ~WriteAheadLog();
+
+    /**
+     * Read the records from the segments left by a previous store, oldest
+     * first. A torn record at the end of a segment is ignored.
+     */
+    void Replay(std::vector<kv_key_t>& keys, std::vector<kv_val_t>& vals);
+
+    /**
+     * Delete the segments left by a previous store.
+     */
+    void Forget();
+
+    /**
+     * Add a record to the log.
+     * @return The sequence number of the record, to pass to Commit.
+     */
+    uint64_t Append(kv_key_t key, kv_val_t val);
+
+    /**
+     * Wait until a record is as durable as the sync policy requires.
+     * Threads waiting at the same time share one write and sync.
+     * @return false if the log has failed.
+     */
+    bool Commit(uint64_t lsn);
+
+    /**
+     * Write and sync everything that has been appended.
+     * @return false if the log has failed.
+     */
+    bool Sync();
+
+    /**
+     * Seal the current segment and start a new one. Called when the memory
+     * level starts to flush.
+     * @return false if the log has failed, in which case the segment isn't
+     *         sealed.
+     */
+    bool Rotate();
+
+    /**
+     * Delete the oldest sealed segment. Called when a flush is finished.
+     * Nothing is deleted once the log has failed.
+     */
+    void Release();
+
+private:
+    /**
+     * A record in the log.
+     */
+    struct Record
+    {
+        kv_key_t key;
+        kv_val_t val;
+        uint32_t check;     // A hash of the key and value.
+    };
+
+    /**
+     * Write the buffered records to the current segment and optionally sync
+     * it. The lock is released while writing so more records can be appended.
+     * @return false if the log has failed.
+     */
+    bool flush(std::unique_lock<std::mutex>& lock, bool sync);
+
+    /**
+     * Write bytes to the end of the current segment and optionally sync it.
+     * @return false if the write or the sync failed.
+     */
+    static bool write(int fd, const char* data, size_t len, bool sync);
+
+    /**
+     * Create the file for the current segment.
+     * @return false if it couldn't be created.
+     */
+    bool open();
+
+    /**
+     * The path of a segment file.
+     */
+    std::string filename(uint64_t seq);
+
+    /**
+     * The hash used to detect torn records.
+     */
+    static uint32_t check(const Record& record);
+
+    /**
+     * The background thread used by SyncPolicy::Interval.
+     */
+    void syncer();
+
+    std::string _dir;           // The directory for the segments.
+    SyncPolicy _policy;         // When the log is forced to disk.
+    int _interval;              // Milliseconds between background syncs.
+    int _fd;                    // The current segment.
+    uint64_t _seq;              // The number of the current segment.
+    std::deque<uint64_t> _sealed;   // Segments waiting for a flush to finish.
+    std::vector<uint64_t> _old;     // Segments left by a previous store.
+    std::vector<Record> _buffer;    // Records not written yet.
+    uint64_t _appended;         // The last record appended.
+    uint64_t _written;          // The last record written to the OS.
+    uint64_t _synced;           // The last record synced to disk.
+    bool _syncing;              // Is a leader writing the buffer.
+    bool _failed;               // Has a write or sync failed.
+    bool _stop;                 // Tells the syncer thread to exit.
+    std::mutex _mutex;          // Guards everything above.
+    std::condition_variable _cond;  // Signaled when a leader finishes.
+    std::thread _syncerThread;  // Used by SyncPolicy::Interval.
+};
+
+}
+#endif
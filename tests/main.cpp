@@ -12,28 +12,107 @@
  *
  * n items will be put in the LSM tree and then n/100 items will be searched
  * for. Half the searche will be for existing keys and half will be for
- * non-existing key. This test will be run twice, once using leveling and once
- * using tiering.
+ * non-existing key. The same number of keys are then looked up in one batch
+ * and checked against single lookups. This test will be run twice, once using
+ * leveling and once using tiering.
  *
  * To display the contents of the LSM tree add 'debug' to the command, e.g.:
  *
  *  bin/lemur-test 100 debug
  *
+ * The leveling test is run a third time with the memory level merging into the
+ * file levels on a background thread, a fourth time using blocked bloom
+ * filters and a fifth time with the bloom filter bits spread over the levels
+ * from a bits per key budget, a sixth time reading through a page cache,
+ * then using a learned index with and without memory mapped files, then
+ * with the file levels split into partitions, and then with lazy leveling,
+ * which tiers the upper levels and levels the last one. The partitioned
+ * test is also run with the partitions pushed down into a tiered level, and
+ * with small partitions read with the stream backend through a page cache,
+ * so many pages are only partly written.
+ *
  * A second test is run to verify that if the same key is added multiple times
- * the most recent value is reterived.
+ * the most recent value is reterived. It is repeated with many updates and a
+ * store which drops superseded values when merging.
+ *
+ * A third test scans a range of keys, some of which have been updated, and
+ * checks each key is returned once, in order, with its most recent value.
+ *
+ * A fourth test closes a store and reopens it from the files it left on disk,
+ * including a store with partitioned levels. Then a new store in a directory
+ * an old store used must delete the old store's files.
+ * A fifth test abandons a store without closing it, as if it crashed, and
+ * reopens it using the write-ahead log. Then a log whose writes fail must
+ * not report puts as durable or delete its segments, and a file which can't
+ * be opened or written must fail with either backend.
+ *
+ * A sixth test checks the vectorized search of unsorted keys against the
+ * scalar search, and fills a skip list whose nodes are all as tall as they
+ * can be. Then keys spread over the whole key range are put, looked up,
+ * scanned and reopened, with a learned index and with partitions.
+ *
+ * A seventh test looks up keys on several threads while another thread puts
+ * them, with merges running underneath the lookups.
+ *
+ * An eighth test puts and updates keys in a store split into shards, looks
+ * them up while some are still queued, and reopens it. Then a sharded store
+ * whose logs fail must report it.
+ *
+ * A ninth test fills a store which splits big merges over threads and one
+ * which doesn't, and checks they leave the same files.
+ *
+ * A tenth test does the same with a store whose merges use io_uring, an
+ * eleventh with a store whose merges use direct I/O, and a twelfth with a
+ * store whose merges read pages ahead on helper threads.
+ *
+ * Keys are 32 bits unless the program is built with -DKV_KEY_BITS=64. The
+ * makefile's test64 target builds bin/lemur-test64 that way, with 32 byte
+ * values, and it is run the same way as bin/lemur-test.
  */
 
 #include "../src/store.hpp"
+#include "../src/shardedstore.hpp"
 #include "../src/test.hpp"
+#include "../src/simd.hpp"
+#include "../src/file.hpp"
+#include "../src/skiplist.hpp"
 #include <iostream>
 #include <cstring>
 #include <sstream>
 #include <iomanip>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <signal.h>
+#include <thread>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
 
 using namespace kv;
 
-void test(std::vector<int>& tests, bool leveling, bool debug);
+void test(std::vector<kv_key_t>& tests, const Options& options, bool debug);
+std::string describe(const Options& options);
 void testUpdates(bool leveling);
+void testDropSuperseded();
+void testScan(bool leveling);
+void testReopen(bool leveling, int partitionSize);
+void testFreshStore();
+void testCrash(bool background);
+void testLogFailure();
+void testFileFailure(FileBackend backend);
+void testFindLast();
+void testSkipList();
+void testWideKeys(const Options& options);
+void testConcurrent(const Options& options);
+void testSharded(int shards);
+void testShardedLogFailure();
+void testSplitMerge(const Options& options);
+void testIoUring(const Options& options);
+void testDirectIo(const Options& options);
+void testPrefetch(const Options& options);
+void fillStore(const Options& options, std::string dir, const std::vector<kv_key_t>& keys);
+bool sameFiles(std::string dir1, std::string dir2);
 
 
 int main(int argc, char** argv)
@@ -41,23 +120,127 @@ int main(int argc, char** argv)
     int n = atoi(argv[1]);
     bool debug = (argc > 2) && (strcmp(argv[2], "debug") == 0);
 
-    std::vector<int> tests = makeRandomKeys(n);
+    std::vector<kv_key_t> tests = makeRandomKeys(n);
 
-    test(tests, false, debug);
-    test(tests, true, debug);
+    Options options;
+    options.leveling = false;
+    test(tests, options, debug);
+    options.leveling = true;
+    test(tests, options, debug);
+    options.background = true;
+    test(tests, options, debug);
+    options.background = false;
+    options.filter = FilterType::Blocked;
+    test(tests, options, debug);
+    options.filter = FilterType::Classic;
+    options.bitsPerKey = 10;
+    test(tests, options, debug);
+    options.bitsPerKey = 0;
+    options.cacheSize = 1024*1024;
+    test(tests, options, debug);
+    options.cacheSize = 0;
+    options.learnedIndex = 16;
+    test(tests, options, debug);
+    options.mmap = false;
+    test(tests, options, debug);
+    options.learnedIndex = 0;
+    options.mmap = true;
+    options.partitionSize = 2048;
+    test(tests, options, debug);
+    options.policy = {true, true, false};
+    test(tests, options, debug);
+    options.policy.clear();
+    options.backend = FileBackend::Stream;
+    options.cacheSize = 1024*1024;
+    options.mmap = false;
+    options.partitionSize = 256;
+    test(tests, options, debug);
+    options.backend = FileBackend::Posix;
+    options.cacheSize = 0;
+    options.mmap = true;
+    options.partitionSize = 0;
+    options.policy = {false, false, false, true};
+    test(tests, options, debug);
+    options.policy.clear();
     testUpdates(false);
     testUpdates(true);
+    testDropSuperseded();
+    testScan(false);
+    testScan(true);
+    testReopen(false, 0);
+    testReopen(true, 0);
+    testReopen(true, 100);
+    testFreshStore();
+    testCrash(false);
+    testCrash(true);
+    testLogFailure();
+    testFileFailure(FileBackend::Posix);
+    testFileFailure(FileBackend::Stream);
+    testFindLast();
+    testSkipList();
+    Options wide;
+    wide.size = 64;
+    wide.leveling = false;
+    wide.learnedIndex = 16;
+    testWideKeys(wide);
+    wide.leveling = true;
+    wide.learnedIndex = 0;
+    wide.partitionSize = 256;
+    testWideKeys(wide);
+    Options concurrent;
+    concurrent.size = 64;
+    testConcurrent(concurrent);
+    concurrent.leveling = false;
+    concurrent.background = true;
+    testConcurrent(concurrent);
+    concurrent.leveling = true;
+    concurrent.partitionSize = 256;
+    testConcurrent(concurrent);
+    testSharded(1);
+    testSharded(4);
+    testShardedLogFailure();
+    Options split;
+    split.size = 64;
+    testSplitMerge(split);
+    split.size = 1024;
+    split.policy = {false, false, true};
+    split.filter = FilterType::Blocked;
+    split.learnedIndex = 16;
+    testSplitMerge(split);
+    Options ring;
+    ring.size = 64;
+    ring.ioDepth = 3;
+    testIoUring(ring);
+    ring.policy = {false, false, true};
+    ring.mergeThreads = 4;
+    testIoUring(ring);
+    Options direct;
+    testDirectIo(direct);
+    direct.policy = {false, false, true};
+    direct.mergeThreads = 4;
+    direct.ioUring = true;
+    testDirectIo(direct);
+    Options prefetch;
+    prefetch.size = 64;
+    prefetch.prefetch = 1;
+    testPrefetch(prefetch);
+    prefetch.policy = {false, false, true};
+    prefetch.mergeThreads = 4;
+    prefetch.prefetch = 3;
+    prefetch.cacheSize = 1024*1024;
+    prefetch.cacheMerges = true;
+    testPrefetch(prefetch);
 }
 
 
-void test(std::vector<int>& tests, bool leveling, bool debug)
+void test(std::vector<kv_key_t>& tests, const Options& options, bool debug)
 {
-    Store kv(leveling, 1024, 3, 1024*1024, 4);
+    Store kv(options);
     std::string str = "This is text";
 
     for (int i = 0; i < tests.size(); i++)
     {
-        int t = tests[i];
+        kv_key_t t = tests[i];
         std::stringstream val;
         val << "Val " << std::setw(8) << t;
         kv.Put(t, val.str());
@@ -65,6 +248,18 @@ void test(std::vector<int>& tests, bool leveling, bool debug)
 
     std::cout << std::endl << kv.Dump(debug) << std::endl;
 
+    // Every key is put once, so each must be counted once, even while a
+    // merge is running in the background.
+    if (kv.Count() != tests.size())
+    {
+        std::cout
+            << "Failure Count"
+            << " " << describe(options)
+            << " " << kv.Count()
+            << std::endl;
+        return;
+    }
+
     int max = tests.size()*2;
     int searches = tests.size()/100;
 
@@ -77,21 +272,89 @@ void test(std::vector<int>& tests, bool leveling, bool debug)
         {
             std::cout
                 << "Failure"
-                << " " << (leveling ? "leveling" : "tiering")
+                << " " << describe(options)
                 << " " << r
                 << " " << (c ? "exists" : "not exists ")
                 << std::endl;
             return;
         }
     }
+
+    // Look up a batch of keys at once and check them against Get.
+    std::vector<kv_key_t> batch;
+    for (int i = 0; i < searches; i++)
+    {
+        batch.push_back(rand() % max);
+    }
+    std::vector<std::string> values;
+    std::vector<bool> found;
+    kv.MultiGet(batch, values, found);
+    for (int i = 0; i < batch.size(); i++)
+    {
+        std::string val;
+        bool c = kv.Get(batch[i], val);
+        if (found[i] != c || values[i] != val)
+        {
+            std::cout
+                << "Failure MultiGet"
+                << " " << describe(options)
+                << " " << batch[i]
+                << std::endl;
+            return;
+        }
+    }
+
     std::cout
         << "Success"
-        << " " << (leveling ? "leveling" : "tiering")
+        << " " << describe(options)
         << " size " << tests.size()
         << " searches " << searches
         << std::endl;
 }
 
+/**
+ * The name of the kind of store used in a test.
+ */
+std::string describe(const Options& options)
+{
+    std::stringstream name;
+    if (options.policy.empty())
+        name << (options.leveling ? "leveling" : "tiering");
+    else
+    {
+        name << "policy";
+        for (bool leveling : options.policy)
+            name << " " << (leveling ? "L" : "T");
+    }
+    if (options.background)
+        name << " background";
+    if (options.backend == FileBackend::Stream)
+        name << " stream";
+    if (options.filter == FilterType::Blocked)
+        name << " blocked";
+    if (options.bitsPerKey > 0)
+        name << " bits/key " << options.bitsPerKey;
+    if (options.cacheSize > 0)
+        name << " cache " << options.cacheSize;
+    if (options.learnedIndex > 0)
+        name << " learned index " << options.learnedIndex;
+    if (!options.mmap)
+        name << " no mmap";
+    if (options.partitionSize > 0)
+        name << " partitions " << options.partitionSize;
+    if (options.mergeThreads > 1)
+        name << " merge threads " << options.mergeThreads;
+    if (options.ioUring)
+        name << " io_uring " << options.ioDepth;
+    if (options.directIo)
+        name << " direct";
+    if (options.prefetch > 0)
+        name << " prefetch " << options.prefetch;
+    if (options.cacheMerges)
+        name << " cache merges";
+    return name.str();
+}
+
 void testUpdates(bool leveling)
 {
    std::cout << std::endl << "TestUpdates";
@@ -123,4 +386,765 @@ void testUpdates(bool leveling)
         << " " << (leveling ? "leveling" : "tiering")
         << " " << val
         << std::endl;
-}
\ No newline at end of file
+}
+
+void testDropSuperseded()
+{
+    std::cout << std::endl << "TestDropSuperseded";
+
+    Options options;
+    options.size = 64;
+    options.dropSuperseded = true;
+    Store kv(options);
+
+    // Update each key many times.
+    int keys = 500;
+    int rounds = 20;
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int k = 0; k < keys; k++)
+        {
+            kv.Put(k, std::to_string(r));
+        }
+    }
+
+    for (int k = 0; k < keys; k++)
+    {
+        std::string val;
+        if (!kv.Get(k, val) || val != std::to_string(rounds - 1))
+        {
+            std::cout << " Failure " << k << "=" << val << std::endl;
+            return;
+        }
+    }
+
+    // Most of the old values should have been dropped.
+    if (kv.Count() >= keys * rounds / 2)
+    {
+        std::cout << " Failure count " << kv.Count() << std::endl;
+        return;
+    }
+    std::cout << " Success " << keys * rounds << " puts " << kv.Count() << " kept" << std::endl;
+}
+
+void testScan(bool leveling)
+{
+    std::cout << std::endl << "TestScan";
+
+    Options options;
+    options.leveling = leveling;
+    options.size = 64;
+    Store kv(options);
+
+    // Put the even keys and then update every third one.
+    std::vector<kv_key_t> keys = makeRandomKeys(4000);
+    for (int i = 0; i < keys.size(); i++)
+    {
+        kv.Put(keys[i], "old");
+    }
+    for (int i = 0; i < keys.size(); i++)
+    {
+        if (keys[i] % 3 == 0)
+            kv.Put(keys[i], "new");
+    }
+
+    int lo = 501;
+    int hi = 1500;
+    int expected = lo + 1;
+    Iterator it = kv.Scan(lo, hi);
+    while (it.HasNext())
+    {
+        kv_key_t key;
+        std::string val;
+        it.Next(key, val);
+        std::string want = (key % 3 == 0) ? "new" : "old";
+        if (key != expected || val != want)
+        {
+            std::cout << " Failure " << (leveling ? "leveling" : "tiering")
+                      << " " << key << "=" << val << std::endl;
+            return;
+        }
+        expected += 2;
+    }
+
+    if (expected != hi + 2)
+    {
+        std::cout << " Failure " << (leveling ? "leveling" : "tiering")
+                  << " stopped at " << expected << std::endl;
+        return;
+    }
+    std::cout << " Success " << (leveling ? "leveling" : "tiering")
+              << " " << (hi - lo + 1) / 2 << std::endl;
+}
+
+void testReopen(bool leveling, int partitionSize)
+{
+    std::cout << std::endl << "TestReopen";
+
+    Options options;
+    options.leveling = leveling;
+    options.size = 64;
+    options.partitionSize = partitionSize;
+    std::vector<kv_key_t> keys = makeRandomKeys(1000);
+
+    // Fill a store and then close it.
+    {
+        Store kv(options);
+        for (int i = 0; i < keys.size(); i++)
+        {
+            kv.Put(keys[i], std::to_string(keys[i]));
+        }
+    }
+
+    // Reopen the store. Every key should still be there with its value.
+    options.reopen = true;
+    Store kv(options);
+    bool success = kv.Count() == keys.size();
+    for (int i = 0; i < keys.size(); i++)
+    {
+        std::string val;
+        if (!kv.Get(keys[i], val) || val.compare(std::to_string(keys[i])) != 0)
+            success = false;
+    }
+    if (kv.Contains(1))
+        success = false;
+
+    std::cout
+        << " " << (success ? "Success" : "Failure")
+        << " " << describe(options)
+        << " " << kv.Count()
+        << std::endl;
+}
+
+void testFreshStore()
+{
+    std::cout << std::endl << "TestFreshStore";
+
+    // Leave a big store in one directory, then put fewer keys in a new store
+    // there and in an empty directory. The new store must delete the files
+    // of the old one, so the two directories end up the same.
+    Options options;
+    options.size = 64;
+    std::vector<kv_key_t> keys = makeRandomKeys(5000);
+    fillStore(options, "data/stale", keys);
+    std::filesystem::remove_all("data/fresh");
+    std::string dirs[] = {"data/stale", "data/fresh"};
+    for (int s = 0; s < 2; s++)
+    {
+        options.dir = dirs[s];
+        Store kv(options);
+        for (int i = 0; i < 1000; i++)
+        {
+            kv.Put(keys[i], std::to_string(keys[i]));
+        }
+    }
+    bool success = sameFiles(dirs[0], dirs[1]);
+
+    std::cout
+        << " " << (success ? "Success" : "Failure")
+        << std::endl;
+}
+
+void testCrash(bool background)
+{
+    std::cout << std::endl << "TestCrash";
+
+    Options options;
+    options.size = 64;
+    options.background = background;
+    options.wal = true;
+    options.sync = SyncPolicy::None;
+    std::vector<kv_key_t> keys = makeRandomKeys(1000);
+
+    // Fill a store in a child process which exits without closing it. The
+    // manifest is only as new as the last flush and the rest of the values
+    // are only in the log.
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        Store* crashed = new Store(options);
+        for (int i = 0; i < keys.size(); i++)
+        {
+            crashed->Put(keys[i], std::to_string(keys[i]));
+        }
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+
+    // Reopen the store. Every key should still be there with its value.
+    options.reopen = true;
+    options.background = false;
+    Store kv(options);
+    bool success = true;
+    for (int i = 0; i < keys.size(); i++)
+    {
+        std::string val;
+        if (!kv.Get(keys[i], val) || val.compare(std::to_string(keys[i])) != 0)
+            success = false;
+    }
+
+    std::cout
+        << " " << (success ? "Success" : "Failure")
+        << (background ? " background" : "")
+        << " " << kv.Count()
+        << std::endl;
+}
+
+void testLogFailure()
+{
+    std::cout << std::endl << "TestLogFailure";
+
+    Options options;
+    options.size = 64;
+    options.wal = true;
+    options.dir = "data/walfail";
+    std::filesystem::remove_all(options.dir);
+    std::filesystem::create_directories(options.dir);
+
+    // Fill a store in a child process which can't write files past 1000
+    // bytes, so the log fails part way through its first segment. Once a
+    // put has failed no later put may be reported as durable.
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        signal(SIGXFSZ, SIG_IGN);
+        rlimit limit = {1000, 1000};
+        setrlimit(RLIMIT_FSIZE, &limit);
+        Store* failing = new Store(options);
+        std::vector<kv_key_t> keys = makeRandomKeys(1000);
+        int durable = 0;
+        bool failed = false;
+        for (int i = 0; i < keys.size(); i++)
+        {
+            bool ok = failing->Put(keys[i], std::to_string(keys[i]));
+            if (ok && failed)
+                _exit(1);
+            failed = failed || !ok;
+            durable += ok;
+        }
+        _exit(failed && durable > 0 ? 0 : 1);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    bool success = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    // The failed segment is neither sealed nor deleted by the flushes.
+    if (!std::filesystem::exists(options.dir + "/lsm.wal.0") ||
+        std::filesystem::exists(options.dir + "/lsm.wal.1"))
+    {
+        success = false;
+    }
+
+    // A log which works reports its puts as durable.
+    options.dir = "data";
+    {
+        Store kv(options);
+        if (!kv.Put(1, "1"))
+            success = false;
+    }
+
+    std::cout
+        << " " << (success ? "Success" : "Failure")
+        << std::endl;
+}
+
+void testFileFailure(FileBackend backend)
+{
+    std::cout << std::endl << "TestFileFailure";
+
+    bool success = true;
+    File<kv_key_t> file;
+    file.Open("data/missing/file.key", true, backend);
+    if (!file.fail())
+        success = false;
+    file.Close();
+
+    // Writes to /dev/full fail because the device is always full.
+    kv_key_t keys[] = {1, 2, 3};
+    file.Open("/dev/full", false, backend);
+    file.Write(keys, 0, 3);
+    if (!file.fail() || file.Sync())
+        success = false;
+    file.Close();
+
+    // Opening a file again clears the failure. Reading past the end of the
+    // file isn't a failure.
+    file.Open("data/file.key", true, backend);
+    file.Write(keys, 0, 3);
+    kv_key_t read[4] = {0, 0, 0, 0};
+    file.Read(read, 0, 4);
+    if (!file.Sync() || file.fail() || read[0] != 1 || read[2] != 3)
+        success = false;
+    file.Close();
+    std::remove("data/file.key");
+
+    std::cout
+        << " " << (success ? "Success" : "Failure")
+        << " " << (backend == FileBackend::Posix ? "posix" : "stream")
+        << std::endl;
+}
+
+void testFindLast()
+{
+    std::cout << std::endl << "TestFindLast " << findLastKernel();
+
+    // Use few distinct keys so most keys are in each array more than once.
+    srand(1);
+    for (int count = 0; count < 100; count++)
+    {
+        std::vector<kv_key_t> keys(count);
+        for (int i = 0; i < count; i++)
+        {
+            keys[i] = rand() % 20;
+        }
+        for (kv_key_t key = -1; key <= 20; key++)
+        {
+            int expected = findLastScalar(keys.data(), count, key);
+            int actual = findLast(keys.data(), count, key);
+            if (actual != expected)
+            {
+                std::cout << " Failure " << count << " " << key
+                    << " " << actual << "!=" << expected << std::endl;
+                return;
+            }
+        }
+    }
+    std::cout << " Success" << std::endl;
+}
+
+void testSkipList()
+{
+    std::cout << std::endl << "TestSkipList";
+
+    // With seed 0 every node asks for the most links, so the arena runs out
+    // long before the list is full. Fill it twice to check Clear too. Each
+    // key is put twice and the newer value must be the one found.
+    const int capacity = 1000;
+    SkipList list(capacity, 0);
+    std::vector<kv_key_t> keys = makeRandomKeys(capacity / 2);
+    kv_val_t older, newer;
+    string2value("older", older);
+    string2value("newer", newer);
+    bool success = true;
+    for (int round = 0; round < 2; round++)
+    {
+        list.Clear();
+        for (int i = 0; i < keys.size(); i++)
+        {
+            list.Insert(keys[i], older);
+            list.Insert(keys[i], newer);
+        }
+
+        kv_val_t val;
+        for (int i = 0; i < keys.size(); i++)
+        {
+            if (!list.Find(keys[i], val) || val != newer)
+                success = false;
+        }
+
+        int count = 0;
+        kv_key_t last = 0;
+        for (int node = list.First(); node != SkipList::END; node = list.Next(node))
+        {
+            if (count > 0 && list.Key(node) < last)
+                success = false;
+            last = list.Key(node);
+            count++;
+        }
+        if (count != capacity || list.Count() != capacity)
+            success = false;
+    }
+
+    std::cout
+        << " " << (success ? "Success" : "Failure")
+        << std::endl;
+}
+
+void testWideKeys(const Options& options)
+{
+    std::cout << std::endl << "TestWideKeys " << sizeof(kv_key_t) * 8;
+
+    // Spread the keys from KEY_MIN to KEY_MAX, so they need every bit of the
+    // key and the partition fences and learned index see the ends of the
+    // range. Looking up each key plus the offset must miss; with 64-bit keys
+    // that key has the same low 32 bits as the one which was put.
+    const int n = 1000;
+    const kv_key_t stride = (KEY_MAX / n) * 2;
+#if KV_KEY_BITS == 64
+    const kv_key_t offset = (kv_key_t)1 << 32;
+#else
+    const kv_key_t offset = 1;
+#endif
+    std::vector<kv_key_t> order = makeRandomKeys(n);
+    std::vector<kv_key_t> keys(n + 1);
+    for (int i = 0; i < n; i++)
+    {
+        keys[i] = KEY_MIN + (order[i] / 2) * stride;
+    }
+    keys[n] = KEY_MAX;
+
+    Options reopen = options;
+    bool success = true;
+    {
+        Store kv(options);
+        for (int i = 0; i < keys.size(); i++)
+        {
+            kv.Put(keys[i], std::to_string(keys[i]));
+        }
+        for (int i = 0; i < n; i++)
+        {
+            if (kv.Contains(keys[i] + offset))
+                success = false;
+        }
+
+        // Scan the whole range. Every key must come back once, in order.
+        int count = 0;
+        kv_key_t last = KEY_MIN;
+        Iterator it = kv.Scan(KEY_MIN, KEY_MAX);
+        while (it.HasNext())
+        {
+            kv_key_t key;
+            std::string val;
+            it.Next(key, val);
+            if ((count > 0 && key <= last) || val != std::to_string(key))
+                success = false;
+            last = key;
+            count++;
+        }
+        if (count != keys.size() || last != KEY_MAX)
+            success = false;
+    }
+
+    // Reopen the store. Every key should still be there with its value.
+    reopen.reopen = true;
+    Store kv(reopen);
+    for (int i = 0; i < keys.size(); i++)
+    {
+        std::string val;
+        if (!kv.Get(keys[i], val) || val.compare(std::to_string(keys[i])) != 0)
+            success = false;
+    }
+
+    std::cout
+        << " " << (success ? "Success" : "Failure")
+        << " " << describe(options)
+        << " " << kv.Count()
+        << std::endl;
+}
+
+void testConcurrent(const Options& options)
+{
+    std::cout << std::endl << "TestConcurrent";
+
+    Store kv(options);
+    std::vector<kv_key_t> keys = makeRandomKeys(20000);
+    std::atomic<int> done(0);
+    std::atomic<int> lookups(0);
+    std::atomic<bool> failed(false);
+
+    // Each reader looks up a key which has already been put, and a key which
+    // is never put, until the writer is done.
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; t++)
+    {
+        readers.push_back(std::thread([&, t]()
+        {
+            unsigned int seed = t;
+            while (done < keys.size() && !failed)
+            {
+                int count = done;
+                if (count == 0)
+                    continue;
+                kv_key_t key = keys[rand_r(&seed) % count];
+                std::string val;
+                if (!kv.Get(key, val) || val != std::to_string(key) || kv.Get(-key - 1, val))
+                    failed = true;
+                lookups++;
+            }
+        }));
+    }
+
+    // Each key must be counted once while merges run under the puts.
+    for (int i = 0; i < keys.size(); i++)
+    {
+        kv.Put(keys[i], std::to_string(keys[i]));
+        if (kv.Count() != i + 1)
+            failed = true;
+        done++;
+    }
+    for (int t = 0; t < readers.size(); t++)
+    {
+        readers[t].join();
+    }
+
+    std::cout
+        << " " << (failed ? "Failure" : "Success")
+        << " " << describe(options)
+        << " " << lookups << " lookups"
+        << std::endl;
+}
+
+void testSharded(int shards)
+{
+    std::cout << std::endl << "TestSharded";
+
+    Options options;
+    options.size = 64;
+    options.dir = "data/shards";
+    std::vector<kv_key_t> keys = makeRandomKeys(5000);
+    bool success = true;
+
+    // Put the keys, and then update every other one. Lookups made straight
+    // after the puts find the values which are still queued.
+    {
+        ShardedStore kv(options, shards);
+        for (int i = 0; i < keys.size(); i++)
+        {
+            kv.Put(keys[i], std::to_string(keys[i]));
+        }
+        std::vector<kv_key_t> updated;
+        std::vector<std::string> updatedVals;
+        for (int i = 0; i < keys.size(); i += 2)
+        {
+            updated.push_back(keys[i]);
+            updatedVals.push_back("new " + std::to_string(keys[i]));
+        }
+        kv.Put(updated, updatedVals);
+
+        for (int i = 0; i < keys.size(); i++)
+        {
+            std::string val;
+            std::string expected = (i % 2 ? "" : "new ") + std::to_string(keys[i]);
+            if (!kv.Get(keys[i], val) || val != expected)
+                success = false;
+        }
+
+        // Look up the keys, and a key which was never put, in one batch.
+        std::vector<kv_key_t> batch(keys);
+        batch.push_back(-1);
+        std::vector<std::string> vals;
+        std::vector<bool> found;
+        kv.MultiGet(batch, vals, found);
+        for (int i = 0; i < keys.size(); i++)
+        {
+            std::string expected = (i % 2 ? "" : "new ") + std::to_string(keys[i]);
+            if (!found[i] || vals[i] != expected)
+                success = false;
+        }
+        if (found.back())
+            success = false;
+    }
+
+    // Reopen the shards. Every key should still have its newest value.
+    options.reopen = true;
+    ShardedStore kv(options, shards);
+    for (int i = 0; i < keys.size(); i++)
+    {
+        std::string val;
+        std::string expected = (i % 2 ? "" : "new ") + std::to_string(keys[i]);
+        if (!kv.Get(keys[i], val) || val != expected)
+            success = false;
+    }
+
+    std::cout
+        << " " << (success ? "Success" : "Failure")
+        << " " << describe(options)
+        << " shards " << shards
+        << std::endl;
+}
+
+void testShardedLogFailure()
+{
+    std::cout << std::endl << "TestShardedLogFailure";
+
+    Options options;
+    options.size = 64;
+    options.wal = true;
+    options.dir = "data/shardfail";
+    std::filesystem::remove_all(options.dir);
+
+    // Fill a sharded store in a child process which can't write files past
+    // 1000 bytes, so the shards' logs fail. Wait must report it, and so must
+    // puts made after it.
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        signal(SIGXFSZ, SIG_IGN);
+        rlimit limit = {1000, 1000};
+        setrlimit(RLIMIT_FSIZE, &limit);
+        ShardedStore* failing = new ShardedStore(options, 2);
+        std::vector<kv_key_t> keys = makeRandomKeys(1000);
+        std::vector<std::string> vals;
+        for (int i = 0; i < keys.size(); i++)
+        {
+            failing->Put(keys[i], std::to_string(keys[i]));
+            vals.push_back(std::to_string(keys[i]));
+        }
+        if (failing->Wait())
+            _exit(1);
+        _exit(failing->Put(keys, vals) ? 1 : 0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    bool success = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    // Shards whose logs work report their puts as done.
+    std::filesystem::remove_all(options.dir);
+    {
+        ShardedStore kv(options, 2);
+        if (!kv.Put(1, "1") || !kv.Wait())
+            success = false;
+    }
+
+    std::cout
+        << " " << (success ? "Success" : "Failure")
+        << std::endl;
+}
+
+void testSplitMerge(const Options& options)
+{
+    std::cout << std::endl << "TestSplitMerge";
+
+    // Put the keys, updating an earlier key after every other one so there
+    // are copies of keys at every level, in a store which merges on one
+    // thread and one which splits big merges over four threads.
+    std::vector<kv_key_t> keys = makeRandomKeys(20000);
+    std::string dirs[] = {"data/serial", "data/split"};
+    for (int s = 0; s < 2; s++)
+    {
+        Options storeOptions = options;
+        storeOptions.mergeThreads = s == 0 ? 1 : 4;
+        fillStore(storeOptions, dirs[s], keys);
+    }
+
+    // The stores must have the same files, with the same contents. This
+    // includes the bloom filters, fence posts and learned indexes.
+    bool success = sameFiles(dirs[0], dirs[1]);
+
+    std::cout
+        << " " << (success ? "Success" : "Failure")
+        << " " << describe(options)
+        << std::endl;
+}
+
+void testIoUring(const Options& options)
+{
+    std::cout << std::endl << "TestIoUring";
+
+    // Fill a store with blocking merges and one whose merges read ahead and
+    // write behind with io_uring. The pages are small so the rings wrap
+    // around many times.
+    std::vector<kv_key_t> keys = makeRandomKeys(20000);
+    std::string dirs[] = {"data/serial", "data/ring"};
+    for (int s = 0; s < 2; s++)
+    {
+        Options storeOptions = options;
+        storeOptions.ioUring = s == 1;
+        fillStore(storeOptions, dirs[s], keys);
+    }
+    bool success = sameFiles(dirs[0], dirs[1]);
+
+    Options ringOptions = options;
+    ringOptions.ioUring = true;
+    std::cout
+        << " " << (success ? "Success" : "Failure")
+        << " " << describe(ringOptions)
+        << std::endl;
+}
+
+void testDirectIo(const Options& options)
+{
+    std::cout << std::endl << "TestDirectIo";
+
+    // Fill a store with buffered merges and one whose merges use direct I/O.
+    // The pages are 1024 items so they are aligned for direct I/O. Split
+    // merges start and end their ranges part way through pages.
+    std::vector<kv_key_t> keys = makeRandomKeys(20000);
+    std::string dirs[] = {"data/serial", "data/direct"};
+    for (int s = 0; s < 2; s++)
+    {
+        Options storeOptions = options;
+        storeOptions.directIo = s == 1;
+        fillStore(storeOptions, dirs[s], keys);
+    }
+    bool success = sameFiles(dirs[0], dirs[1]);
+
+    Options directOptions = options;
+    directOptions.directIo = true;
+    std::cout
+        << " " << (success ? "Success" : "Failure")
+        << " " << describe(directOptions)
+        << std::endl;
+}
+
+void testPrefetch(const Options& options)
+{
+    std::cout << std::endl << "TestPrefetch";
+
+    // Fill a store with merges which read each page when they need it, and
+    // one whose merges read pages ahead on helper threads. The pages are
+    // small so the helpers wrap around their buffers many times.
+    std::vector<kv_key_t> keys = makeRandomKeys(20000);
+    std::string dirs[] = {"data/serial", "data/prefetch"};
+    for (int s = 0; s < 2; s++)
+    {
+        Options storeOptions = options;
+        storeOptions.prefetch = s == 0 ? 0 : options.prefetch;
+        fillStore(storeOptions, dirs[s], keys);
+    }
+    bool success = sameFiles(dirs[0], dirs[1]);
+
+    std::cout
+        << " " << (success ? "Success" : "Failure")
+        << " " << describe(options)
+        << std::endl;
+}
+
+/**
+ * Put keys in a new store in a directory, updating an earlier key after every
+ * other one so there are copies of keys at every level.
+ */
+void fillStore(const Options& options, std::string dir, const std::vector<kv_key_t>& keys)
+{
+    Options storeOptions = options;
+    storeOptions.dir = dir;
+    std::filesystem::remove_all(dir);
+    Store kv(storeOptions);
+    for (int i = 0; i < keys.size(); i++)
+    {
+        kv.Put(keys[i], std::to_string(keys[i]));
+        if (i % 2 == 1)
+            kv.Put(keys[i / 2], "new " + std::to_string(i));
+    }
+}
+
+/**
+ * Do two directories have the same files, with the same contents.
+ */
+bool sameFiles(std::string dir1, std::string dir2)
+{
+    auto read = [](std::string filename)
+    {
+        std::ifstream input(filename, std::ifstream::binary);
+        std::stringstream contents;
+        contents << input.rdbuf();
+        return contents.str();
+    };
+    bool success = true;
+    int files = 0;
+    for (auto& entry : std::filesystem::directory_iterator(dir1))
+    {
+        std::string name = entry.path().filename();
+        if (!std::filesystem::exists(dir2 + "/" + name) ||
+            read(dir1 + "/" + name) != read(dir2 + "/" + name))
+        {
+            success = false;
+        }
+        files++;
+    }
+    for (auto& entry : std::filesystem::directory_iterator(dir2))
+    {
+        files--;
+    }
+    return success && files == 0;
+}